@@ -30,11 +30,26 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <QApplication>
 #include <QCommandLineParser>
 #include <QCursor>
+#include <QDialog>
+#include <QDialogButtonBox>
+#include <QFile>
+#include <QFileDialog>
+#include <QHeaderView>
+#include <QIcon>
+#include <QInputDialog>
 #include <QKeyEvent>
+#include <QLocale>
 #include <QMenuBar>
+#include <QPushButton>
+#include <QSaveFile>
+#include <QSharedPointer>
 #include <QShortcut>
 #include <QStyle>
 #include <QButtonGroup>
+#include <QTableWidget>
+#include <QTextStream>
+#include <QThread>
+#include <QVBoxLayout>
 
 #include <KAboutData>
 #include <KAcceleratorManager>
@@ -48,10 +63,17 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <Kdelibs4ConfigMigrator>
 #include <KCrash>
 
+#include "kcalc_batch.h"
 #include "kcalc_bitset.h"
 #include "kcalc_const_menu.h"
 #include "kcalc_settings.h"
+#include "kcalc_factor.h"
+#include "kcalc_import.h"
+#include "kcalc_optimizer.h"
+#include "kcalc_preview.h"
+#include "kcalc_server.h"
 #include "kcalc_statusbar.h"
+#include "kcalc_table.h"
 /* #include "kcalcdisplay.h" */
 #include "kcalcdisplay2.h"
 
@@ -72,7 +94,10 @@ KCalculator::KCalculator(QWidget *parent) :
 		memory_num_(0.0),
         constants_menu_(nullptr),
         constants_(nullptr),
-		core() {
+		core(CalcEngine::Settings{KCalcSettings::repeatLastOperation()}),
+		executor_(new KCalcExecutor(this)),
+		factor_(nullptr),
+		import_(nullptr) {
 
 	// central widget to contain all the elements
 	QWidget *const central = new QWidget(this);
@@ -153,6 +178,34 @@ KCalculator::KCalculator(QWidget *parent) :
 
 	calc_display->setFocus();
     parser.addDefaultParser();
+    connect(&parser, &KCalcParser::functionDefined, this, [this](const QString &name) {
+        statusBar()->showMessage(i18n("Function %1 defined", name), 3000);
+    });
+
+    // cached results may depend on any setting
+    connect(KCalcSettings::self(), &KCalcSettings::configChanged, this, [this]() {
+        parser.resultCache().invalidate();
+    });
+
+    // long calculations run on a worker thread
+    connect(executor_, &KCalcExecutor::busyChanged, this, [this](bool busy) {
+        statusBar()->setBusyIndicator(busy);
+        action_cancel_->setEnabled(busy);
+    });
+
+    // evaluate what is typed in the background and show it below the input
+    preview_ = new KCalcPreview(parser, this);
+    connect(calc_display, &KCalcDisplay2::textChanged, preview_, &KCalcPreview::setExpression);
+    connect(preview_, &KCalcPreview::cleared, calc_display, [this]() {
+        calc_display->setPreview(QString());
+    });
+    connect(preview_, &KCalcPreview::resultReady, calc_display, [this](const KNumber &result) {
+        calc_display->setPreview(QLatin1String("= ") + calc_display->formatNumber(result, parser.getNumBase()));
+    });
+
+    // every change of the input is a step to undo
+    connect(calc_display, &KCalcDisplay2::textChanged, this, &KCalculator::recordState);
+    recordState();
 }
 
 //------------------------------------------------------------------------------
@@ -161,6 +214,9 @@ KCalculator::KCalculator(QWidget *parent) :
 //------------------------------------------------------------------------------
 KCalculator::~KCalculator() {
 
+	// stop the worker before the core it works on goes away
+	delete executor_;
+
 	KCalcSettings::self()->save();
 }
 
@@ -171,15 +227,49 @@ KCalculator::~KCalculator() {
 void KCalculator::setupMainActions() {
 
 	// file menu
+	QAction *const action_import = actionCollection()->addAction(QStringLiteral("import_statistics"));
+	action_import->setText(i18n("&Import Statistic Data..."));
+	action_import->setIcon(QIcon::fromTheme(QStringLiteral("document-import")));
+	connect(action_import, &QAction::triggered, this, &KCalculator::slotStatImportData);
+
 	KStandardAction::quit(this, SLOT(close()), actionCollection());
 
 	// edit menu
-	/* KStandardAction::undo(calc_display, SLOT(slotHistoryBack()), actionCollection()); */
-	/* KStandardAction::redo(calc_display, SLOT(slotHistoryForward()), actionCollection()); */
+	action_undo_ = KStandardAction::undo(this, SLOT(slotUndo()), actionCollection());
+	action_redo_ = KStandardAction::redo(this, SLOT(slotRedo()), actionCollection());
+	action_undo_->setEnabled(false);
+	action_redo_->setEnabled(false);
 	KStandardAction::cut(calc_display, SLOT(cut()), actionCollection());
 	KStandardAction::copy(calc_display, SLOT(copy()), actionCollection());
 	KStandardAction::paste(calc_display, SLOT(paste()), actionCollection());
 
+	action_cancel_ = actionCollection()->addAction(QStringLiteral("cancel_calculation"));
+	action_cancel_->setText(i18n("Cancel Calculation"));
+	action_cancel_->setIcon(QIcon::fromTheme(QStringLiteral("process-stop")));
+	action_cancel_->setEnabled(false);
+	actionCollection()->setDefaultShortcut(action_cancel_, QKeySequence(Qt::CTRL + Qt::Key_Pause));
+	connect(action_cancel_, &QAction::triggered, this, [this]() {
+		executor_->cancel();
+		if (factor_) {
+			factor_->cancel();
+		}
+		if (import_) {
+			import_->cancel();
+		}
+		statusBar()->showMessage(i18n("Calculation canceled"), 3000);
+	});
+
+	action_macro_record_ = actionCollection()->add<KToggleAction>(QStringLiteral("macro_record"));
+	action_macro_record_->setText(i18n("&Record Macro"));
+	action_macro_record_->setIcon(QIcon::fromTheme(QStringLiteral("media-record")));
+	connect(action_macro_record_, &KToggleAction::toggled, this, &KCalculator::slotMacroRecordtoggled);
+
+	action_macro_run_ = actionCollection()->addAction(QStringLiteral("macro_run"));
+	action_macro_run_->setText(i18n("R&un Macro"));
+	action_macro_run_->setIcon(QIcon::fromTheme(QStringLiteral("media-playback-start")));
+	action_macro_run_->setEnabled(false);
+	connect(action_macro_run_, &QAction::triggered, this, &KCalculator::slotMacroRunclicked);
+
 	// mode menu
 	QActionGroup *modeGroup = new QActionGroup(this);
 
@@ -403,25 +493,44 @@ void KCalculator::setupLogicKeys() {
 	logic_buttons_.append(pbRsh);
 	logic_buttons_.append(pbCmp);
 
+	// number theory on the shifted keys, inserted as functions
+	pbAND->addMode(ModeNormal, i18nc("Bitwise AND", "AND"), i18n("Bitwise AND"));
+	pbAND->addMode(ModeShift, i18nc("Greatest common divisor", "GCD"), i18n("Greatest common divisor"));
+	connect(this, &KCalculator::switchMode, pbAND, &KCalcButton::slotSetMode);
 	pbAND->setShortcut(QKeySequence(Qt::Key_Ampersand));
 	connect(this, &KCalculator::switchShowAccels, pbAND, &KCalcButton::slotSetAccelDisplayMode);
 	connect(pbAND, &KCalcButton::clicked, this, &KCalculator::slotANDclicked);
 
+	pbOR->addMode(ModeNormal, i18nc("Bitwise OR", "OR"), i18n("Bitwise OR"));
+	pbOR->addMode(ModeShift, i18nc("Least common multiple", "LCM"), i18n("Least common multiple"));
+	connect(this, &KCalculator::switchMode, pbOR, &KCalcButton::slotSetMode);
 	pbOR->setShortcut(QKeySequence(Qt::Key_Bar));
 	connect(this, &KCalculator::switchShowAccels, pbOR, &KCalcButton::slotSetAccelDisplayMode);
 	connect(pbOR, &KCalcButton::clicked, this, &KCalculator::slotORclicked);
 
+	pbXOR->addMode(ModeNormal, i18nc("Bitwise XOR", "XOR"), i18n("Bitwise XOR"));
+	pbXOR->addMode(ModeShift, i18nc("Modular exponentiation", "PowMod"), i18n("Modular exponentiation"));
+	connect(this, &KCalculator::switchMode, pbXOR, &KCalcButton::slotSetMode);
 	connect(this, &KCalculator::switchShowAccels, pbXOR, &KCalcButton::slotSetAccelDisplayMode);
 	connect(pbXOR, &KCalcButton::clicked, this, &KCalculator::slotXORclicked);
 
+	pbLsh->addMode(ModeNormal, i18nc("Left bit shift", "Lsh"), i18n("Left bit shift"));
+	pbLsh->addMode(ModeShift, i18nc("Modular inverse", "InvMod"), i18n("Modular inverse"));
+	connect(this, &KCalculator::switchMode, pbLsh, &KCalcButton::slotSetMode);
 	pbLsh->setShortcut(QKeySequence(Qt::Key_Less));
 	connect(this, &KCalculator::switchShowAccels, pbLsh, &KCalcButton::slotSetAccelDisplayMode);
 	connect(pbLsh, &KCalcButton::clicked, this, &KCalculator::slotLeftShiftclicked);
 
+	pbRsh->addMode(ModeNormal, i18nc("Right bit shift", "Rsh"), i18n("Right bit shift"));
+	pbRsh->addMode(ModeShift, i18nc("Next prime", "NextPr"), i18n("Next prime"));
+	connect(this, &KCalculator::switchMode, pbRsh, &KCalcButton::slotSetMode);
 	pbRsh->setShortcut(QKeySequence(Qt::Key_Greater));
 	connect(this, &KCalculator::switchShowAccels, pbRsh, &KCalcButton::slotSetAccelDisplayMode);
 	connect(pbRsh, &KCalcButton::clicked, this, &KCalculator::slotRightShiftclicked);
 
+	pbCmp->addMode(ModeNormal, i18nc("One's complement", "Cmp"), i18n("One's complement"));
+	pbCmp->addMode(ModeShift, i18nc("Primality test", "Prime?"), i18n("Primality test"));
+	connect(this, &KCalculator::switchMode, pbCmp, &KCalcButton::slotSetMode);
 	pbCmp->setShortcut(QKeySequence(Qt::Key_AsciiTilde));
 	connect(this, &KCalculator::switchShowAccels, pbCmp, &KCalcButton::slotSetAccelDisplayMode);
 	connect(pbCmp, &KCalcButton::clicked, this, &KCalculator::slotNegateclicked);
@@ -756,6 +865,9 @@ void KCalculator::slotBaseSelected(int base) {
 	}
 
     const int current_base = parser.getNumBase();
+	if (recorder_) {
+		recorder_->setBase(parser.getNumBase());
+	}
 	// Enable the buttons available in this base
 	for (int i = 0; i < current_base; ++i) {
 		(num_button_group_->buttons()[i])->setEnabled(true);
@@ -850,6 +962,7 @@ void KCalculator::slotAngleSelected(int mode) {
 		angle_mode_ = RadMode;
 	}
 
+	parser.setAngleMode(::AngleMode(angle_mode_));
 	KCalcSettings::setAngleMode(angle_mode_);
 }
 
@@ -859,6 +972,9 @@ void KCalculator::slotAngleSelected(int mode) {
 //------------------------------------------------------------------------------
 void KCalculator::slotEEclicked() {
     calc_display->insert(QString(QLatin1Char('e')));
+	if (recorder_) {
+		recorder_->exponent();
+	}
 }
 
 //------------------------------------------------------------------------------
@@ -925,7 +1041,9 @@ void KCalculator::slotMemStoreclicked() {
 void KCalculator::slotNumberclicked(int number_clicked) {
 
 	calc_display->insert(KNumber(number_clicked), parser.getNumBase());
-	core.setOnlyUpdateOperation(false);
+	if (recorder_) {
+		recorder_->digit(number_clicked);
+	}
 }
 
 //------------------------------------------------------------------------------
@@ -938,8 +1056,10 @@ void KCalculator::slotSinclicked() {
 		// sinh or arsinh
 		if (!shift_mode_) {
 			/* core.SinHyp(calc_display->getAmount()); */
+			recordFunction(KCalcMacro::SinHyp);
 		} else {
 			/* core.AreaSinHyp(calc_display->getAmount()); */
+			recordFunction(KCalcMacro::AreaSinHyp);
 		}
 	} else {
 		// sine or arcsine
@@ -947,14 +1067,17 @@ void KCalculator::slotSinclicked() {
 			switch (angle_mode_) {
 			case DegMode:
 				/* core.SinDeg(calc_display->getAmount()); */
+				recordFunction(KCalcMacro::SinDeg);
                 calc_display->insert(QStringLiteral("sin("));
 				break;
 			case RadMode:
 				/* core.SinRad(calc_display->getAmount()); */
+				recordFunction(KCalcMacro::SinRad);
                 calc_display->insert(QStringLiteral("sin("));
 				break;
 			case GradMode:
 				/* core.SinGrad(calc_display->getAmount()); */
+				recordFunction(KCalcMacro::SinGrad);
                 calc_display->insert(QStringLiteral("sin("));
 				break;
 			}
@@ -962,12 +1085,15 @@ void KCalculator::slotSinclicked() {
 			switch (angle_mode_) {
 			case DegMode:
 				/* core.ArcSinDeg(calc_display->getAmount()); */
+				recordFunction(KCalcMacro::ArcSinDeg);
 				break;
 			case RadMode:
 				/* core.ArcSinRad(calc_display->getAmount()); */
+				recordFunction(KCalcMacro::ArcSinRad);
 				break;
 			case GradMode:
 				/* core.ArcSinGrad(calc_display->getAmount()); */
+				recordFunction(KCalcMacro::ArcSinGrad);
 				break;
 			}
 		}
@@ -982,6 +1108,9 @@ void KCalculator::slotSinclicked() {
 //------------------------------------------------------------------------------
 void KCalculator::slotPlusMinusclicked() {
 
+	// a macro inverts whatever it has, typed or not
+	recordFunction(KCalcMacro::InvertSign);
+
 	// display can only change sign, when in input mode, otherwise we
 	// need the core to do this.
 	if (!calc_display->sendEvent(KCalcDisplay2::EventChangeSign)) {
@@ -1022,8 +1151,10 @@ void KCalculator::slotCosclicked() {
 		// cosh or arcosh
 		if (!shift_mode_) {
 			/* core.CosHyp(calc_display->getAmount()); */
+			recordFunction(KCalcMacro::CosHyp);
 		} else {
 			/* core.AreaCosHyp(calc_display->getAmount()); */
+			recordFunction(KCalcMacro::AreaCosHyp);
 		}
 	} else {
 		// cosine or arccosine
@@ -1031,24 +1162,30 @@ void KCalculator::slotCosclicked() {
 			switch (angle_mode_) {
 			case DegMode:
 				/* core.CosDeg(calc_display->getAmount()); */
+				recordFunction(KCalcMacro::CosDeg);
 				break;
 			case RadMode:
 				/* core.CosRad(calc_display->getAmount()); */
+				recordFunction(KCalcMacro::CosRad);
 				break;
 			case GradMode:
 				/* core.CosGrad(calc_display->getAmount()); */
+				recordFunction(KCalcMacro::CosGrad);
 				break;
 			}
 		} else {
 			switch (angle_mode_) {
 			case DegMode:
 				/* core.ArcCosDeg(calc_display->getAmount()); */
+				recordFunction(KCalcMacro::ArcCosDeg);
 				break;
 			case RadMode:
 				/* core.ArcCosRad(calc_display->getAmount()); */
+				recordFunction(KCalcMacro::ArcCosRad);
 				break;
 			case GradMode:
 				/* core.ArcCosGrad(calc_display->getAmount()); */
+				recordFunction(KCalcMacro::ArcCosGrad);
 				break;
 			}
 		}
@@ -1065,8 +1202,11 @@ void KCalculator::slotReciclicked() {
 
 	if (shift_mode_) {
 		/* core.enterOperation(calc_display->getAmount(), CalcEngine::FUNC_BINOM); */
+		recordOperation(CalcEngine::FUNC_BINOM);
+		insertOperator(KCalcOperators::BINOM);
 	} else {
 		/* core.Reciprocal(calc_display->getAmount()); */
+		recordFunction(KCalcMacro::Reciprocal);
 		updateDisplay(UPDATE_FROM_CORE);
 		return;
 	}
@@ -1088,8 +1228,10 @@ void KCalculator::slotTanclicked() {
 		// tanh or artanh
 		if (!shift_mode_) {
 			/* core.TangensHyp(calc_display->getAmount()); */
+			recordFunction(KCalcMacro::TangensHyp);
 		} else {
 			/* core.AreaTangensHyp(calc_display->getAmount()); */
+			recordFunction(KCalcMacro::AreaTangensHyp);
 		}
 	} else {
 		// tan or arctan
@@ -1097,24 +1239,30 @@ void KCalculator::slotTanclicked() {
 			switch (angle_mode_) {
 			case DegMode:
 				/* core.TangensDeg(calc_display->getAmount()); */
+				recordFunction(KCalcMacro::TangensDeg);
 				break;
 			case RadMode:
 				/* core.TangensRad(calc_display->getAmount()); */
+				recordFunction(KCalcMacro::TangensRad);
 				break;
 			case GradMode:
 				/* core.TangensGrad(calc_display->getAmount()); */
+				recordFunction(KCalcMacro::TangensGrad);
 				break;
 			}
 		} else {
 			switch (angle_mode_) {
 			case DegMode:
 				/* core.ArcTangensDeg(calc_display->getAmount()); */
+				recordFunction(KCalcMacro::ArcTangensDeg);
 				break;
 			case RadMode:
 				/* core.ArcTangensRad(calc_display->getAmount()); */
+				recordFunction(KCalcMacro::ArcTangensRad);
 				break;
 			case GradMode:
 				/* core.ArcTangensGrad(calc_display->getAmount()); */
+				recordFunction(KCalcMacro::ArcTangensGrad);
 				break;
 			}
 		}
@@ -1129,17 +1277,17 @@ void KCalculator::slotTanclicked() {
 //------------------------------------------------------------------------------
 void KCalculator::slotFactorialclicked() {
 
-    // Set WaitCursor, as this operation may take looooong
-    // time and UI frezes with large numbers. User needs some
-    // visual feedback.
-    QApplication::setOverrideCursor(QCursor(Qt::WaitCursor));
+	// evaluated with the rest of the expression on the worker thread,
+	// large numbers take long but do not freeze the UI
 	if (!shift_mode_) {
 	    /* core.Factorial(calc_display->getAmount()); */
+	    recordFunction(KCalcMacro::Factorial);
+		calc_display->insert(QStringLiteral("!"));
 	} else {
 		/* core.Gamma(calc_display->getAmount()); */
+		recordFunction(KCalcMacro::Gamma);
 	}
-    QApplication::restoreOverrideCursor();
-    updateDisplay(UPDATE_FROM_CORE);
+    updateDisplay({});
 }
 
 //------------------------------------------------------------------------------
@@ -1150,8 +1298,10 @@ void KCalculator::slotLogclicked() {
 
 	if (!shift_mode_) {
 		/* core.Log10(calc_display->getAmount()); */
+		recordFunction(KCalcMacro::Log10);
 	} else {
 		/* core.Exp10(calc_display->getAmount()); */
+		recordFunction(KCalcMacro::Exp10);
 	}
 
 	updateDisplay(UPDATE_FROM_CORE);
@@ -1165,8 +1315,10 @@ void KCalculator::slotSquareclicked() {
 
 	if (!shift_mode_) {
 		/* core.Square(calc_display->getAmount()); */
+		recordFunction(KCalcMacro::Square);
 	} else {
 		/* core.SquareRoot(calc_display->getAmount()); */
+		recordFunction(KCalcMacro::SquareRoot);
 	}
 
     calc_display->insert(QStringLiteral("^2")); // TODO
@@ -1181,8 +1333,10 @@ void KCalculator::slotCubeclicked() {
 
 	if (!shift_mode_) {
 		/* core.Cube(calc_display->getAmount()); */
+		recordFunction(KCalcMacro::Cube);
 	} else {
 		/* core.CubeRoot(calc_display->getAmount()); */
+		recordFunction(KCalcMacro::CubeRoot);
 	}
 
     calc_display->insert(QStringLiteral("^3")); // TODO
@@ -1197,8 +1351,10 @@ void KCalculator::slotLnclicked() {
 
 	if (!shift_mode_) {
 		/* core.Ln(calc_display->getAmount()); */
+		recordFunction(KCalcMacro::Ln);
 	} else {
 		/* core.Exp(calc_display->getAmount()); */
+		recordFunction(KCalcMacro::Exp);
 	}
 
 	updateDisplay(UPDATE_FROM_CORE);
@@ -1212,14 +1368,17 @@ void KCalculator::slotPowerclicked() {
 
 	if (shift_mode_) {
 		/* core.enterOperation(calc_display->getAmount(), CalcEngine::FUNC_PWR_ROOT); */
+		recordOperation(CalcEngine::FUNC_PWR_ROOT);
+		insertOperator(KCalcOperators::PWR_ROOT);
 		pbShift->setChecked(false);
 	} else {
 		/* core.enterOperation(calc_display->getAmount(), CalcEngine::FUNC_POWER); */
+		recordOperation(CalcEngine::FUNC_POWER);
+		insertOperator(KCalcOperators::POWER);
 	}
 
 	// temp. work-around
 	/* KNumber tmp_num = calc_display->getAmount(); */
-    calc_display->insert(QStringLiteral("^")); // TODO
 	/* calc_display->setAmount(tmp_num); */
     updateDisplay({});
 }
@@ -1234,6 +1393,7 @@ void KCalculator::slotMemClearclicked() {
 	statusBar()->setMemoryIndicator(false);
 	calc_display->setStatusText(MemField, QString());
 	pbMemRecall->setDisabled(true);
+	recordState();
 }
 
 //------------------------------------------------------------------------------
@@ -1243,6 +1403,9 @@ void KCalculator::slotMemClearclicked() {
 void KCalculator::slotBackspaceclicked() {
 
     calc_display->backspace(); // TODO: Connect signals directly
+	if (recorder_) {
+		recorder_->backspace();
+	}
 }
 
 //------------------------------------------------------------------------------
@@ -1260,9 +1423,24 @@ void KCalculator::slotClearclicked() {
 //------------------------------------------------------------------------------
 void KCalculator::slotAllClearclicked() {
 
-	core.Reset();
-	calc_display->sendEvent(KCalcDisplay2::EventReset);
-	updateDisplay(UPDATE_FROM_CORE);
+	// pending results are stale now
+	executor_->cancel();
+	if (factor_) {
+		factor_->cancel();
+	}
+	if (import_) {
+		import_->cancel();
+	}
+	executor_->submit([this]() -> KCalcExecutor::Work {
+		calc_display->sendEvent(KCalcDisplay2::EventReset);
+		return [this](const QAtomicInt &) {
+			core.Reset();
+			core.setOnlyUpdateOperation(true);
+			return KNumber::Zero;
+		};
+	}, [this](const KNumber &) {
+		updateDisplay(UPDATE_FROM_CORE);
+	});
 }
 
 //------------------------------------------------------------------------------
@@ -1273,6 +1451,7 @@ void KCalculator::slotParenOpenclicked() {
 
     calc_display->insert(QStringLiteral("(")); // TODO
     /* core.ParenOpen(calc_display->getAmount()); */
+    recordFunction(KCalcMacro::ParenOpen);
 }
 
 //------------------------------------------------------------------------------
@@ -1283,6 +1462,7 @@ void KCalculator::slotParenCloseclicked() {
 
     calc_display->insert(QStringLiteral(")")); // TODO
     /* core.ParenClose(calc_display->getAmount()); */
+    recordParenClose();
     updateDisplay(UPDATE_FROM_CORE);
 }
 
@@ -1292,7 +1472,13 @@ void KCalculator::slotParenCloseclicked() {
 //------------------------------------------------------------------------------
 void KCalculator::slotANDclicked() {
 
-	/* core.enterOperation(calc_display->getAmount(), CalcEngine::FUNC_AND); */
+	if (shift_mode_) {
+		calc_display->insert(QStringLiteral("gcd("));
+	} else {
+		/* core.enterOperation(calc_display->getAmount(), CalcEngine::FUNC_AND); */
+		recordOperation(CalcEngine::FUNC_AND);
+		insertOperator(KCalcOperators::AND);
+	}
 	updateDisplay(UPDATE_FROM_CORE);
 }
 
@@ -1303,6 +1489,7 @@ void KCalculator::slotANDclicked() {
 void KCalculator::slotMultiplicationclicked() {
 
 	/* core.enterOperation(calc_display->getAmount(), CalcEngine::FUNC_MULTIPLY); */
+	recordOperation(CalcEngine::FUNC_MULTIPLY);
     calc_display->insert(QStringLiteral("*")); // TODO
 	updateDisplay(UPDATE_FROM_CORE);
 }
@@ -1314,6 +1501,7 @@ void KCalculator::slotMultiplicationclicked() {
 void KCalculator::slotDivisionclicked() {
 
     /* core.enterOperation(calc_display->getAmount(), CalcEngine::FUNC_DIVIDE); */
+    recordOperation(CalcEngine::FUNC_DIVIDE);
     calc_display->insert(QStringLiteral("/")); // TODO
     updateDisplay(UPDATE_FROM_CORE);
 }
@@ -1324,7 +1512,13 @@ void KCalculator::slotDivisionclicked() {
 //------------------------------------------------------------------------------
 void KCalculator::slotORclicked() {
 
-	/* core.enterOperation(calc_display->getAmount(), CalcEngine::FUNC_OR); */
+	if (shift_mode_) {
+		calc_display->insert(QStringLiteral("lcm("));
+	} else {
+		/* core.enterOperation(calc_display->getAmount(), CalcEngine::FUNC_OR); */
+		recordOperation(CalcEngine::FUNC_OR);
+		insertOperator(KCalcOperators::OR);
+	}
 	updateDisplay(UPDATE_FROM_CORE);
 }
 
@@ -1334,7 +1528,13 @@ void KCalculator::slotORclicked() {
 //------------------------------------------------------------------------------
 void KCalculator::slotXORclicked() {
 
-	/* core.enterOperation(calc_display->getAmount(), CalcEngine::FUNC_XOR); */
+	if (shift_mode_) {
+		calc_display->insert(QStringLiteral("powmod("));
+	} else {
+		/* core.enterOperation(calc_display->getAmount(), CalcEngine::FUNC_XOR); */
+		recordOperation(CalcEngine::FUNC_XOR);
+		insertOperator(KCalcOperators::XOR);
+	}
 	updateDisplay(UPDATE_FROM_CORE);
 }
 
@@ -1345,6 +1545,7 @@ void KCalculator::slotXORclicked() {
 void KCalculator::slotPlusclicked() {
 
 	/* core.enterOperation(calc_display->getAmount(), CalcEngine::FUNC_ADD); */
+	recordOperation(CalcEngine::FUNC_ADD);
     calc_display->insert(QStringLiteral("+")); // TODO
 	updateDisplay(UPDATE_FROM_CORE);
 }
@@ -1356,6 +1557,7 @@ void KCalculator::slotPlusclicked() {
 void KCalculator::slotMinusclicked() {
 
     /* core.enterOperation(calc_display->getAmount(), CalcEngine::FUNC_SUBTRACT); */
+    recordOperation(CalcEngine::FUNC_SUBTRACT);
     calc_display->insert(QStringLiteral("-")); // TODO
     updateDisplay(UPDATE_FROM_CORE);
 }
@@ -1366,7 +1568,13 @@ void KCalculator::slotMinusclicked() {
 //------------------------------------------------------------------------------
 void KCalculator::slotLeftShiftclicked() {
 
-	/* core.enterOperation(calc_display->getAmount(), CalcEngine::FUNC_LSH); */
+	if (shift_mode_) {
+		calc_display->insert(QStringLiteral("invmod("));
+	} else {
+		/* core.enterOperation(calc_display->getAmount(), CalcEngine::FUNC_LSH); */
+		recordOperation(CalcEngine::FUNC_LSH);
+		insertOperator(KCalcOperators::LSH);
+	}
 	updateDisplay(UPDATE_FROM_CORE);
 }
 
@@ -1376,7 +1584,13 @@ void KCalculator::slotLeftShiftclicked() {
 //------------------------------------------------------------------------------
 void KCalculator::slotRightShiftclicked() {
 
-    /* core.enterOperation(calc_display->getAmount(), CalcEngine::FUNC_RSH); */
+	if (shift_mode_) {
+		calc_display->insert(QStringLiteral("nextprime("));
+	} else {
+		/* core.enterOperation(calc_display->getAmount(), CalcEngine::FUNC_RSH); */
+		recordOperation(CalcEngine::FUNC_RSH);
+		insertOperator(KCalcOperators::RSH);
+	}
     updateDisplay(UPDATE_FROM_CORE);
 }
 
@@ -1389,6 +1603,9 @@ void KCalculator::slotPeriodclicked() {
 	// i know this isn't locale friendly, should be converted to appropriate
 	// value at lower levels
     calc_display->insert(QLocale().decimalPoint()); // TODO
+	if (recorder_) {
+		recorder_->point();
+	}
 }
 
 //------------------------------------------------------------------------------
@@ -1397,11 +1614,421 @@ void KCalculator::slotPeriodclicked() {
 //------------------------------------------------------------------------------
 void KCalculator::EnterEqual() {
 
-    const auto result = parser.parseExpression(calc_display->text());
-    // TODO if errors
-    calc_display->sendEvent(KCalcDisplay2::EventClear);
-    calc_display->insert(result, parser.getNumBase());
-    updateDisplay(UPDATE_FROM_CORE | UPDATE_STORE_RESULT);
+    // Prepared once all earlier results are in the display, the
+    // expression is then evaluated on the worker thread
+    executor_->submit([this]() -> KCalcExecutor::Work {
+        const QString text = calc_display->text();
+
+        // "=" after a function head like "f(x, y)" starts a definition,
+        // pressing it again defines the function
+        if (parser.isFunctionHead(text)) {
+            calc_display->insert(QStringLiteral(" = "));
+            return KCalcExecutor::Work();
+        }
+
+        if (parser.defineFunction(text)) {
+            calc_display->sendEvent(KCalcDisplay2::EventClear);
+            return KCalcExecutor::Work();
+        }
+
+        if (KCalcTable::isTable(text)) {
+            showTable(text);
+            return KCalcExecutor::Work();
+        }
+
+        if (KCalcFactor::isFactorization(text)) {
+            showFactors(text);
+            return KCalcExecutor::Work();
+        }
+
+        // folding constants evaluates, so it is left to the worker
+        const bool optimize = parser.getOptimize();
+        parser.setOptimize(false);
+        QString key;
+        const auto program = parser.compile(text, key);
+        parser.setOptimize(optimize);
+        // TODO if errors
+
+        calc_display->sendEvent(KCalcDisplay2::EventClear);
+
+        // the result of the same expression under the same settings
+        KNumber cached;
+        if (!key.isEmpty() && parser.resultCache().find(key, cached)) {
+            pending_key_.clear();
+            return [cached](const QAtomicInt &) {
+                return cached;
+            };
+        }
+        pending_key_ = key;
+
+        const auto functions = parser.functions();
+        const QSharedPointer<KCalcOptimizer> optimizer(optimize ? new KCalcOptimizer(parser) : nullptr);
+
+        return [program, functions, optimizer](const QAtomicInt &canceled) {
+            return KCalcParser::run(optimizer ? optimizer->optimize(program) : program,
+                                    functions, QVector<KNumber>(), &canceled);
+        };
+    }, [this](const KNumber &result) {
+        if (!pending_key_.isEmpty()) {
+            parser.resultCache().insert(pending_key_, result);
+        }
+        showResult(result);
+        updateDisplay(UPDATE_FROM_CORE | UPDATE_STORE_RESULT);
+    });
+}
+
+//------------------------------------------------------------------------------
+// Name: insertOperator
+// Desc: types a key pad operator, words are kept apart from the operands
+//------------------------------------------------------------------------------
+void KCalculator::insertOperator(KCalcOperators::Id id) {
+
+	const QString symbol = QLatin1String(KCalcOperators::get(id).symbol);
+	if (symbol.at(0).isLetter()) {
+		calc_display->insert(QLatin1Char(' ') + symbol + QLatin1Char(' '));
+	} else {
+		calc_display->insert(symbol);
+	}
+}
+
+//------------------------------------------------------------------------------
+// Name: showResult
+// Desc: puts a result in front of what was typed while it was computed
+//------------------------------------------------------------------------------
+void KCalculator::showResult(const KNumber &result) {
+
+	calc_display->setCursorPosition(0);
+	calc_display->insert(result, parser.getNumBase());
+	calc_display->end(false);
+}
+
+//------------------------------------------------------------------------------
+// Name: enterStatFunction
+// Desc: runs a statistical function of the core on the worker thread
+//------------------------------------------------------------------------------
+void KCalculator::enterStatFunction(void (CalcEngine::*function)(const KNumber &), const QString &message) {
+
+	executor_->submit([this, function]() -> KCalcExecutor::Work {
+		calc_display->sendEvent(KCalcDisplay2::EventClear);
+		return [this, function](const QAtomicInt &) {
+			(core.*function)(KNumber::Zero);
+			// the next operation key replaces the pending one
+			core.setOnlyUpdateOperation(true);
+			bool error;
+			return core.lastOutput(error);
+		};
+	}, [this, message](const KNumber &result) {
+		showResult(result);
+		if (!message.isEmpty()) {
+			statusBar()->showMessage(message, 3000);
+		}
+		updateDisplay(UPDATE_FROM_CORE);
+	});
+}
+
+//------------------------------------------------------------------------------
+// Name: changeCore
+// Desc: runs a change of the core on the worker thread, after the
+//       calculations submitted before it
+//------------------------------------------------------------------------------
+void KCalculator::changeCore(const std::function<void()> &change) {
+
+	executor_->submit([change]() -> KCalcExecutor::Work {
+		return [change](const QAtomicInt &) {
+			change();
+			return KNumber::Zero;
+		};
+	});
+}
+
+//------------------------------------------------------------------------------
+// Name: recordOperation
+// Desc: adds an operation key to the macro being recorded
+//------------------------------------------------------------------------------
+void KCalculator::recordOperation(CalcEngine::Operation operation) {
+
+	if (recorder_) {
+		recorder_->enterOperation(operation);
+	}
+}
+
+//------------------------------------------------------------------------------
+// Name: recordFunction
+// Desc: adds a function key to the macro being recorded
+//------------------------------------------------------------------------------
+void KCalculator::recordFunction(KCalcMacro::Function function) {
+
+	if (recorder_) {
+		recorder_->apply(function);
+	}
+}
+
+//------------------------------------------------------------------------------
+// Name: recordParenClose
+// Desc: adds a closing bracket to the macro being recorded
+//------------------------------------------------------------------------------
+void KCalculator::recordParenClose() {
+
+	if (recorder_) {
+		recorder_->parenClose();
+	}
+}
+
+//------------------------------------------------------------------------------
+// Name: showTable
+// Desc: tabulates "table(expr, var, from, to, step)" in a dialog
+//------------------------------------------------------------------------------
+void KCalculator::showTable(const QString &text) {
+
+	QDialog *const dialog = new QDialog(this);
+	dialog->setAttribute(Qt::WA_DeleteOnClose);
+	dialog->setWindowTitle(text);
+
+	// owned by the dialog, the table stops its workers when destroyed
+	KCalcTable *const table = new KCalcTable(dialog);
+	if (!table->start(parser, text)) {
+		delete dialog;
+		statusBar()->showMessage(i18n("Invalid table expression"), 3000);
+		return;
+	}
+
+	QTableWidget *const view = new QTableWidget(0, 2, dialog);
+	view->setHorizontalHeaderLabels(QStringList() << table->variable() << table->expression());
+	view->horizontalHeader()->setStretchLastSection(true);
+	view->verticalHeader()->hide();
+	view->setEditTriggers(QAbstractItemView::NoEditTriggers);
+
+	QDialogButtonBox *const buttons = new QDialogButtonBox(QDialogButtonBox::Save | QDialogButtonBox::Close, dialog);
+	buttons->button(QDialogButtonBox::Save)->setEnabled(false);
+
+	QVBoxLayout *const layout = new QVBoxLayout(dialog);
+	layout->addWidget(view);
+	layout->addWidget(buttons);
+
+	// rows arrive in order while the rest is still being computed
+	QSharedPointer<QPair<QVector<KNumber>, QVector<KNumber>>> rows(new QPair<QVector<KNumber>, QVector<KNumber>>);
+	const int precision = KCalcSettings::precision();
+
+	connect(table, &KCalcTable::rowsReady, view, [view, rows, precision](qint64, const QVector<KNumber> &arguments, const QVector<KNumber> &results) {
+		int row = view->rowCount();
+		view->setRowCount(row + arguments.size());
+		for (int i = 0; i < arguments.size(); ++i, ++row) {
+			view->setItem(row, 0, new QTableWidgetItem(arguments.at(i).toQString(precision)));
+			view->setItem(row, 1, new QTableWidgetItem(results.at(i).toQString(precision)));
+		}
+		rows->first += arguments;
+		rows->second += results;
+	});
+
+	connect(table, &KCalcTable::finished, buttons, [buttons]() {
+		buttons->button(QDialogButtonBox::Save)->setEnabled(true);
+	});
+
+	connect(buttons, &QDialogButtonBox::rejected, dialog, &QDialog::close);
+	connect(buttons, &QDialogButtonBox::accepted, dialog, [dialog, rows, precision]() {
+		const QString fileName = QFileDialog::getSaveFileName(dialog, i18n("Save Table"), QString(), i18n("CSV files (*.csv)"));
+		if (fileName.isEmpty()) {
+			return;
+		}
+
+		QSaveFile file(fileName);
+		if (file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+			QTextStream stream(&file);
+			KCalcTable::writeCsv(stream, rows->first, rows->second, precision);
+			stream.flush();
+			file.commit();
+		}
+	});
+
+	dialog->resize(400, 500);
+	dialog->show();
+}
+
+//------------------------------------------------------------------------------
+// Name: showFactors
+// Desc: factors "factor(n)" into primes, the display gets the product
+//------------------------------------------------------------------------------
+void KCalculator::showFactors(const QString &text) {
+
+	// a factorization still running stops, primes it has queued go with it
+	delete factor_;
+	factor_ = new KCalcFactor(this);
+
+	QSharedPointer<QVector<KCalcFactor::Factor>> factors(new QVector<KCalcFactor::Factor>);
+	const auto format = [this](const KNumber &prime) {
+		return calc_display->formatNumber(prime, parser.getNumBase());
+	};
+
+	// primes show up below the input as soon as they are found
+	connect(factor_, &KCalcFactor::factorFound, factor_, [this, factors, format](const KNumber &prime, int exponent) {
+		factors->push_back(KCalcFactor::Factor{prime, exponent});
+		calc_display->setPreview(KCalcFactor::toString(*factors, format) + QStringLiteral(" * ..."));
+	});
+
+	connect(factor_, &KCalcFactor::finished, factor_, [this, factors, format](bool complete) {
+		action_cancel_->setEnabled(false);
+		calc_display->setPreview(QString());
+		if (complete) {
+			calc_display->setText(KCalcFactor::toString(*factors, format));
+		} else {
+			statusBar()->showMessage(i18n("Factorization canceled"), 3000);
+		}
+	});
+
+	if (!factor_->start(parser, text)) {
+		statusBar()->showMessage(i18n("Only integers can be factored"), 3000);
+		return;
+	}
+
+	action_cancel_->setEnabled(true);
+	calc_display->setPreview(i18n("Factoring..."));
+}
+
+//------------------------------------------------------------------------------
+// Name: recordState
+// Desc: adds the state of the calculator to the undo history
+//------------------------------------------------------------------------------
+void KCalculator::recordState() {
+
+	if (restoring_) {
+		return;
+	}
+
+	// The display belongs to this keystroke, later ones may change it
+	// before the job is prepared. The core is taken once the earlier
+	// calculations are done and before the later ones start, the worker
+	// does not touch it then; while it is idle that is right away.
+	KCalcHistory::State state;
+	state.input = calc_display->text();
+	state.cursor = calc_display->cursorPosition();
+	state.memory = memory_num_;
+
+	const auto record = [this](KCalcHistory::State &state) {
+		state.core = core.snapshot();
+		history_.record(state);
+
+		action_undo_->setEnabled(history_.canUndo());
+		action_redo_->setEnabled(history_.canRedo());
+	};
+
+	if (executor_->isIdle()) {
+		record(state);
+		return;
+	}
+
+	executor_->submit([record, state]() mutable -> KCalcExecutor::Work {
+		record(state);
+		return KCalcExecutor::Work();
+	});
+}
+
+//------------------------------------------------------------------------------
+// Name: restoreState
+// Desc: brings the display and memory back to a state of the undo
+//       history, returns the work bringing back the core
+//------------------------------------------------------------------------------
+KCalcExecutor::Work KCalculator::restoreState(const KCalcHistory::State &state) {
+
+	restoring_ = true;
+	calc_display->setText(state.input);
+	calc_display->setCursorPosition(state.cursor);
+	restoring_ = false;
+
+	memory_num_ = state.memory;
+	const bool memory = memory_num_ != KNumber::Zero;
+	statusBar()->setMemoryIndicator(memory);
+	calc_display->setStatusText(MemField, memory ? QStringLiteral("M") : QString());
+	pbMemRecall->setEnabled(memory);
+
+	action_undo_->setEnabled(history_.canUndo());
+	action_redo_->setEnabled(history_.canRedo());
+
+	const CalcEngine::Snapshot snapshot = state.core;
+	return [this, snapshot](const QAtomicInt &) {
+		core.restore(snapshot);
+		return KNumber::Zero;
+	};
+}
+
+//------------------------------------------------------------------------------
+// Name: slotUndo
+// Desc: goes back one step in the undo history
+//------------------------------------------------------------------------------
+void KCalculator::slotUndo() {
+
+	executor_->submit([this]() -> KCalcExecutor::Work {
+		if (!history_.canUndo()) {
+			return KCalcExecutor::Work();
+		}
+		return restoreState(history_.undo());
+	});
+}
+
+//------------------------------------------------------------------------------
+// Name: slotRedo
+// Desc: goes forward one step in the undo history
+//------------------------------------------------------------------------------
+void KCalculator::slotRedo() {
+
+	executor_->submit([this]() -> KCalcExecutor::Work {
+		if (!history_.canRedo()) {
+			return KCalcExecutor::Work();
+		}
+		return restoreState(history_.redo());
+	});
+}
+
+//------------------------------------------------------------------------------
+// Name: slotMacroRecordtoggled
+// Desc: starts recording the keys into a new macro, or stops it
+//------------------------------------------------------------------------------
+void KCalculator::slotMacroRecordtoggled(bool flag) {
+
+	if (flag) {
+		macro_.clear();
+		recorder_.reset(new KCalcMacro::Recorder(macro_, parser.getNumBase()));
+		action_macro_run_->setEnabled(false);
+		statusBar()->showMessage(i18n("Recording macro"), 3000);
+	} else {
+		recorder_.reset();
+		action_macro_run_->setEnabled(!macro_.isEmpty());
+	}
+}
+
+//------------------------------------------------------------------------------
+// Name: slotMacroRunclicked
+// Desc: replays the macro on the value of the display, straight against
+//       the core on the worker thread
+//------------------------------------------------------------------------------
+void KCalculator::slotMacroRunclicked() {
+
+	const KCalcMacro macro = macro_;
+	executor_->submit([this, macro]() -> KCalcExecutor::Work {
+		const QString text = calc_display->text();
+
+		// folding constants evaluates, the worker does it
+		const bool optimize = parser.getOptimize();
+		parser.setOptimize(false);
+		const auto program = parser.compile(text);
+		parser.setOptimize(optimize);
+		const auto functions = parser.functions();
+		const bool empty = text.trimmed().isEmpty();
+
+		calc_display->sendEvent(KCalcDisplay2::EventClear);
+
+		return [this, macro, program, functions, empty](const QAtomicInt &canceled) {
+			const KNumber input = empty ? KNumber::Zero
+				: KCalcParser::run(program, functions, QVector<KNumber>(), &canceled);
+			core.setOnlyUpdateOperation(false);
+			const KNumber result = macro.run(core, input);
+			core.setOnlyUpdateOperation(true);
+			return result;
+		};
+	}, [this](const KNumber &result) {
+		// the steps did not touch the widgets, the display follows once
+		showResult(result);
+		updateDisplay(UPDATE_FROM_CORE | UPDATE_STORE_RESULT);
+	});
 }
 
 //------------------------------------------------------------------------------
@@ -1410,6 +2037,7 @@ void KCalculator::EnterEqual() {
 //------------------------------------------------------------------------------
 void KCalculator::slotEqualclicked() {
 
+	recordOperation(CalcEngine::FUNC_EQUAL);
     EnterEqual();
 }
 
@@ -1420,6 +2048,7 @@ void KCalculator::slotEqualclicked() {
 void KCalculator::slotPercentclicked() {
 
     /* core.enterOperation(calc_display->getAmount(), CalcEngine::FUNC_PERCENT); */
+    recordOperation(CalcEngine::FUNC_PERCENT);
     updateDisplay(UPDATE_FROM_CORE);
 }
 
@@ -1430,7 +2059,12 @@ void KCalculator::slotPercentclicked() {
 //------------------------------------------------------------------------------
 void KCalculator::slotNegateclicked() {
 
-	/* core.Complement(calc_display->getAmount()); */
+	if (shift_mode_) {
+		calc_display->insert(QStringLiteral("isprime("));
+	} else {
+		/* core.Complement(calc_display->getAmount()); */
+		recordFunction(KCalcMacro::Complement);
+	}
 	updateDisplay(UPDATE_FROM_CORE);
 }
 
@@ -1442,8 +2076,12 @@ void KCalculator::slotModclicked(){
 
 	if (shift_mode_) {
 		/* core.enterOperation(calc_display->getAmount(), CalcEngine::FUNC_INTDIV); */
+		recordOperation(CalcEngine::FUNC_INTDIV);
+		insertOperator(KCalcOperators::INTDIV);
 	} else {
 		/* core.enterOperation(calc_display->getAmount(), CalcEngine::FUNC_MOD); */
+		recordOperation(CalcEngine::FUNC_MOD);
+		insertOperator(KCalcOperators::MOD);
 	}
 
 	updateDisplay(UPDATE_FROM_CORE);
@@ -1456,13 +2094,13 @@ void KCalculator::slotModclicked(){
 void KCalculator::slotStatNumclicked() {
 
 	if (!shift_mode_) {
-		core.StatCount(KNumber::Zero);
+		recordFunction(KCalcMacro::StatCount);
+		enterStatFunction(&CalcEngine::StatCount);
 	} else {
 		pbShift->setChecked(false);
-		core.StatSum(KNumber::Zero);
+		recordFunction(KCalcMacro::StatSum);
+		enterStatFunction(&CalcEngine::StatSum);
 	}
-
-	updateDisplay(UPDATE_FROM_CORE);
 }
 
 //------------------------------------------------------------------------------
@@ -1472,13 +2110,13 @@ void KCalculator::slotStatNumclicked() {
 void KCalculator::slotStatMeanclicked() {
 
 	if (!shift_mode_) {
-		core.StatMean(KNumber::Zero);
+		recordFunction(KCalcMacro::StatMean);
+		enterStatFunction(&CalcEngine::StatMean);
 	} else {
 		pbShift->setChecked(false);
-		core.StatSumSquares(KNumber::Zero);
+		recordFunction(KCalcMacro::StatSumSquares);
+		enterStatFunction(&CalcEngine::StatSumSquares);
 	}
-
-	updateDisplay(UPDATE_FROM_CORE);
 }
 
 //------------------------------------------------------------------------------
@@ -1489,14 +2127,14 @@ void KCalculator::slotStatStdDevclicked() {
 
 	if (shift_mode_) {
 		// std (n-1)
-		core.StatStdDeviation(KNumber::Zero);
+		recordFunction(KCalcMacro::StatStdDeviation);
+		enterStatFunction(&CalcEngine::StatStdDeviation);
 		pbShift->setChecked(false);
 	} else {
 		// std (n)
-		core.StatStdSample(KNumber::Zero);
+		recordFunction(KCalcMacro::StatStdSample);
+		enterStatFunction(&CalcEngine::StatStdSample);
 	}
-
-	updateDisplay(UPDATE_FROM_CORE);
 }
 
 //------------------------------------------------------------------------------
@@ -1507,15 +2145,16 @@ void KCalculator::slotStatMedianclicked() {
 
 	if (!shift_mode_) {
 		// std (n-1)
-		core.StatMedian(KNumber::Zero);
+		recordFunction(KCalcMacro::StatMedian);
+		enterStatFunction(&CalcEngine::StatMedian);
 	} else {
 		// std (n)
-		core.StatMedian(KNumber::Zero);
+		recordFunction(KCalcMacro::StatMedian);
+		enterStatFunction(&CalcEngine::StatMedian);
 		pbShift->setChecked(false);
 	}
 
 	// TODO: it seems two different modes should be implemented, but...?
-	updateDisplay(UPDATE_FROM_CORE);
 }
 
 //------------------------------------------------------------------------------
@@ -1526,13 +2165,13 @@ void KCalculator::slotStatDataInputclicked() {
 
 	if (!shift_mode_) {
 		/* core.StatDataNew(calc_display->getAmount()); */
+		recordFunction(KCalcMacro::StatDataNew);
+		updateDisplay(UPDATE_FROM_CORE);
 	} else {
 		pbShift->setChecked(false);
-		core.StatDataDel(KNumber::Zero);
-		statusBar()->showMessage(i18n("Last stat item erased"), 3000);
+		recordFunction(KCalcMacro::StatDataDel);
+		enterStatFunction(&CalcEngine::StatDataDel, i18n("Last stat item erased"));
 	}
-
-	updateDisplay(UPDATE_FROM_CORE);
 }
 
 //------------------------------------------------------------------------------
@@ -1542,14 +2181,83 @@ void KCalculator::slotStatDataInputclicked() {
 void KCalculator::slotStatClearDataclicked() {
 
 	if (!shift_mode_) {
-		core.StatClearAll(KNumber::Zero);
-		statusBar()->showMessage(i18n("Stat mem cleared"), 3000);
+		recordFunction(KCalcMacro::StatClearAll);
+		enterStatFunction(&CalcEngine::StatClearAll, i18n("Stat mem cleared"));
 	} else {
 		pbShift->setChecked(false);
         updateDisplay({});
 	}
 }
 
+//------------------------------------------------------------------------------
+// Name: slotStatImportData
+// Desc: enters the values of a text or binary file as statistic data
+//------------------------------------------------------------------------------
+void KCalculator::slotStatImportData() {
+
+	const QString fileName = QFileDialog::getOpenFileName(this, i18n("Import Statistic Data"), QString(),
+		i18n("Data files (*.csv *.txt *.dat *.f64 *.bin *.i32 *.i64);;All files (*)"));
+	if (fileName.isEmpty()) {
+		return;
+	}
+
+	int column = -1;
+	if (KCalcImport::formatFor(fileName) == KCalcImport::Text) {
+		bool ok;
+		column = QInputDialog::getInt(this, i18n("Import Statistic Data"),
+			i18n("Column to import, 0 for all:"), 0, 0, 9999, 1, &ok) - 1;
+		if (!ok) {
+			return;
+		}
+	}
+
+	// an import still running stops, its values go with it
+	delete import_;
+	import_ = new KCalcImport(this);
+	import_->setColumn(column);
+
+	connect(import_, &KCalcImport::progress, import_, [this](qint64 done, qint64 total) {
+		statusBar()->showMessage(i18n("Importing... %1%", total > 0 ? done * 100 / total : 100));
+	});
+
+	connect(import_, &KCalcImport::finished, import_, [this](bool complete) {
+		action_cancel_->setEnabled(false);
+		if (!complete) {
+			statusBar()->showMessage(i18n("Import canceled"), 3000);
+			return;
+		}
+
+		const qint64 skipped = import_->skipped();
+		const QSharedPointer<QVector<KNumber>> values(new QVector<KNumber>(import_->takeValues()));
+		action_mode_statistic_->setChecked(true);
+
+		executor_->submit([this, values]() -> KCalcExecutor::Work {
+			calc_display->sendEvent(KCalcDisplay2::EventClear);
+			return [this, values](const QAtomicInt &) {
+				core.StatDataImport(*values);
+				core.setOnlyUpdateOperation(true);
+				bool error;
+				return core.lastOutput(error);
+			};
+		}, [this, values, skipped](const KNumber &result) {
+			showResult(result);
+			QString message = i18np("Imported 1 value", "Imported %1 values", values->size());
+			if (skipped > 0) {
+				message += QLatin1String(", ") + i18np("skipped 1 field", "skipped %1 fields", skipped);
+			}
+			statusBar()->showMessage(message, 3000);
+			updateDisplay(UPDATE_FROM_CORE);
+		});
+	});
+
+	if (!import_->start(fileName)) {
+		statusBar()->showMessage(i18n("Could not read %1", fileName), 3000);
+		return;
+	}
+
+	action_cancel_->setEnabled(true);
+}
+
 //------------------------------------------------------------------------------
 // Name: slotConstclicked
 // Desc: enters a constant
@@ -2051,6 +2759,10 @@ void KCalculator::updateSettings() {
 	setColors();
 	setFonts();
 	setPrecision();
+	const bool repeat = KCalcSettings::repeatLastOperation();
+	changeCore([this, repeat]() {
+		core.setRepeatLastOperation(repeat);
+	});
 
 	// Show the result in the app's caption in taskbar (wishlist - bug #52858)
     disconnect(calc_display, SIGNAL(changedText(QString)), this, nullptr);
@@ -2073,7 +2785,6 @@ void KCalculator::updateDisplay(UpdateFlags flags) {
 
 	if(flags & UPDATE_FROM_CORE) {
 		/* calc_display->updateFromCore(core, (flags & UPDATE_STORE_RESULT) != 0); */
-		core.setOnlyUpdateOperation(true);
 	} else {
 		/* calc_display->update(); */
 	}
@@ -2283,12 +2994,178 @@ bool KCalculator::eventFilter(QObject *o, QEvent *e) {
 //
 
 
+namespace {
+
+//------------------------------------------------------------------------------
+// Name: addBatchOptions
+// Desc: command line options of the headless modes
+//------------------------------------------------------------------------------
+void addBatchOptions(QCommandLineParser &parser) {
+
+	parser.addOption(QCommandLineOption(QStringLiteral("batch"),
+		i18n("Evaluate the expressions in file, one per line, and print the results without starting the user interface.")));
+	parser.addOption(QCommandLineOption(QStringLiteral("serve"),
+		i18n("Evaluate JSON requests received on a local socket without starting the user interface."), QStringLiteral("socket")));
+	parser.addOption(QCommandLineOption(QStringLiteral("base"),
+		i18n("Number base in batch mode: bin, oct, dec or hex."), QStringLiteral("base"), QStringLiteral("dec")));
+	parser.addOption(QCommandLineOption(QStringLiteral("angle"),
+		i18n("Angle mode in batch mode: deg, rad or grad."), QStringLiteral("mode"), QStringLiteral("deg")));
+	parser.addOption(QCommandLineOption(QStringLiteral("precision"),
+		i18n("Number of digits printed in batch mode."), QStringLiteral("digits"), QStringLiteral("12")));
+	parser.addOption(QCommandLineOption(QStringLiteral("jobs"),
+		i18n("Number of threads evaluating in batch mode, by default one per core."), QStringLiteral("n")));
+	parser.addPositionalArgument(QStringLiteral("file"),
+		i18n("File to read in batch mode, - for standard input."), QStringLiteral("[file|-]"));
+}
+
+//------------------------------------------------------------------------------
+// Name: applyBatchOptions
+// Desc: configures the evaluator from the command line
+//------------------------------------------------------------------------------
+bool applyBatchOptions(const QCommandLineParser &parser, KCalcBatch &batch, QTextStream &errors) {
+
+	const QString base = parser.value(QStringLiteral("base")).toLower();
+	if (base == QLatin1String("bin") || base == QLatin1String("2")) {
+		batch.setNumBase(NB_BINARY);
+	} else if (base == QLatin1String("oct") || base == QLatin1String("8")) {
+		batch.setNumBase(NB_OCTAL);
+	} else if (base == QLatin1String("dec") || base == QLatin1String("10")) {
+		batch.setNumBase(NB_DECIMAL);
+	} else if (base == QLatin1String("hex") || base == QLatin1String("16")) {
+		batch.setNumBase(NB_HEX);
+	} else {
+		errors << i18n("kcalc: unknown base: %1", base) << endl;
+		return false;
+	}
+
+	const QString angle = parser.value(QStringLiteral("angle")).toLower();
+	if (angle == QLatin1String("deg")) {
+		batch.setAngleMode(A_DEG);
+	} else if (angle == QLatin1String("rad")) {
+		batch.setAngleMode(A_RAD);
+	} else if (angle == QLatin1String("grad")) {
+		batch.setAngleMode(A_GRAD);
+	} else {
+		errors << i18n("kcalc: unknown angle mode: %1", angle) << endl;
+		return false;
+	}
+
+	bool ok;
+	const int precision = parser.value(QStringLiteral("precision")).toInt(&ok);
+	if (!ok || precision < 1 || precision > maxprecision) {
+		errors << i18n("kcalc: precision must be between 1 and %1", maxprecision) << endl;
+		return false;
+	}
+	batch.setPrecision(precision);
+
+	if (parser.isSet(QStringLiteral("jobs"))) {
+		const int jobs = parser.value(QStringLiteral("jobs")).toInt(&ok);
+		if (!ok || jobs < 1) {
+			errors << i18n("kcalc: jobs must be a positive number") << endl;
+			return false;
+		}
+		batch.setJobs(jobs);
+	} else {
+		batch.setJobs(QThread::idealThreadCount());
+	}
+
+	return true;
+}
+
+//------------------------------------------------------------------------------
+// Name: isHeadless
+// Desc: looks for --batch or --serve before any application object exists
+//------------------------------------------------------------------------------
+bool isHeadless(int argc, char *argv[]) {
+
+	for (int i = 1; i < argc; ++i) {
+		const QByteArray argument(argv[i]);
+		if (argument == "--batch" || argument == "-batch"
+			|| argument.startsWith("--serve") || argument.startsWith("-serve")) {
+			return true;
+		}
+	}
+	return false;
+}
+
+//------------------------------------------------------------------------------
+// Name: runHeadless
+// Desc: evaluates expressions from a file, stdin or a local socket, no
+//       widgets, XML GUI, constants menu or crash handler are set up
+//------------------------------------------------------------------------------
+int runHeadless(int argc, char *argv[]) {
+
+	QCoreApplication app(argc, argv);
+	KLocalizedString::setApplicationDomain("kcalc");
+	QCoreApplication::setApplicationName(QStringLiteral("kcalc"));
+	QCoreApplication::setApplicationVersion(QStringLiteral(KCALC_VERSION_STRING));
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription(i18n(description));
+	parser.addHelpOption();
+	parser.addVersionOption();
+	addBatchOptions(parser);
+	parser.process(app);
+
+	QTextStream errors(stderr);
+
+	// scripts get the same results in every locale
+	setlocale(LC_NUMERIC, "C");
+	QLocale::setDefault(QLocale::c());
+
+	if (parser.isSet(QStringLiteral("serve"))) {
+		const QString path = parser.value(QStringLiteral("serve"));
+
+		KCalcServer server;
+		if (!applyBatchOptions(parser, server.settings(), errors)) {
+			return 2;
+		}
+		if (!server.listen(path)) {
+			errors << i18n("kcalc: cannot listen on %1: %2", path, server.errorString()) << endl;
+			return 2;
+		}
+		return app.exec();
+	}
+
+	KCalcBatch batch;
+	if (!applyBatchOptions(parser, batch, errors)) {
+		return 2;
+	}
+
+	const QStringList arguments = parser.positionalArguments();
+	const QString name = arguments.isEmpty() ? QStringLiteral("-") : arguments.first();
+
+	QFile file;
+	bool ok;
+	if (name == QLatin1String("-")) {
+		ok = file.open(stdin, QIODevice::ReadOnly);
+	} else {
+		file.setFileName(name);
+		ok = file.open(QIODevice::ReadOnly | QIODevice::Text);
+	}
+	if (!ok) {
+		errors << i18n("kcalc: cannot open %1: %2", name, file.errorString()) << endl;
+		return 2;
+	}
+
+	QTextStream input(&file);
+	QTextStream output(stdout);
+	return batch.run(input, output, errors) == 0 ? 0 : 1;
+}
+
+}
+
 //------------------------------------------------------------------------------
 // Name: kdemain
 // Desc: entry point of the application
 //------------------------------------------------------------------------------
 extern "C" Q_DECL_EXPORT int kdemain(int argc, char *argv[]) {
 
+	// must be decided before a QApplication needs a display
+	if (isHeadless(argc, argv)) {
+		return runHeadless(argc, argv);
+	}
+
     QApplication app(argc, argv);
 
     KLocalizedString::setApplicationDomain("kcalc");
@@ -2335,6 +3212,7 @@ extern "C" Q_DECL_EXPORT int kdemain(int argc, char *argv[]) {
 	QCommandLineParser parser;
 	parser.addHelpOption();
 	parser.addVersionOption();
+	addBatchOptions(parser);
         aboutData.setupCommandLine(&parser);
 	parser.process(app);
         aboutData.processCommandLine(&parser);
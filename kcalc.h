@@ -23,6 +23,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define KCALC_H_
 
 class Constants;
+class QAction;
 class QButtonGroup;
 class KToggleAction;
 class KCalcConstMenu;
@@ -47,6 +48,10 @@ class KCalcStatusBar;
  */
 
 #include "kcalc_core.h"
+#include "kcalc_executor.h"
+#include "kcalc_history.h"
+#include "kcalc_macro.h"
+#include "kcalc_operators.h"
 #include "kcalc_button.h"
 #include "kcalc_const_button.h"
 #include "kcalc_parser.h"
@@ -58,9 +63,16 @@ class KCalcStatusBar;
 #include "ui_colors.h"
 
 #include <QFlags>
+#include <QScopedPointer>
+
+#include <functional>
 
 #include <kxmlguiwindow.h>
 
+class KCalcFactor;
+class KCalcImport;
+class KCalcPreview;
+
 class General: public QWidget, public Ui::General
 {
     Q_OBJECT
@@ -140,6 +152,17 @@ private:
     void setBase();
 
     void updateDisplay(UpdateFlags flags);
+    void insertOperator(KCalcOperators::Id id);
+    void showTable(const QString &text);
+    void recordState();
+    KCalcExecutor::Work restoreState(const KCalcHistory::State &state);
+    void showFactors(const QString &text);
+    void showResult(const KNumber &result);
+    void enterStatFunction(void (CalcEngine::*function)(const KNumber &), const QString &message = QString());
+    void changeCore(const std::function<void()> &change);
+    void recordOperation(CalcEngine::Operation operation);
+    void recordFunction(KCalcMacro::Function function);
+    void recordParenClose();
     KCalcStatusBar *statusBar();
 	
     // button sets
@@ -210,6 +233,7 @@ protected Q_SLOTS:
     void slotStatMedianclicked();
     void slotStatDataInputclicked();
     void slotStatClearDataclicked();
+    void slotStatImportData();
     void slotHyptoggled(bool flag);
     void slotConstclicked(int);
 	void slotBackspaceclicked();
@@ -222,6 +246,12 @@ protected Q_SLOTS:
     void slotChooseScientificConst4(const science_constant &);
     void slotChooseScientificConst5(const science_constant &);
 
+    void slotUndo();
+    void slotRedo();
+
+    void slotMacroRecordtoggled(bool flag);
+    void slotMacroRunclicked();
+
     void slotBitsetChanged(quint64);
     void slotUpdateBitset(const KNumber &);
 
@@ -282,6 +312,24 @@ private:
 
     CalcEngine core;
     KCalcParser parser;
+    KCalcPreview *preview_;
+    KCalcExecutor *executor_;
+    // result cache key of the expression the worker is evaluating
+    QString pending_key_;
+    KCalcFactor *factor_;
+    KCalcImport *import_;
+    QAction *action_cancel_;
+
+    KCalcHistory history_;
+    bool restoring_ = false;
+    QAction *action_undo_;
+    QAction *action_redo_;
+
+    // keys pressed while recording, replayed against the core
+    KCalcMacro macro_;
+    QScopedPointer<KCalcMacro::Recorder> recorder_;
+    KToggleAction *action_macro_record_;
+    QAction *action_macro_run_;
 };
 
 Q_DECLARE_OPERATORS_FOR_FLAGS(KCalculator::UpdateFlags)
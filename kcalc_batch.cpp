@@ -0,0 +1,364 @@
+#include "kcalc_batch.h"
+
+#include <QLocale>
+#include <QMap>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QQueue>
+#include <QRunnable>
+#include <QTextStream>
+#include <QThreadPool>
+#include <QWaitCondition>
+
+namespace {
+
+// lines written before the output is flushed
+const int flushInterval = 1024;
+
+// chunks in flight per worker before reading pauses
+const int chunksPerJob = 4;
+
+}
+
+// Shared by the reading thread and the workers, everything is guarded
+// by one mutex which is taken once per chunk.
+class KCalcBatch::Scheduler
+{
+public:
+    explicit Scheduler(int workers)
+        : queues(workers)
+    {
+    }
+
+    bool take(int worker, Chunk &chunk)
+    {
+        QMutexLocker locker(&mutex);
+        forever {
+            if (!queues[worker].isEmpty()) {
+                chunk = queues[worker].dequeue();
+                return true;
+            }
+
+            // steal the newest chunk of the fullest queue, its owner
+            // keeps working on the oldest ones
+            int victim = -1;
+            for (int i = 0; i < queues.size(); ++i) {
+                if (!queues[i].isEmpty() && (victim < 0 || queues[i].size() > queues[victim].size())) {
+                    victim = i;
+                }
+            }
+            if (victim >= 0) {
+                chunk = queues[victim].takeLast();
+                return true;
+            }
+
+            if (closed) {
+                return false;
+            }
+            work.wait(&mutex);
+        }
+    }
+
+    void finish(const Results &results, qint64 sequence)
+    {
+        QMutexLocker locker(&mutex);
+        done.insert(sequence, results);
+        ready.wakeAll();
+    }
+
+    QMutex mutex;
+    QWaitCondition work;
+    QWaitCondition ready;
+    QVector<QQueue<Chunk>> queues;
+    QMap<qint64, Results> done;
+    bool closed = false;
+};
+
+class KCalcBatch::Worker : public QRunnable
+{
+public:
+    Worker(const KCalcBatch &settings, Scheduler &scheduler, int index)
+        : scheduler_(scheduler)
+        , index_(index)
+    {
+        // each worker compiles with a parser of its own
+        batch_.configure(settings);
+    }
+
+    void run() override
+    {
+        Chunk chunk;
+        while (scheduler_.take(index_, chunk)) {
+            Results results;
+            batch_.evaluate(chunk, results);
+            scheduler_.finish(results, chunk.sequence);
+        }
+    }
+
+private:
+    KCalcBatch batch_;
+    Scheduler &scheduler_;
+    const int index_;
+};
+
+KCalcBatch::KCalcBatch()
+{
+    parser_.addDefaultParser();
+    parser_.setNumBase(NB_DECIMAL);
+
+    QObject::connect(&parser_, &KCalcParser::foundInvalidToken, [this](int) { ++errors_; });
+}
+
+void KCalcBatch::setNumBase(NumBase base)
+{
+    parser_.setNumBase(base);
+}
+
+void KCalcBatch::setAngleMode(AngleMode mode)
+{
+    parser_.setAngleMode(mode);
+}
+
+void KCalcBatch::setPrecision(int precision)
+{
+    precision_ = precision;
+    KNumber::setDefaultFloatPrecision(precision);
+}
+
+void KCalcBatch::configure(const KCalcBatch &other)
+{
+    setNumBase(other.parser_.getNumBase());
+    setAngleMode(other.parser_.getAngleMode());
+    precision_ = other.precision_;
+}
+
+void KCalcBatch::setJobs(int jobs)
+{
+    jobs_ = qMax(1, jobs);
+}
+
+int KCalcBatch::jobs() const
+{
+    return jobs_;
+}
+
+void KCalcBatch::setChunkSize(int lines)
+{
+    chunkSize_ = qMax(1, lines);
+}
+
+int KCalcBatch::chunkSize() const
+{
+    return chunkSize_;
+}
+
+int KCalcBatch::run(QTextStream &input, QTextStream &output, QTextStream &errors)
+{
+    if (jobs_ > 1) {
+        return runParallel(input, output, errors);
+    }
+
+    int failed = 0;
+    qint64 number = 0;
+    QString line;
+    QString result;
+
+    while (input.readLineInto(&line)) {
+        ++number;
+
+        if (!evaluate(line, result)) {
+            ++failed;
+            errors << QStringLiteral("kcalc: line %1: invalid expression: %2").arg(number).arg(line) << endl;
+        }
+
+        output << result << QLatin1Char('\n');
+
+        if (number % flushInterval == 0) {
+            output.flush();
+        }
+    }
+
+    output.flush();
+    return failed;
+}
+
+int KCalcBatch::runParallel(QTextStream &input, QTextStream &output, QTextStream &errors)
+{
+    Scheduler scheduler(jobs_);
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(jobs_);
+    for (int i = 0; i < jobs_; ++i) {
+        pool.start(new Worker(*this, scheduler, i));
+    }
+
+    const qint64 maxInFlight = qint64(jobs_) * chunksPerJob;
+    qint64 submitted = 0;
+    qint64 written = 0;
+    int failed = 0;
+
+    // writes the finished chunks which are next in line, waits for
+    // them while more than limit chunks are in flight
+    auto drain = [&](qint64 limit) {
+        forever {
+            QVector<Results> ready;
+            {
+                QMutexLocker locker(&scheduler.mutex);
+                forever {
+                    auto it = scheduler.done.find(written + ready.size());
+                    while (it != scheduler.done.end()) {
+                        ready.push_back(*it);
+                        scheduler.done.erase(it);
+                        it = scheduler.done.find(written + ready.size());
+                    }
+                    if (!ready.isEmpty() || submitted - written <= limit) {
+                        break;
+                    }
+                    scheduler.ready.wait(&scheduler.mutex);
+                }
+            }
+
+            for (const Results &results : ready) {
+                failed += write(results, output, errors);
+            }
+            written += ready.size();
+            if (!ready.isEmpty()) {
+                output.flush();
+            }
+
+            if (submitted - written <= limit) {
+                return;
+            }
+        }
+    };
+
+    auto submit = [&](Chunk &chunk) {
+        if (chunk.lines.isEmpty()) {
+            return;
+        }
+        chunk.sequence = submitted;
+        chunk.definitions = definitions_;
+        {
+            QMutexLocker locker(&scheduler.mutex);
+            scheduler.queues[submitted % jobs_].enqueue(chunk);
+            scheduler.work.wakeOne();
+        }
+        ++submitted;
+        chunk.first += chunk.lines.size();
+        chunk.lines.clear();
+        drain(maxInFlight);
+    };
+
+    Chunk chunk { 0, 1, QStringList(), QStringList() };
+    QString line;
+
+    while (input.readLineInto(&line)) {
+        // definitions are made in order here and handed to the workers
+        // with every later chunk, they need no evaluation
+        const QString text = line.trimmed();
+        if (parser_.defineFunction(text)) {
+            submit(chunk);
+
+            Results results { chunk.first, QStringList(line), QStringList(QString()), QVector<int>() };
+            definitions_.push_back(text);
+            scheduler.finish(results, submitted++);
+            ++chunk.first;
+            drain(maxInFlight);
+            continue;
+        }
+
+        chunk.lines.push_back(line);
+        if (chunk.lines.size() >= chunkSize_) {
+            submit(chunk);
+        }
+    }
+    submit(chunk);
+
+    {
+        QMutexLocker locker(&scheduler.mutex);
+        scheduler.closed = true;
+        scheduler.work.wakeAll();
+    }
+    drain(0);
+    pool.waitForDone();
+
+    return failed;
+}
+
+void KCalcBatch::evaluate(const Chunk &chunk, Results &results)
+{
+    // catch up with the definitions made before this chunk
+    for (int i = definitions_.size(); i < chunk.definitions.size(); ++i) {
+        parser_.defineFunction(chunk.definitions.at(i));
+        definitions_.push_back(chunk.definitions.at(i));
+    }
+
+    results.first = chunk.first;
+    results.lines = chunk.lines;
+    results.results.reserve(chunk.lines.size());
+
+    QString result;
+    for (int i = 0; i < chunk.lines.size(); ++i) {
+        if (!evaluate(chunk.lines.at(i), result)) {
+            results.failed.push_back(i);
+        }
+        results.results.push_back(result);
+    }
+}
+
+int KCalcBatch::write(const Results &results, QTextStream &output, QTextStream &errors)
+{
+    for (const int i : results.failed) {
+        errors << QStringLiteral("kcalc: line %1: invalid expression: %2").arg(results.first + i).arg(results.lines.at(i)) << endl;
+    }
+
+    for (const QString &result : results.results) {
+        output << result << QLatin1Char('\n');
+    }
+
+    return results.failed.size();
+}
+
+bool KCalcBatch::evaluate(const QString &line, QString &result)
+{
+    result.clear();
+
+    const QString text = line.trimmed();
+    if (text.isEmpty()) {
+        return true;
+    }
+
+    if (parser_.defineFunction(text)) {
+        return true;
+    }
+
+    // repeated expressions come from the parser's result cache
+    errors_ = 0;
+    const KNumber number = parser_.parseExpression(text);
+    if (errors_ > 0) {
+        return false;
+    }
+
+    result = formatNumber(number, parser_.getNumBase(), precision_);
+    return true;
+}
+
+QString KCalcBatch::formatNumber(const KNumber &number, NumBase base, int precision)
+{
+    if (base == NB_DECIMAL || number.type() == KNumber::TYPE_ERROR) {
+        return number.toQString(precision);
+    }
+
+    // same as the display without two's complement
+    qint64 value = number.integerPart().toInt64();
+    const bool negative = value < 0;
+    if (negative) {
+        value = qAbs(value);
+    }
+
+    QString text = QString::number(value, base).toUpper();
+    if (negative) {
+        text.prepend(QLocale().negativeSign());
+    }
+    return text;
+}
@@ -0,0 +1,81 @@
+#ifndef KCALC_BATCH_H
+#define KCALC_BATCH_H value
+
+#include "kcalc_parser.h"
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+class QTextStream;
+
+// Evaluates expressions line by line without any user interface,
+// for "kcalc --batch".
+//
+// Every non-empty line yields exactly one line of output so results
+// stay aligned with their input; definitions like "f(x) = x^2" print
+// an empty line and invalid lines are reported on the error stream.
+// Each parser serves the whole run, repeated lines are answered from
+// its result cache.
+//
+// With more than one job the input is cut into chunks of lines. Every
+// worker has its own queue and parser and steals from the others when
+// its queue runs dry. Finished chunks wait in a reorder buffer until
+// all chunks before them are written, and reading pauses while too
+// many chunks are in flight, so memory stays bounded on any input.
+class KCalcBatch
+{
+public:
+    KCalcBatch();
+
+    void setNumBase(NumBase base);
+    void setAngleMode(AngleMode mode);
+    void setPrecision(int precision);
+
+    // takes base, angle mode and precision from other, leaving the
+    // process-wide float precision alone so workers may call it
+    void configure(const KCalcBatch &other);
+
+    void setJobs(int jobs);
+    int jobs() const;
+
+    void setChunkSize(int lines);
+    int chunkSize() const;
+
+    // returns the number of lines which could not be evaluated
+    int run(QTextStream &input, QTextStream &output, QTextStream &errors);
+
+    bool evaluate(const QString &line, QString &result);
+
+    static QString formatNumber(const KNumber &number, NumBase base, int precision);
+
+private:
+    struct Chunk {
+        qint64 sequence;
+        qint64 first;
+        QStringList lines;
+        QStringList definitions;
+    };
+
+    struct Results {
+        qint64 first;
+        QStringList lines;
+        QStringList results;
+        QVector<int> failed;
+    };
+
+    class Scheduler;
+    class Worker;
+
+    int runParallel(QTextStream &input, QTextStream &output, QTextStream &errors);
+    void evaluate(const Chunk &chunk, Results &results);
+    static int write(const Results &results, QTextStream &output, QTextStream &errors);
+
+    KCalcParser parser_;
+    QStringList definitions_;
+    int precision_ = 12;
+    int jobs_ = 1;
+    int chunkSize_ = 1024;
+    int errors_ = 0;
+};
+
+#endif
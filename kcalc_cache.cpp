@@ -0,0 +1,83 @@
+#include "kcalc_cache.h"
+
+namespace {
+
+// hash node and bookkeeping of an entry besides key and number
+const int entryOverhead = 64;
+
+}
+
+KCalcResultCache::KCalcResultCache(int maxBytes)
+    : cache_(maxBytes)
+{
+}
+
+void KCalcResultCache::setMaxBytes(int bytes)
+{
+    cache_.setMaxCost(bytes);
+}
+
+int KCalcResultCache::maxBytes() const
+{
+    return cache_.maxCost();
+}
+
+int KCalcResultCache::bytes() const
+{
+    return cache_.totalCost();
+}
+
+int KCalcResultCache::count() const
+{
+    return cache_.count();
+}
+
+bool KCalcResultCache::find(const QString &key, KNumber &result)
+{
+    // object() also makes the entry the most recently used one
+    if (const KNumber *const cached = cache_.object(key)) {
+        ++hits_;
+        result = *cached;
+        return true;
+    }
+
+    ++misses_;
+    return false;
+}
+
+void KCalcResultCache::insert(const QString &key, const KNumber &result)
+{
+    const qint64 cost = key.size() * qint64(sizeof(QChar)) + result.memoryUsage() + entryOverhead;
+
+    // QCache refuses anything larger than the whole cache
+    if (cost <= cache_.maxCost()) {
+        cache_.insert(key, new KNumber(result), int(cost));
+    }
+}
+
+void KCalcResultCache::invalidate()
+{
+    cache_.clear();
+}
+
+quint64 KCalcResultCache::hits() const
+{
+    return hits_;
+}
+
+quint64 KCalcResultCache::misses() const
+{
+    return misses_;
+}
+
+double KCalcResultCache::hitRate() const
+{
+    const quint64 lookups = hits_ + misses_;
+    return lookups == 0 ? 0.0 : double(hits_) / double(lookups);
+}
+
+void KCalcResultCache::resetStatistics()
+{
+    hits_ = 0;
+    misses_ = 0;
+}
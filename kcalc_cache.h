@@ -0,0 +1,41 @@
+#ifndef KCALC_CACHE_H
+#define KCALC_CACHE_H value
+
+#include "knumber/knumber.h"
+#include <QCache>
+#include <QString>
+
+// Least recently used results of whole expressions.
+//
+// Keys are built by the parser from the normalized tokens of an
+// expression and every setting its result depends on. The size is
+// bounded by the bytes the keys and numbers hold, so a few huge
+// factorials displace many small results. Whoever changes state not
+// covered by the key, like user functions or configuration, calls
+// invalidate().
+class KCalcResultCache
+{
+public:
+    explicit KCalcResultCache(int maxBytes = 4 << 20);
+
+    void setMaxBytes(int bytes);
+    int maxBytes() const;
+    int bytes() const;
+    int count() const;
+
+    bool find(const QString &key, KNumber &result);
+    void insert(const QString &key, const KNumber &result);
+    void invalidate();
+
+    quint64 hits() const;
+    quint64 misses() const;
+    double hitRate() const;
+    void resetStatistics();
+
+private:
+    QCache<QString, KNumber> cache_;
+    quint64 hits_ = 0;
+    quint64 misses_ = 0;
+};
+
+#endif
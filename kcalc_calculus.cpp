@@ -0,0 +1,458 @@
+#include "kcalc_calculus.h"
+#include "kcalc_operators.h"
+#include "kcalc_trig.h"
+
+#include <functional>
+
+namespace {
+
+// Newton steps before a bracket is searched, and steps after that
+const int newtonIterations = 64;
+const int bracketedIterations = 512;
+
+// the finest step of the quadrature is 2^-maxLevel
+const int maxLevel = 12;
+
+// decimal digits of the float results
+int digits()
+{
+    const int precision = KNumber::defaultFloatPrecision();
+
+    // GMP's default of 64 bits until the precision is set
+    return precision > 0 ? precision : 18;
+}
+
+KNumber tenToMinus(int exponent)
+{
+    return KNumber::One / KNumber(10).pow(KNumber(exponent));
+}
+
+// Exact fractions would grow with every step, the iterations work on
+// floats
+KNumber rounded(const KNumber &x)
+{
+    static const KNumber half(0.5);
+    return x.type() == KNumber::TYPE_FRACTION ? (x + half) - half : x;
+}
+
+KNumber magnitude(const KNumber &x)
+{
+    const KNumber abs = x.abs();
+    return abs > KNumber::One ? abs : KNumber::One;
+}
+
+bool isFinite(const KNumber &x)
+{
+    return x.type() != KNumber::TYPE_ERROR;
+}
+
+// The body as a function of its bound variable
+class Body
+{
+public:
+    Body(const KCalcParser::Program &body, const QVector<KCalcParser::Function> &functions,
+         const QVector<KNumber> &arguments, const QAtomicInt *canceled)
+        : body_(body)
+        , functions_(functions)
+        , arguments_(arguments)
+        , canceled_(canceled)
+    {
+        arguments_.resize(body.arguments);
+    }
+
+    KNumber operator()(const KNumber &x)
+    {
+        arguments_.last() = x;
+        return KCalcParser::run(body_, functions_, arguments_, canceled_);
+    }
+
+    void differentiate(const KNumber &x, KNumber &value, KNumber &derivative)
+    {
+        arguments_.resize(body_.arguments - 1);
+        KCalcCalculus::differentiate(body_, functions_, arguments_, x, value, derivative);
+        arguments_.resize(body_.arguments);
+    }
+
+    bool isCanceled() const
+    {
+        return canceled_ && canceled_->load();
+    }
+
+private:
+    const KCalcParser::Program &body_;
+    const QVector<KCalcParser::Function> &functions_;
+    QVector<KNumber> arguments_;
+    const QAtomicInt *const canceled_;
+};
+
+//------------------------------------------------------------------------------
+// derivatives
+//------------------------------------------------------------------------------
+
+struct Dual {
+    KNumber value;
+    KNumber derivative;
+};
+
+using Evaluate = std::function<KNumber(const QVector<KNumber> &)>;
+
+// step of the central differences, balancing truncation and rounding
+KNumber differenceStep(const KNumber &x)
+{
+    return rounded(magnitude(x) * tenToMinus(digits() / 3 + 1));
+}
+
+KNumber centralDifference(const Evaluate &evaluate, QVector<KNumber> operands, int index)
+{
+    const KNumber x = operands.at(index);
+    const KNumber h = differenceStep(x);
+
+    operands[index] = x + h;
+    const KNumber upper = evaluate(operands);
+    operands[index] = x - h;
+    const KNumber lower = evaluate(operands);
+
+    return (upper - lower) / (KNumber(2) * h);
+}
+
+// the chain rule for a function the derivative of which is unknown
+Dual chain(const Evaluate &evaluate, const QVector<Dual> &operands)
+{
+    QVector<KNumber> values;
+    values.reserve(operands.size());
+    for (const auto &operand : operands) {
+        values.push_back(operand.value);
+    }
+
+    Dual result { evaluate(values), KNumber::Zero };
+    for (int i = 0; i < operands.size(); ++i) {
+        if (operands.at(i).derivative != KNumber::Zero) {
+            result.derivative += centralDifference(evaluate, values, i) * operands.at(i).derivative;
+        }
+    }
+    return result;
+}
+
+Dual binary(KCalcParser::BinaryEvaluateFunc evaluate, const Dual &lhs, const Dual &rhs)
+{
+    const Dual &u = lhs;
+    const Dual &v = rhs;
+
+    if (evaluate == KCalcOperators::get(KCalcOperators::ADD).evaluate) {
+        return Dual { u.value + v.value, u.derivative + v.derivative };
+    }
+    if (evaluate == KCalcOperators::get(KCalcOperators::SUBTRACT).evaluate) {
+        return Dual { u.value - v.value, u.derivative - v.derivative };
+    }
+    if (evaluate == KCalcOperators::get(KCalcOperators::MULTIPLY).evaluate) {
+        return Dual { u.value * v.value, u.derivative * v.value + u.value * v.derivative };
+    }
+    if (evaluate == KCalcOperators::get(KCalcOperators::DIVIDE).evaluate) {
+        return Dual { u.value / v.value, (u.derivative * v.value - u.value * v.derivative) / (v.value * v.value) };
+    }
+    if (evaluate == KCalcOperators::get(KCalcOperators::POWER).evaluate) {
+        const KNumber power = u.value.pow(v.value);
+        if (v.derivative == KNumber::Zero) {
+            // (u^c)' = c u^(c - 1) u'
+            if (u.derivative == KNumber::Zero) {
+                return Dual { power, KNumber::Zero };
+            }
+            return Dual { power, v.value * u.value.pow(v.value - KNumber::One) * u.derivative };
+        }
+        // (u^v)' = u^v (v' ln u + v u' / u)
+        return Dual { power, power * (v.derivative * u.value.ln() + v.value * u.derivative / u.value) };
+    }
+
+    return chain([evaluate](const QVector<KNumber> &operands) {
+        KNumber result = operands.at(0);
+        evaluate(result, operands.at(1));
+        return result;
+    }, QVector<Dual> { lhs, rhs });
+}
+
+}
+
+bool KCalcCalculus::differentiate(const KCalcParser::Program &body,
+                                  const QVector<KCalcParser::Function> &functions,
+                                  const QVector<KNumber> &arguments,
+                                  const KNumber &x,
+                                  KNumber &value,
+                                  KNumber &derivative)
+{
+    const int variable = body.arguments - 1;
+
+    QVector<Dual> stack;
+    QVector<Dual> locals(body.locals);
+    bool through = true;
+
+    stack.reserve(body.code.size());
+
+    for (const auto &instruction : body.code) {
+        switch (instruction.opcode) {
+        case KCalcParser::PUSH_NUMBER:
+            stack.push_back(Dual { body.constants.at(instruction.index), KNumber::Zero });
+            break;
+        case KCalcParser::PUSH_ARGUMENT:
+            if (instruction.index == variable) {
+                stack.push_back(Dual { x, KNumber::One });
+            } else {
+                stack.push_back(Dual { arguments.value(instruction.index), KNumber::Zero });
+            }
+            break;
+        case KCalcParser::UNARY:
+            if (instruction.unary == KCalcOperators::negate) {
+                stack.last() = Dual { -stack.last().value, -stack.last().derivative };
+            } else {
+                const KCalcParser::UnaryEvaluateFunc unary = instruction.unary;
+                stack.last() = chain([unary](const QVector<KNumber> &operands) {
+                    KNumber result = operands.at(0);
+                    unary(result);
+                    return result;
+                }, QVector<Dual> { stack.last() });
+            }
+            break;
+        case KCalcParser::BINARY: {
+            const Dual rhs = stack.takeLast();
+            stack.last() = binary(instruction.binary, stack.last(), rhs);
+            break;
+        }
+        case KCalcParser::NARY:
+        case KCalcParser::CALL: {
+            const int first = stack.size() - instruction.operands;
+            const QVector<Dual> operands = stack.mid(first);
+            stack.resize(first);
+
+            if (instruction.opcode == KCalcParser::NARY) {
+                const KCalcParser::NaryEvaluateFunc nary = instruction.nary;
+                stack.push_back(chain([nary](const QVector<KNumber> &values) {
+                    QVector<KNumber> result = values;
+                    nary(result.data(), result.size());
+                    return result.front();
+                }, operands));
+            } else {
+                const KCalcParser::Program &callee = functions.at(instruction.index).body;
+                stack.push_back(chain([&callee, &functions](const QVector<KNumber> &values) {
+                    return KCalcParser::run(callee, functions, values);
+                }, operands));
+            }
+            break;
+        }
+        case KCalcParser::STORE_LOCAL:
+            locals[instruction.index] = stack.last();
+            break;
+        case KCalcParser::LOAD_LOCAL:
+            stack.push_back(locals.at(instruction.index));
+            break;
+        case KCalcParser::SUM:
+        case KCalcParser::PRODUCT:
+        case KCalcParser::SOLVE:
+        case KCalcParser::INTEGRATE:
+            // their bodies see the variable as an argument
+            through = false;
+            break;
+        }
+
+        if (!through) {
+            break;
+        }
+    }
+
+    if (through && stack.size() == 1) {
+        value = stack.last().value;
+        derivative = stack.last().derivative;
+        return true;
+    }
+
+    // differences of the whole body
+    QVector<KNumber> operands = arguments;
+    operands.resize(body.arguments);
+    operands.last() = x;
+
+    const Evaluate evaluate = [&body, &functions](const QVector<KNumber> &values) {
+        return KCalcParser::run(body, functions, values);
+    };
+    value = evaluate(operands);
+    derivative = centralDifference(evaluate, operands, body.arguments - 1);
+    return false;
+}
+
+//------------------------------------------------------------------------------
+// roots
+//------------------------------------------------------------------------------
+
+KNumber KCalcCalculus::solve(const KCalcParser::Program &body,
+                             const QVector<KCalcParser::Function> &functions,
+                             const QVector<KNumber> &arguments,
+                             const KNumber &guess,
+                             const QAtomicInt *canceled)
+{
+    if (!isFinite(guess)) {
+        return KNumber::NaN;
+    }
+
+    Body f(body, functions, arguments, canceled);
+    const KNumber tolerance = tenToMinus(digits() - 1);
+
+    KNumber x = rounded(guess);
+    KNumber fx;
+    KNumber dfx;
+    f.differentiate(x, fx, dfx);
+
+    // f(negative) < 0 < f(positive) once bracketed
+    bool bracketed = false;
+    KNumber negative;
+    KNumber positive;
+
+    // Without a sign change after the Newton steps the bracket is
+    // searched in growing distances around the guess
+    const auto findBracket = [&]() {
+        KNumber distance = magnitude(guess) / KNumber(64);
+        for (int i = 0; i < 64 && !f.isCanceled(); ++i) {
+            for (const KNumber &candidate : { guess - distance, guess + distance }) {
+                const KNumber y = rounded(candidate);
+                const KNumber fy = f(y);
+                if (isFinite(fy) && fy != KNumber::Zero && (fy < KNumber::Zero) != (fx < KNumber::Zero)) {
+                    negative = fy < KNumber::Zero ? y : x;
+                    positive = fy < KNumber::Zero ? x : y;
+                    return true;
+                }
+            }
+            distance *= KNumber(2);
+        }
+        return false;
+    };
+
+    for (int iteration = 0; iteration < newtonIterations + bracketedIterations; ++iteration) {
+        if (f.isCanceled() || !isFinite(fx)) {
+            return KNumber::NaN;
+        }
+        if (fx == KNumber::Zero) {
+            return x;
+        }
+
+        if (!bracketed && iteration == newtonIterations) {
+            bracketed = findBracket();
+            if (!bracketed) {
+                return KNumber::NaN;
+            }
+        }
+
+        const bool newton = isFinite(dfx) && dfx != KNumber::Zero;
+        KNumber next = newton ? rounded(x - fx / dfx) : x;
+
+        if (bracketed) {
+            const KNumber &low = negative < positive ? negative : positive;
+            const KNumber &high = negative < positive ? positive : negative;
+            if (!newton || !isFinite(next) || next <= low || next >= high) {
+                next = rounded((negative + positive) / KNumber(2));
+            }
+        } else if (!newton || !isFinite(next)) {
+            // off a flat spot
+            next = rounded(x + magnitude(x));
+        }
+
+        KNumber fnext;
+        KNumber dfnext;
+        f.differentiate(next, fnext, dfnext);
+
+        if (isFinite(fnext) && fnext != KNumber::Zero) {
+            if (bracketed) {
+                (fnext < KNumber::Zero ? negative : positive) = next;
+            } else if ((fnext < KNumber::Zero) != (fx < KNumber::Zero)) {
+                bracketed = true;
+                negative = fnext < KNumber::Zero ? next : x;
+                positive = fnext < KNumber::Zero ? x : next;
+            }
+        }
+
+        const KNumber scale = tolerance * magnitude(next);
+        const bool converged = (next - x).abs() <= scale
+                               || (bracketed && (positive - negative).abs() <= scale);
+
+        x = next;
+        fx = fnext;
+        dfx = dfnext;
+
+        if (converged && isFinite(fx)) {
+            return x;
+        }
+    }
+
+    return KNumber::NaN;
+}
+
+//------------------------------------------------------------------------------
+// integrals
+//------------------------------------------------------------------------------
+
+KNumber KCalcCalculus::integrate(const KCalcParser::Program &body,
+                                 const QVector<KCalcParser::Function> &functions,
+                                 const QVector<KNumber> &arguments,
+                                 const KNumber &from,
+                                 const KNumber &to,
+                                 const QAtomicInt *canceled)
+{
+    if (!isFinite(from) || !isFinite(to)) {
+        return KNumber::NaN;
+    }
+    if (from == to) {
+        return KNumber::Zero;
+    }
+
+    Body f(body, functions, arguments, canceled);
+
+    const KNumber epsilon = tenToMinus(digits());
+    // the error about squares from one level to the next
+    const KNumber tolerance = tenToMinus(digits() / 2 + 1);
+
+    const KNumber halfPi = KCalcTrig::pi() / KNumber(2);
+    const KNumber center = (from + to) / KNumber(2);
+    const KNumber half = (to - from) / KNumber(2);
+
+    // Adds the nodes at +t and -t; x = tanh(pi/2 sinh t) is taken through
+    // its distance 2 / (exp(pi sinh t) + 1) from the bounds, which keeps
+    // the nodes off the bounds. False once the nodes reach the bounds.
+    const auto addNodes = [&](const KNumber &t, KNumber &sum) {
+        const KNumber e = (KNumber(2) * halfPi * t.sinh()).exp();
+        const KNumber distance = KNumber(2) / (e + KNumber::One);
+        if (distance < epsilon) {
+            return false;
+        }
+
+        const KNumber weight = halfPi * t.cosh() * KNumber(4) * e / ((e + KNumber::One) * (e + KNumber::One));
+        sum += weight * (f(rounded(to - half * distance)) + f(rounded(from + half * distance)));
+        return true;
+    };
+
+    KNumber sum = halfPi * f(rounded(center));
+    for (int k = 1; addNodes(KNumber(k), sum); ++k) {
+        if (f.isCanceled()) {
+            return KNumber::NaN;
+        }
+    }
+
+    KNumber step = KNumber::One;
+    KNumber estimate = half * sum;
+
+    for (int level = 1; level <= maxLevel; ++level) {
+        // the new nodes lie halfway between the old ones
+        step /= KNumber(2);
+        for (int k = 1; addNodes(KNumber(k) * step, sum); k += 2) {
+            if (f.isCanceled()) {
+                return KNumber::NaN;
+            }
+        }
+
+        const KNumber previous = estimate;
+        estimate = half * step * sum;
+
+        if (!isFinite(estimate)) {
+            return estimate;
+        }
+        if (level >= 3 && (estimate - previous).abs() <= tolerance * estimate.abs() + epsilon) {
+            return estimate;
+        }
+    }
+
+    return KNumber::NaN;
+}
@@ -0,0 +1,42 @@
+#ifndef KCALC_CALCULUS_H
+#define KCALC_CALCULUS_H value
+
+#include "kcalc_parser.h"
+
+// Roots and integrals of compiled bodies, run by the SOLVE and INTEGRATE
+// instructions. The body is called with the arguments followed by the
+// bound variable, like the bodies of KCalcSeries.
+//
+// Both work to the float precision of KNumber, which KCalculator sets
+// from the precision in the settings. Results which do not converge are
+// NaN, as is everything once canceled is set.
+namespace KCalcCalculus
+{
+// Newton's method on derivatives taken through the body, kept inside
+// a bracket by bisection once the sign of the body changed
+KNumber solve(const KCalcParser::Program &body,
+              const QVector<KCalcParser::Function> &functions,
+              const QVector<KNumber> &arguments,
+              const KNumber &guess,
+              const QAtomicInt *canceled = nullptr);
+
+// Double exponential (tanh-sinh) quadrature, halving the step until
+// two estimates agree; integrable singularities at the bounds are fine
+KNumber integrate(const KCalcParser::Program &body,
+                  const QVector<KCalcParser::Function> &functions,
+                  const QVector<KNumber> &arguments,
+                  const KNumber &from,
+                  const KNumber &to,
+                  const QAtomicInt *canceled = nullptr);
+
+// The body and its derivative at x, exactly for the arithmetic
+// operators and by central differences for other functions
+bool differentiate(const KCalcParser::Program &body,
+                   const QVector<KCalcParser::Function> &functions,
+                   const QVector<KNumber> &arguments,
+                   const KNumber &x,
+                   KNumber &value,
+                   KNumber &derivative);
+}
+
+#endif
@@ -25,155 +25,40 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include "kcalc_core.h"
-#include "kcalc_settings.h"
+#include "kcalc_operators.h"
+#include "kcalc_trig.h"
 
 #include <QDebug>
 
 namespace {
 
-KNumber Deg2Rad(const KNumber &x) {
-	return x * (KNumber::Pi() / KNumber(180));
-}
-
-KNumber Gra2Rad(const KNumber &x) {
-	return x * (KNumber::Pi() / KNumber(200));
-}
-
 KNumber Rad2Deg(const KNumber &x) {
-	 return x * (KNumber(180) / KNumber::Pi());
+	return KCalcTrig::fromRadians(x, A_DEG);
 }
 
 KNumber Rad2Gra(const KNumber &x) {
-	return x * (KNumber(200) / KNumber::Pi());
-}
-
-bool error_;
-
-KNumber ExecOr(const KNumber &left_op, const KNumber &right_op) {
-    return left_op | right_op;
-}
-
-KNumber ExecXor(const KNumber &left_op, const KNumber &right_op) {
-    return left_op ^ right_op;
-}
-
-KNumber ExecAnd(const KNumber &left_op, const KNumber &right_op) {
-    return left_op & right_op;
-}
-
-KNumber ExecLsh(const KNumber &left_op, const KNumber &right_op) {
-    return left_op << right_op;
-}
-
-KNumber ExecRsh(const KNumber &left_op, const KNumber &right_op) {
-    return left_op >> right_op;
-}
-
-KNumber ExecAdd(const KNumber &left_op, const KNumber &right_op) {
-    return left_op + right_op;
-}
-
-KNumber ExecSubtract(const KNumber &left_op, const KNumber &right_op) {
-    return left_op - right_op;
+	return KCalcTrig::fromRadians(x, A_GRAD);
 }
 
-KNumber ExecMultiply(const KNumber &left_op, const KNumber &right_op) {
-    return left_op * right_op;
-}
-
-KNumber ExecDivide(const KNumber &left_op, const KNumber &right_op) {
-    return left_op / right_op;
-}
-
-KNumber ExecMod(const KNumber &left_op, const KNumber &right_op) {
-    return left_op % right_op;
-}
-
-KNumber ExecIntDiv(const KNumber &left_op, const KNumber &right_op) {
-    return (left_op / right_op).integerPart();
-}
-
-KNumber ExecBinom(const KNumber &left_op, const KNumber &right_op) {
-	return left_op.bin(right_op);
-}
-
-KNumber ExecPower(const KNumber &left_op, const KNumber &right_op) {
-    return left_op.pow(right_op);
-}
-
-KNumber ExecPwrRoot(const KNumber &left_op, const KNumber &right_op) {
-    return left_op.pow(KNumber::One / right_op);
-}
-
-KNumber ExecAddP(const KNumber &left_op, const KNumber &right_op) {
-    return left_op * (KNumber::One + right_op / KNumber(100));
-}
-
-KNumber ExecSubP(const KNumber &left_op, const KNumber &right_op) {
-    return left_op * (KNumber::One - right_op / KNumber(100));
-}
-
-KNumber ExecMultiplyP(const KNumber &left_op, const KNumber &right_op) {
-    return left_op * right_op / KNumber(100);
-}
+static_assert(CalcEngine::FUNC_PWR_ROOT - CalcEngine::FUNC_OR == KCalcOperators::PWR_ROOT,
+              "binary operations follow the order of KCalcOperators::Id");
 
-KNumber ExecDivideP(const KNumber &left_op, const KNumber &right_op) {
-    return left_op * KNumber(100) / right_op;
-}
-
-// move a number into the interval [0,360) by adding multiples of 360
-KNumber moveIntoDegInterval(const KNumber &num) {
-    KNumber tmp_num = num - (num / KNumber(360)).integerPart() * KNumber(360);
-    if (tmp_num < KNumber::Zero)
-        return tmp_num + KNumber(360);
-    return tmp_num;
-}
-
-// move a number into the interval [0,400) by adding multiples of 400
-KNumber moveIntoGradInterval(const KNumber &num) {
-    KNumber tmp_num = num - (num / KNumber(400)).integerPart() * KNumber(400);
-    if (tmp_num < KNumber::Zero)
-        return tmp_num + KNumber(400);
-    return tmp_num;
+// precedence of the operations stored in the calculation stack, the
+// pseudo operations FUNC_EQUAL, FUNC_PERCENT and FUNC_BRACKET bind loosest
+int precedence(CalcEngine::Operation operation) {
+    if (operation < CalcEngine::FUNC_OR) {
+        return 0;
+    }
+    return KCalcOperators::get(KCalcOperators::Id(operation - CalcEngine::FUNC_OR)).precedence;
 }
 
-typedef KNumber(*Arith)(const KNumber &, const KNumber &);
-typedef KNumber(*Prcnt)(const KNumber &, const KNumber &);
-
-struct operator_data {
-    int precedence;  // priority of operators in " enum Operation"
-    Arith arith_ptr;
-    Prcnt prcnt_ptr;
-};
-
-// build precedence list
-const struct operator_data Operator[] = {
-    { 0, nullptr,         nullptr},          // FUNC_EQUAL
-    { 0, nullptr,         nullptr},          // FUNC_PERCENT
-    { 0, nullptr,         nullptr},          // FUNC_BRACKET
-    { 1, ExecOr,       nullptr},          // FUNC_OR
-    { 2, ExecXor,      nullptr},          // FUNC_XOR
-    { 3, ExecAnd,      nullptr},          // FUNC_AND
-    { 4, ExecLsh,      nullptr},          // FUNC_LSH
-    { 4, ExecRsh,      nullptr},          // FUNC_RSH
-    { 5, ExecAdd,      ExecAddP},      // FUNC_ADD
-    { 5, ExecSubtract, ExecSubP},      // FUNC_SUBTRACT
-    { 6, ExecMultiply, ExecMultiplyP}, // FUNC_MULTIPLY
-    { 6, ExecDivide,   ExecDivideP},   // FUNC_DIVIDE
-    { 6, ExecMod,      nullptr},          // FUNC_MOD
-    { 6, ExecIntDiv,   nullptr},          // FUNC_INTDIV
-    { 7, ExecBinom,    nullptr},          // FUNC_BINOM
-    { 7, ExecPower,    nullptr},          // FUNC_POWER
-    { 7, ExecPwrRoot,  nullptr}           // FUNC_PWR_ROOT
-};
-
 }
 
-CalcEngine::CalcEngine()
-    : only_update_operation_(false), repeat_mode_(false), percent_mode_(false) {
+CalcEngine::CalcEngine(const Settings &settings)
+    : repeat_mode_(false), only_update_operation_(false), repeat_last_operation_(settings.repeatLastOperation),
+      percent_mode_(false), error_(false) {
 
     last_number_ = KNumber::Zero;
-    error_ = false;
     last_operation_ = FUNC_EQUAL;
 }
 
@@ -313,9 +198,9 @@ void CalcEngine::ArcTangensRad(const KNumber &input)
     if (input.type() == KNumber::TYPE_ERROR) {
         if (input == KNumber::NaN) last_number_ = KNumber::NaN;
         if (input == KNumber::PosInfinity)
-            last_number_ = KNumber::Pi() / KNumber(2);
+            last_number_ = KCalcTrig::pi() / KNumber(2);
         if (input == KNumber::NegInfinity)
-            last_number_ = -KNumber::Pi() / KNumber(2);
+            last_number_ = -KCalcTrig::pi() / KNumber(2);
         return;
     }
 
@@ -404,68 +289,17 @@ void CalcEngine::Complement(const KNumber &input)
 
 void CalcEngine::CosDeg(const KNumber &input)
 {
-    if (input.type() == KNumber::TYPE_ERROR) {
-        last_number_ = KNumber::NaN;
-        return;
-    }
-	
-    KNumber trunc_input = moveIntoDegInterval(input);
-    
-	if (trunc_input.type() == KNumber::TYPE_INTEGER) {
-        KNumber mult = trunc_input / KNumber(90);
-        if (mult.type() == KNumber::TYPE_INTEGER) {
-            if (mult == KNumber::Zero)
-                last_number_ = KNumber::One;
-            else if (mult == KNumber::One)
-                last_number_ = KNumber::Zero;
-            else if (mult == KNumber(2))
-                last_number_ = KNumber::NegOne;
-            else if (mult == KNumber(3))
-                last_number_ = KNumber::Zero;
-            else qDebug() << "Something wrong in CalcEngine::CosDeg";
-            return;
-        }
-    }
-		
-    trunc_input = Deg2Rad(trunc_input);
-    last_number_ = trunc_input.cos();
+    last_number_ = KCalcTrig::cos(input, A_DEG);
 }
 
 void CalcEngine::CosRad(const KNumber &input)
 {
-    if (input.type() == KNumber::TYPE_ERROR) {
-        last_number_ = KNumber::NaN;
-        return;
-    }
-	
-    last_number_ = input.cos();
+    last_number_ = KCalcTrig::cos(input, A_RAD);
 }
 
 void CalcEngine::CosGrad(const KNumber &input)
 {
-    if (input.type() == KNumber::TYPE_ERROR) {
-        last_number_ = KNumber::NaN;
-        return;
-    }
-    KNumber trunc_input = moveIntoGradInterval(input);
-    if (trunc_input.type() == KNumber::TYPE_INTEGER) {
-        KNumber mult = trunc_input / KNumber(100);
-        if (mult.type() == KNumber::TYPE_INTEGER) {
-            if (mult == KNumber::Zero)
-                last_number_ = KNumber::One;
-            else if (mult == KNumber::One)
-                last_number_ = KNumber::Zero;
-            else if (mult == KNumber(2))
-                last_number_ = KNumber::NegOne;
-            else if (mult == KNumber(3))
-                last_number_ = KNumber::Zero;
-            else qDebug() << "Something wrong in CalcEngine::CosGrad";
-            return;
-        }
-    }
-    trunc_input = Gra2Rad(trunc_input);
-
-    last_number_ = trunc_input.cos();
+    last_number_ = KCalcTrig::cos(input, A_GRAD);
 }
 
 void CalcEngine::CosHyp(const KNumber &input)
@@ -576,12 +410,14 @@ void CalcEngine::ParenClose(KNumber input)
 {
     // evaluate stack until corresponding opening bracket
     while (!stack_.isEmpty()) {
-        Node tmp_node = stack_.pop();
+        Node tmp_node = std::move(stack_.last());
+        stack_.removeLast();
         if (tmp_node.operation == FUNC_BRACKET)
             break;
-        input = evalOperation(tmp_node.number, tmp_node.operation, input);
+        evalOperation(tmp_node.number, tmp_node.operation, input);
+        input = std::move(tmp_node.number);
     }
-    last_number_ = input;
+    last_number_ = std::move(input);
     return;
 }
 
@@ -598,69 +434,17 @@ void CalcEngine::Reciprocal(const KNumber &input)
 
 void CalcEngine::SinDeg(const KNumber &input)
 {
-    if (input.type() == KNumber::TYPE_ERROR) {
-        last_number_ = KNumber::NaN;
-        return;
-    }
-
-    KNumber trunc_input = moveIntoDegInterval(input);
-    if (trunc_input.type() == KNumber::TYPE_INTEGER) {
-        KNumber mult = trunc_input / KNumber(90);
-        if (mult.type() == KNumber::TYPE_INTEGER) {
-            if (mult == KNumber::Zero)
-                last_number_ = KNumber::Zero;
-            else if (mult == KNumber::One)
-                last_number_ = KNumber::One;
-            else if (mult == KNumber(2))
-                last_number_ = KNumber::Zero;
-            else if (mult == KNumber(3))
-                last_number_ = KNumber::NegOne;
-            else qDebug() << "Something wrong in CalcEngine::SinDeg";
-            return;
-        }
-    }
-    trunc_input = Deg2Rad(trunc_input);
-
-    last_number_ = trunc_input.sin();
+    last_number_ = KCalcTrig::sin(input, A_DEG);
 }
 
 void CalcEngine::SinRad(const KNumber &input)
 {
-    if (input.type() == KNumber::TYPE_ERROR) {
-        last_number_ = KNumber::NaN;
-        return;
-    }
-
-    last_number_ = input.sin();
+    last_number_ = KCalcTrig::sin(input, A_RAD);
 }
 
 void CalcEngine::SinGrad(const KNumber &input)
 {
-    if (input.type() == KNumber::TYPE_ERROR) {
-        last_number_ = KNumber::NaN;
-        return;
-    }
-
-    KNumber trunc_input = moveIntoGradInterval(input);
-    if (trunc_input.type() == KNumber::TYPE_INTEGER) {
-        KNumber mult = trunc_input / KNumber(100);
-        if (mult.type() == KNumber::TYPE_INTEGER) {
-            if (mult == KNumber::Zero)
-                last_number_ = KNumber::Zero;
-            else if (mult == KNumber::One)
-                last_number_ = KNumber::One;
-            else if (mult == KNumber(2))
-                last_number_ = KNumber::Zero;
-            else if (mult == KNumber(3))
-                last_number_ = KNumber::NegOne;
-            else qDebug() << "Something wrong in CalcEngine::SinGrad";
-            return;
-        }
-    }
-
-    trunc_input = Gra2Rad(trunc_input);
-
-    last_number_ = trunc_input.sin();
+    last_number_ = KCalcTrig::sin(input, A_GRAD);
 }
 
 void CalcEngine::SinHyp(const KNumber &input)
@@ -710,6 +494,12 @@ void CalcEngine::StatDataDel(const KNumber &input)
     last_number_ = KNumber(stats.count());
 }
 
+void CalcEngine::StatDataImport(const QVector<KNumber> &data)
+{
+    stats.enterData(data);
+    last_number_ = KNumber(stats.count());
+}
+
 void CalcEngine::StatMean(const KNumber &input)
 {
     Q_UNUSED(input);
@@ -758,47 +548,17 @@ void CalcEngine::StatSumSquares(const KNumber &input)
 
 void CalcEngine::TangensDeg(const KNumber &input)
 {
-    if (input.type() == KNumber::TYPE_ERROR) {
-        last_number_ = KNumber::NaN;
-        return;
-    }
-
-    SinDeg(input);
-    KNumber arg1 = last_number_;
-    CosDeg(input);
-    KNumber arg2 = last_number_;
-
-    last_number_ = arg1 / arg2;
+    last_number_ = KCalcTrig::tan(input, A_DEG);
 }
 
 void CalcEngine::TangensRad(const KNumber &input)
 {
-    if (input.type() == KNumber::TYPE_ERROR) {
-        last_number_ = KNumber::NaN;
-        return;
-    }
-
-    SinRad(input);
-    KNumber arg1 = last_number_;
-    CosRad(input);
-    KNumber arg2 = last_number_;
-
-    last_number_ = arg1 / arg2;
+    last_number_ = KCalcTrig::tan(input, A_RAD);
 }
 
 void CalcEngine::TangensGrad(const KNumber &input)
 {
-    if (input.type() == KNumber::TYPE_ERROR) {
-        last_number_ = KNumber::NaN;
-        return;
-    }
-
-    SinGrad(input);
-    KNumber arg1 = last_number_;
-    CosGrad(input);
-    KNumber arg2 = last_number_;
-
-    last_number_ = arg1 / arg2;
+    last_number_ = KCalcTrig::tan(input, A_GRAD);
 }
 
 void CalcEngine::TangensHyp(const KNumber &input)
@@ -813,26 +573,22 @@ void CalcEngine::TangensHyp(const KNumber &input)
 	last_number_ = input.tanh();
 }
 
-KNumber CalcEngine::evalOperation(const KNumber &arg1, Operation operation, const KNumber &arg2)
+void CalcEngine::evalOperation(KNumber &lhs, Operation operation, const KNumber &rhs)
 {
-    if (!percent_mode_ || Operator[operation].prcnt_ptr == nullptr) {
-        return (Operator[operation].arith_ptr)(arg1, arg2);
-    } else {
+    const KCalcOperators::Id id = KCalcOperators::Id(operation - FUNC_OR);
+
+    if (percent_mode_ && KCalcOperators::get(id).percent) {
         percent_mode_ = false;
-        return (Operator[operation].prcnt_ptr)(arg1, arg2);
+        KCalcOperators::applyPercent(id, lhs, rhs);
+    } else {
+        KCalcOperators::apply(id, lhs, rhs);
     }
 }
 
 void CalcEngine::enterOperation(const KNumber &number, Operation func)
 {
-    Node tmp_node;
-
     if (func == FUNC_BRACKET) {
-        tmp_node.number = KNumber::Zero;
-        tmp_node.operation = FUNC_BRACKET;
-
-        stack_.push(tmp_node);
-
+        stack_.append(Node{KNumber::Zero, FUNC_BRACKET});
         return;
     }
 
@@ -840,10 +596,9 @@ void CalcEngine::enterOperation(const KNumber &number, Operation func)
         percent_mode_ = true;
     }
 
-    tmp_node.number = number;
-    tmp_node.operation = func;
+    Node tmp_node{number, func};
 
-    if (KCalcSettings::repeatLastOperation()) {
+    if (repeat_last_operation_) {
         if (func != FUNC_EQUAL && func != FUNC_PERCENT) {
             last_operation_ = tmp_node.operation;
             repeat_mode_ = false;
@@ -854,20 +609,17 @@ void CalcEngine::enterOperation(const KNumber &number, Operation func)
                 repeat_mode_ = last_operation_ != FUNC_EQUAL;
                 last_repeat_number_ = number;
             } else {
-                Node repeat_node;
-                repeat_node.operation = last_operation_;
-                repeat_node.number = number;
+                stack_.append(Node{number, last_operation_});
                 tmp_node.number = last_repeat_number_;
-                stack_.push(repeat_node);
             }
         }
     }
 
     if (getOnlyUpdateOperation() && !stack_.isEmpty() &&
         !(func == FUNC_EQUAL || func == FUNC_PERCENT))
-        stack_.top().operation = func;
+        stack_.last().operation = func;
     else
-        stack_.push(tmp_node);
+        stack_.append(std::move(tmp_node));
 
     evalStack();
 }
@@ -877,26 +629,29 @@ bool CalcEngine::evalStack()
     // this should never happen
     Q_ASSERT(!stack_.isEmpty());
 
-    Node tmp_node = stack_.pop();
+    Node tmp_node = std::move(stack_.last());
+    stack_.removeLast();
 
+    // the result of each operation is formed in the node below and
+    // moved up, no number is copied
     while (! stack_.isEmpty()) {
-        Node tmp_node2 = stack_.pop();
-        if (Operator[tmp_node.operation].precedence <=
-                Operator[tmp_node2.operation].precedence) {
-            if (tmp_node2.operation == FUNC_BRACKET) continue;
-			const KNumber tmp_result = evalOperation(tmp_node2.number, tmp_node2.operation, tmp_node.number);
-            tmp_node.number = tmp_result;
-        } else {
-            stack_.push(tmp_node2);
+        Node &tmp_node2 = stack_.last();
+        if (precedence(tmp_node.operation) > precedence(tmp_node2.operation))
             break;
-        }
 
+        if (tmp_node2.operation != FUNC_BRACKET) {
+            evalOperation(tmp_node2.number, tmp_node2.operation, tmp_node.number);
+            tmp_node.number.swap(tmp_node2.number);
+        }
+        stack_.removeLast();
     }
 
-    if (tmp_node.operation != FUNC_EQUAL && tmp_node.operation != FUNC_PERCENT)
-        stack_.push(tmp_node);
-
-    last_number_ = tmp_node.number;
+    if (tmp_node.operation != FUNC_EQUAL && tmp_node.operation != FUNC_PERCENT) {
+        last_number_ = tmp_node.number;
+        stack_.append(std::move(tmp_node));
+    } else {
+        last_number_ = std::move(tmp_node.number);
+    }
     return true;
 }
 
@@ -922,3 +677,72 @@ bool CalcEngine::getOnlyUpdateOperation() const
     return only_update_operation_;
 }
 
+void CalcEngine::setRepeatLastOperation(bool repeat)
+{
+    repeat_last_operation_ = repeat;
+}
+
+bool CalcEngine::getRepeatLastOperation() const
+{
+    return repeat_last_operation_;
+}
+
+CalcEngine::Snapshot CalcEngine::snapshot() const
+{
+    Snapshot snapshot;
+    snapshot.stack_.reserve(stack_.size());
+    for (const Node &node : stack_) {
+        snapshot.stack_.append(node);
+    }
+    snapshot.stats_ = stats;
+    snapshot.last_number_ = last_number_;
+    snapshot.last_operation_ = last_operation_;
+    snapshot.last_repeat_number_ = last_repeat_number_;
+    snapshot.repeat_mode_ = repeat_mode_;
+    snapshot.only_update_operation_ = only_update_operation_;
+    snapshot.percent_mode_ = percent_mode_;
+    snapshot.error_ = error_;
+    return snapshot;
+}
+
+void CalcEngine::restore(const Snapshot &snapshot)
+{
+    stack_.clear();
+    for (const Node &node : snapshot.stack_) {
+        stack_.append(node);
+    }
+    stats = snapshot.stats_;
+    last_number_ = snapshot.last_number_;
+    last_operation_ = snapshot.last_operation_;
+    last_repeat_number_ = snapshot.last_repeat_number_;
+    repeat_mode_ = snapshot.repeat_mode_;
+    only_update_operation_ = snapshot.only_update_operation_;
+    percent_mode_ = snapshot.percent_mode_;
+    error_ = snapshot.error_;
+}
+
+qint64 CalcEngine::Snapshot::memoryUsage() const
+{
+    qint64 usage = sizeof(*this) + last_number_.memoryUsage() + last_repeat_number_.memoryUsage() + stats_.lastEntryUsage();
+    for (const Node &node : stack_) {
+        usage += sizeof(Node) + node.number.memoryUsage();
+    }
+    return usage;
+}
+
+bool CalcEngine::Snapshot::operator==(const Snapshot &other) const
+{
+    if (stack_.size() != other.stack_.size()) {
+        return false;
+    }
+    for (int i = 0; i < stack_.size(); ++i) {
+        if (stack_[i].operation != other.stack_[i].operation || !(stack_[i].number == other.stack_[i].number)) {
+            return false;
+        }
+    }
+
+    return stats_.sharesData(other.stats_) && last_number_ == other.last_number_ && last_operation_ == other.last_operation_
+        && last_repeat_number_ == other.last_repeat_number_ && repeat_mode_ == other.repeat_mode_
+        && only_update_operation_ == other.only_update_operation_ && percent_mode_ == other.percent_mode_
+        && error_ == other.error_;
+}
@@ -22,13 +22,15 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #ifndef KCALC_CORE_H_
 #define KCALC_CORE_H_
 
-#include <QStack>
+#include <QVarLengthArray>
+#include <QVector>
 #include "stats.h"
 #include "knumber.h"
 
 class CalcEngine {
 public:
-    // operations that can be stored in calculation stack
+    // operations that can be stored in calculation stack, FUNC_OR to
+    // FUNC_PWR_ROOT are the operators of KCalcOperators in the same order
     enum Operation {
         FUNC_EQUAL,
         FUNC_PERCENT,
@@ -49,7 +51,14 @@ public:
         FUNC_PWR_ROOT
     };
 
-    CalcEngine();
+    // what the engine takes from the user's settings
+    struct Settings {
+        bool repeatLastOperation;
+    };
+
+    // An engine keeps all of its state, engines on different threads
+    // do not interfere.
+    explicit CalcEngine(const Settings &settings = Settings());
 
     KNumber lastOutput(bool &error) const;
 
@@ -94,6 +103,7 @@ public:
     void StatCount(const KNumber &input);
     void StatDataNew(const KNumber &input);
     void StatDataDel(const KNumber &input);
+    void StatDataImport(const QVector<KNumber> &data);
     void StatMean(const KNumber &input);
     void StatMedian(const KNumber &input);
     void StatStdDeviation(const KNumber &input);
@@ -109,6 +119,17 @@ public:
     void setOnlyUpdateOperation(bool update);
     bool getOnlyUpdateOperation() const;
 
+    // "=" repeats the last operation, set from the user's settings
+    void setRepeatLastOperation(bool repeat);
+    bool getRepeatLastOperation() const;
+
+    // The whole state for undo. The statistics data are shared with the
+    // engine, so a snapshot costs about as much as the pending operations.
+    class Snapshot;
+
+    Snapshot snapshot() const;
+    void restore(const Snapshot &snapshot);
+
 private:
     KStats stats;
 
@@ -136,7 +157,10 @@ private:
     // into the stack, each time the user opens one.  When a bracket is
     // closed, everything in the stack is evaluated until the first
     // marker "FUNC_BRACKET" found.
-    QStack<Node> stack_;
+    //
+    // The first levels live in the engine itself, only deep brackets
+    // reach the heap.
+    QVarLengthArray<Node, 16> stack_;
 
     KNumber last_number_;
 
@@ -144,12 +168,34 @@ private:
     KNumber last_repeat_number_;
     bool repeat_mode_;
     bool only_update_operation_;
+    bool repeat_last_operation_;
 
     bool percent_mode_;
+    bool error_;
 
     bool evalStack();
 
-    KNumber evalOperation(const KNumber &arg1, Operation operation, const KNumber &arg2);
+    // lhs = lhs operation rhs
+    void evalOperation(KNumber &lhs, Operation operation, const KNumber &rhs);
+};
+
+class CalcEngine::Snapshot {
+public:
+    qint64 memoryUsage() const;
+    bool operator==(const Snapshot &other) const;
+
+private:
+    friend class CalcEngine;
+
+    QVector<Node> stack_;
+    KStats stats_;
+    KNumber last_number_;
+    Operation last_operation_ = FUNC_EQUAL;
+    KNumber last_repeat_number_;
+    bool repeat_mode_ = false;
+    bool only_update_operation_ = false;
+    bool percent_mode_ = false;
+    bool error_ = false;
 };
 
 
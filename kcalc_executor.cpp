@@ -0,0 +1,126 @@
+#include "kcalc_executor.h"
+
+#include <QRunnable>
+
+class KCalcExecutor::Runner : public QRunnable
+{
+public:
+    Runner(KCalcExecutor *executor, const Work &work, quint64 generation, const QSharedPointer<QAtomicInt> &canceled)
+        : executor_(executor)
+        , work_(work)
+        , generation_(generation)
+        , canceled_(canceled)
+    {
+    }
+
+    void run() override
+    {
+        const KNumber result = canceled_->load() ? KNumber::NaN : work_(*canceled_);
+
+        // delivered on the thread of the executor, dropped if it is gone
+        KCalcExecutor *const executor = executor_;
+        const quint64 generation = generation_;
+        QMetaObject::invokeMethod(executor, [executor, generation, result]() {
+            executor->deliver(generation, result);
+        }, Qt::QueuedConnection);
+    }
+
+private:
+    KCalcExecutor *const executor_;
+    const Work work_;
+    const quint64 generation_;
+    const QSharedPointer<QAtomicInt> canceled_;
+};
+
+KCalcExecutor::KCalcExecutor(QObject *parent)
+    : QObject(parent)
+    , canceled_(new QAtomicInt(0))
+{
+    // one worker runs the jobs one after the other
+    pool_.setMaxThreadCount(1);
+}
+
+KCalcExecutor::~KCalcExecutor()
+{
+    cancel();
+    pool_.waitForDone();
+}
+
+void KCalcExecutor::submit(const Prepare &prepare, const Done &done)
+{
+    queue_.enqueue(Job { prepare, done });
+    next();
+}
+
+bool KCalcExecutor::isBusy() const
+{
+    return busy_;
+}
+
+bool KCalcExecutor::isIdle() const
+{
+    return !running_ && !dispatching_ && queue_.isEmpty();
+}
+
+void KCalcExecutor::cancel()
+{
+    ++generation_;
+    canceled_->store(1);
+
+    // the worker stays taken until the work returns
+    queue_.clear();
+    current_ = Done();
+}
+
+void KCalcExecutor::next()
+{
+    // jobs submitted while preparing are picked up by the loop below
+    if (dispatching_) {
+        return;
+    }
+    dispatching_ = true;
+
+    while (!running_ && !queue_.isEmpty()) {
+        const Job job = queue_.dequeue();
+
+        const Work work = job.prepare ? job.prepare() : Work();
+        if (!work) {
+            continue;
+        }
+
+        running_ = true;
+        current_ = job.done;
+        canceled_.reset(new QAtomicInt(0));
+        pool_.start(new Runner(this, work, generation_, canceled_));
+    }
+
+    dispatching_ = false;
+    setBusy(running_);
+}
+
+void KCalcExecutor::deliver(quint64 generation, const KNumber &result)
+{
+    if (!running_) {
+        return;
+    }
+
+    // the next job is only prepared after this result is in, a canceled
+    // job's result is dropped
+    const Done done = generation == generation_ ? current_ : Done();
+    current_ = Done();
+    running_ = false;
+
+    if (done) {
+        done(result);
+    }
+
+    next();
+}
+
+void KCalcExecutor::setBusy(bool busy)
+{
+    if (busy_ != busy) {
+        busy_ = busy;
+        emit busyChanged(busy);
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef KCALC_EXECUTOR_H
+#define KCALC_EXECUTOR_H value
+
+#include "knumber/knumber.h"
+#include <QAtomicInt>
+#include <QObject>
+#include <QQueue>
+#include <QSharedPointer>
+#include <QThreadPool>
+
+#include <functional>
+
+// Runs calculations on a worker thread so the GUI never blocks.
+//
+// A job is prepared on the GUI thread only once every job submitted
+// before it has delivered its result, so it sees the state those
+// results left behind. Preparing returns the work to run on the worker,
+// or nothing if the job was handled right away. Results are handed to
+// the done callback on the GUI thread, in submission order.
+//
+// cancel() drops all queued jobs and the result of the running one. The
+// running work is asked to stop through the flag it is given, a single
+// GMP operation can not be interrupted though. Jobs submitted after it
+// are only prepared once the canceled work has returned, so a prepare
+// may always use what the work shares with the GUI.
+class KCalcExecutor : public QObject
+{
+    Q_OBJECT
+
+public:
+    using Work = std::function<KNumber(const QAtomicInt &canceled)>;
+    using Prepare = std::function<Work()>;
+    using Done = std::function<void(const KNumber &result)>;
+
+    explicit KCalcExecutor(QObject *parent = nullptr);
+    ~KCalcExecutor() override;
+
+    void submit(const Prepare &prepare, const Done &done = Done());
+    bool isBusy() const;
+
+    // nothing runs or waits, the GUI thread may use what jobs share
+    bool isIdle() const;
+
+public Q_SLOTS:
+    void cancel();
+
+Q_SIGNALS:
+    void busyChanged(bool busy);
+
+private:
+    struct Job {
+        Prepare prepare;
+        Done done;
+    };
+
+    class Runner;
+
+    void next();
+    void deliver(quint64 generation, const KNumber &result);
+    void setBusy(bool busy);
+
+    QThreadPool pool_;
+    QQueue<Job> queue_;
+    Done current_;
+    bool running_ = false;
+    bool dispatching_ = false;
+    bool busy_ = false;
+    quint64 generation_ = 0;
+    QSharedPointer<QAtomicInt> canceled_;
+};
+
+#endif
@@ -0,0 +1,739 @@
+#include "kcalc_factor.h"
+
+#include <QBitArray>
+#include <QByteArray>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QRegularExpression>
+#include <QRunnable>
+#include <QSharedPointer>
+#include <QStringList>
+
+#include <algorithm>
+#include <gmp.h>
+
+namespace {
+
+const unsigned long trialBound = 1UL << 16;
+
+// stage 1 bounds of the curves, growing with every round of curves
+const unsigned long firstBound = 2000;
+const unsigned long lastBound = 250000;
+
+// stage 2 covers the primes up to this multiple of the stage 1 bound
+const unsigned long stage2Factor = 50;
+
+// the giant steps of stage 2, baby steps are the residues coprime to it
+const unsigned long giantStep = 2 * 3 * 5 * 7;
+
+const long rhoIterations = 1L << 18;
+const int primeReps = 25;
+
+// how many primes or giant steps pass between looks at the stop flag
+const int pollInterval = 256;
+
+// an mpz_t with a lifetime
+class Integer
+{
+public:
+    Integer()
+    {
+        mpz_init(value_);
+    }
+
+    explicit Integer(unsigned long value)
+    {
+        mpz_init_set_ui(value_, value);
+    }
+
+    Integer(const Integer &other)
+    {
+        mpz_init_set(value_, other.value_);
+    }
+
+    Integer &operator=(const Integer &other)
+    {
+        mpz_set(value_, other.value_);
+        return *this;
+    }
+
+    ~Integer()
+    {
+        mpz_clear(value_);
+    }
+
+    operator mpz_ptr()
+    {
+        return value_;
+    }
+
+    operator mpz_srcptr() const
+    {
+        return value_;
+    }
+
+private:
+    mpz_t value_;
+};
+
+bool isOne(mpz_srcptr value)
+{
+    return mpz_cmp_ui(value, 1) == 0;
+}
+
+// 1 < divisor < n
+bool isProper(mpz_srcptr divisor, mpz_srcptr n)
+{
+    return mpz_cmp_ui(divisor, 1) > 0 && mpz_cmp(divisor, n) < 0;
+}
+
+// below the bound, the gmp macros need a plain pointer
+bool isBelow(mpz_srcptr value, unsigned long bound)
+{
+    return mpz_cmp_ui(value, bound) < 0;
+}
+
+bool isPrime(mpz_srcptr value)
+{
+    return mpz_probab_prime_p(value, primeReps) != 0;
+}
+
+// KNumber keeps its mpz to itself, the digits are the way in and out
+// like in knumber_integer::toUint64()
+void fromKNumber(mpz_ptr result, const KNumber &number)
+{
+    mpz_set_str(result, number.toQString().toLatin1().constData(), 10);
+}
+
+KNumber toKNumber(mpz_srcptr value)
+{
+    QByteArray digits(static_cast<int>(mpz_sizeinbase(value, 10)) + 2, '\0');
+    mpz_get_str(digits.data(), 10, value);
+    return KNumber(QString::fromLatin1(digits.constData()));
+}
+
+// bit i tells whether 2i + 1 is prime, up to the largest stage 2 bound
+const QBitArray &oddPrimes()
+{
+    static const QBitArray sieve = []() {
+        const qint64 size = lastBound * stage2Factor / 2 + 1;
+        QBitArray bits(static_cast<int>(size), true);
+        bits.clearBit(0);
+
+        for (qint64 i = 1; (2 * i + 1) * (2 * i + 1) / 2 < size; ++i) {
+            if (bits.testBit(static_cast<int>(i))) {
+                const qint64 p = 2 * i + 1;
+                for (qint64 j = p * p / 2; j < size; j += p) {
+                    bits.clearBit(static_cast<int>(j));
+                }
+            }
+        }
+
+        return bits;
+    }();
+    return sieve;
+}
+
+bool isSmallPrime(unsigned long value)
+{
+    return value == 2 || (value % 2 == 1 && oddPrimes().testBit(static_cast<int>(value / 2)));
+}
+
+// the primes up to the largest stage 1 bound
+const QVector<unsigned long> &smallPrimes()
+{
+    static const QVector<unsigned long> primes = []() {
+        QVector<unsigned long> result{2};
+        for (unsigned long value = 3; value <= lastBound; value += 2) {
+            if (isSmallPrime(value)) {
+                result.push_back(value);
+            }
+        }
+        return result;
+    }();
+    return primes;
+}
+
+// One composite being split. The walks and curves of all threads share
+// it, the first divisor offered stops them.
+struct Search {
+    Integer n;
+    QAtomicInt stopped;
+
+    QMutex mutex;
+    Integer divisor;
+    bool found = false;
+
+    // only the caller passes the external flag, helpers may outlive it
+    bool stop(const QAtomicInt *canceled)
+    {
+        if (canceled && canceled->load()) {
+            stopped.store(1);
+        }
+        return stopped.load();
+    }
+
+    bool offer(mpz_srcptr value)
+    {
+        QMutexLocker locker(&mutex);
+        if (!found) {
+            mpz_set(divisor, value);
+            found = true;
+        }
+        stopped.store(1);
+        return true;
+    }
+};
+
+// Pollard rho with Brent's cycle detection, the differences are
+// multiplied up in batches so only every batch takes a gcd.
+bool rho(Search &search, unsigned long c, const QAtomicInt *canceled)
+{
+    const mpz_srcptr n = search.n;
+    const long batchSize = 128;
+
+    Integer x;
+    Integer y(2);
+    Integer ys;
+    Integer product(1);
+    Integer g(1);
+    Integer t;
+    long iterations = 0;
+
+    const auto step = [n, c](mpz_ptr value) {
+        mpz_mul(value, value, value);
+        mpz_add_ui(value, value, c);
+        mpz_mod(value, value, n);
+    };
+
+    for (long r = 1; isOne(g); r *= 2) {
+        mpz_set(x, y);
+        for (long i = 0; i < r; ++i) {
+            step(y);
+        }
+
+        for (long k = 0; k < r && isOne(g); k += batchSize) {
+            mpz_set(ys, y);
+            const long batch = std::min(batchSize, r - k);
+            for (long i = 0; i < batch; ++i) {
+                step(y);
+                mpz_sub(t, x, y);
+                mpz_mul(product, product, t);
+                mpz_mod(product, product, n);
+            }
+            mpz_gcd(g, product, n);
+
+            iterations += batch;
+            if (search.stop(canceled) || iterations > rhoIterations) {
+                return false;
+            }
+        }
+    }
+
+    // the batch overshot, walk it again one step at a time
+    if (mpz_cmp(g, n) == 0) {
+        do {
+            step(ys);
+            mpz_sub(t, x, ys);
+            mpz_gcd(g, t, n);
+        } while (isOne(g));
+    }
+
+    return isProper(g, n) && search.offer(g);
+}
+
+// Montgomery curve b y^2 = x^3 + a x^2 + x in projective (x : z), with
+// a24 = (a + 2) / 4. Only x and z are computed, additions need the
+// difference of the points.
+class Curve
+{
+public:
+    Curve(mpz_srcptr n, mpz_srcptr a24)
+        : n_(n)
+        , a24_(a24)
+    {
+    }
+
+    void twice(mpz_ptr x2, mpz_ptr z2, mpz_srcptr x, mpz_srcptr z)
+    {
+        mpz_add(t1_, x, z);
+        mpz_mul(t1_, t1_, t1_);
+        mpz_mod(t1_, t1_, n_);
+        mpz_sub(t2_, x, z);
+        mpz_mul(t2_, t2_, t2_);
+        mpz_mod(t2_, t2_, n_);
+        mpz_sub(t3_, t1_, t2_);
+        mpz_mul(x2, t1_, t2_);
+        mpz_mod(x2, x2, n_);
+        mpz_mul(t4_, a24_, t3_);
+        mpz_add(t4_, t4_, t2_);
+        mpz_mul(z2, t3_, t4_);
+        mpz_mod(z2, z2, n_);
+    }
+
+    // (x3 : z3) = P + Q, with (xd : zd) = P - Q
+    void add(mpz_ptr x3, mpz_ptr z3, mpz_srcptr xp, mpz_srcptr zp, mpz_srcptr xq, mpz_srcptr zq,
+             mpz_srcptr xd, mpz_srcptr zd)
+    {
+        mpz_sub(t1_, xp, zp);
+        mpz_add(t2_, xq, zq);
+        mpz_mul(t1_, t1_, t2_);
+        mpz_mod(t1_, t1_, n_);
+        mpz_add(t2_, xp, zp);
+        mpz_sub(t3_, xq, zq);
+        mpz_mul(t2_, t2_, t3_);
+        mpz_mod(t2_, t2_, n_);
+        mpz_add(t3_, t1_, t2_);
+        mpz_mul(t3_, t3_, t3_);
+        mpz_mul(t3_, t3_, zd);
+        mpz_sub(t4_, t1_, t2_);
+        mpz_mul(t4_, t4_, t4_);
+        mpz_mul(t4_, t4_, xd);
+        mpz_mod(x3, t3_, n_);
+        mpz_mod(z3, t4_, n_);
+    }
+
+    // Montgomery ladder, R0 and R1 = R0 + P differ by P all the way
+    void multiply(mpz_ptr x, mpz_ptr z, unsigned long k)
+    {
+        mpz_set(xp_, x);
+        mpz_set(zp_, z);
+        mpz_set(x0_, x);
+        mpz_set(z0_, z);
+        twice(x1_, z1_, x0_, z0_);
+
+        int bit = 0;
+        while (bit + 1 < 64 && (k >> (bit + 1)) != 0) {
+            ++bit;
+        }
+
+        for (--bit; bit >= 0; --bit) {
+            if ((k >> bit) & 1) {
+                add(x0_, z0_, x0_, z0_, x1_, z1_, xp_, zp_);
+                twice(x1_, z1_, x1_, z1_);
+            } else {
+                add(x1_, z1_, x0_, z0_, x1_, z1_, xp_, zp_);
+                twice(x0_, z0_, x0_, z0_);
+            }
+        }
+
+        mpz_set(x, x0_);
+        mpz_set(z, z0_);
+    }
+
+private:
+    const mpz_srcptr n_;
+    const mpz_srcptr a24_;
+    Integer xp_, zp_, x0_, z0_, x1_, z1_;
+    Integer t1_, t2_, t3_, t4_;
+};
+
+// Lenstra's elliptic curve method on the curve of Suyama's
+// parametrization for sigma, which has a group order divisible by 12.
+bool ecm(Search &search, unsigned long sigma, unsigned long bound, const QAtomicInt *canceled)
+{
+    const mpz_srcptr n = search.n;
+
+    Integer u(sigma);
+    Integer v(sigma);
+    Integer x, z, t, a24, g;
+
+    // u = sigma^2 - 5, v = 4 sigma, the point (u^3 : v^3) and
+    // a24 = (v - u)^3 (3u + v) / (16 u^3 v)
+    mpz_mul(u, u, u);
+    mpz_sub_ui(u, u, 5);
+    mpz_mod(u, u, n);
+    mpz_mul_ui(v, v, 4);
+    mpz_mod(v, v, n);
+    mpz_powm_ui(x, u, 3, n);
+    mpz_powm_ui(z, v, 3, n);
+
+    mpz_sub(t, v, u);
+    mpz_powm_ui(t, t, 3, n);
+    mpz_mul_ui(a24, u, 3);
+    mpz_add(a24, a24, v);
+    mpz_mul(t, t, a24);
+    mpz_mod(t, t, n);
+    mpz_mul(a24, x, v);
+    mpz_mul_ui(a24, a24, 16);
+    mpz_mod(a24, a24, n);
+
+    if (!mpz_invert(g, a24, n)) {
+        // a lucky curve, the denominator shares a factor
+        mpz_gcd(g, a24, n);
+        return isProper(g, n) && search.offer(g);
+    }
+    mpz_mul(a24, t, g);
+    mpz_mod(a24, a24, n);
+
+    Curve curve(n, a24);
+
+    // stage 1: multiply by every prime power up to the bound
+    const QVector<unsigned long> &primes = smallPrimes();
+    for (int i = 0; i < primes.size() && primes.at(i) <= bound; ++i) {
+        const unsigned long p = primes.at(i);
+        unsigned long power = p;
+        while (static_cast<quint64>(power) * p <= bound) {
+            power *= p;
+        }
+        curve.multiply(x, z, power);
+
+        if (i % pollInterval == 0 && search.stop(canceled)) {
+            return false;
+        }
+    }
+
+    mpz_gcd(g, z, n);
+    if (isProper(g, n)) {
+        return search.offer(g);
+    }
+    if (!isOne(g)) {
+        return false;
+    }
+
+    // stage 2: one more prime q up to bound * stage2Factor. Writing
+    // q = m D +- j, [q]Q is at infinity mod p exactly when
+    // x([mD]Q) z([j]Q) - x([j]Q) z([mD]Q) vanishes mod p, and those
+    // are multiplied up for a single gcd.
+    const unsigned long last = bound * stage2Factor;
+    const int half = giantStep / 2;
+
+    QVector<int> residues;
+    QVector<Integer> xs(half);
+    QVector<Integer> zs(half);
+    for (int j = 1; j < half; j += 2) {
+        if (j % 3 != 0 && j % 5 != 0 && j % 7 != 0) {
+            residues.push_back(j);
+            mpz_set(xs[j], x);
+            mpz_set(zs[j], z);
+            curve.multiply(xs[j], zs[j], j);
+        }
+    }
+
+    unsigned long m = bound / giantStep + 1;
+    Integer xd(x), zd(z);
+    Integer xr(x), zr(z);
+    Integer xl(x), zl(z);
+    curve.multiply(xd, zd, giantStep);
+    curve.multiply(xr, zr, m * giantStep);
+    curve.multiply(xl, zl, (m - 1) * giantStep);
+
+    Integer product(1);
+    Integer xn, zn, t1, t2;
+    for (; m * giantStep - half <= last; ++m) {
+        for (const int j : residues) {
+            const unsigned long lower = m * giantStep - j;
+            const unsigned long upper = m * giantStep + j;
+            if ((lower > bound && lower <= last && isSmallPrime(lower))
+                || (upper > bound && upper <= last && isSmallPrime(upper))) {
+                mpz_mul(t1, xr, zs.at(j));
+                mpz_mul(t2, xs.at(j), zr);
+                mpz_sub(t1, t1, t2);
+                mpz_mul(product, product, t1);
+                mpz_mod(product, product, n);
+            }
+        }
+
+        // [(m + 1) D]Q from [mD]Q and [D]Q, their difference is [(m - 1) D]Q
+        curve.add(xn, zn, xr, zr, xd, zd, xl, zl);
+        mpz_swap(xl, xr);
+        mpz_swap(zl, zr);
+        mpz_swap(xr, xn);
+        mpz_swap(zr, zn);
+
+        if (m % pollInterval == 0 && search.stop(canceled)) {
+            return false;
+        }
+    }
+
+    mpz_gcd(g, product, n);
+    return isProper(g, n) && search.offer(g);
+}
+
+// Worker w of k takes walk w and the curves w, w + k, w + 2k, ... The
+// bounds grow with the rounds, so small factors turn up early and large
+// ones are still reached.
+void search(Search &search, int worker, int workers, const QAtomicInt *canceled)
+{
+    if (rho(search, worker + 1, canceled)) {
+        return;
+    }
+
+    for (unsigned long curve = worker; !search.stop(canceled); curve += workers) {
+        const unsigned long round = curve / workers + 1;
+        const unsigned long bound = std::min(lastBound, firstBound * round * round);
+
+        // sigma below 6 gives singular or tiny curves
+        if (ecm(search, curve + 6, bound, canceled)) {
+            return;
+        }
+    }
+}
+
+class Helper : public QRunnable
+{
+public:
+    Helper(const QSharedPointer<Search> &state, int worker, int workers)
+        : state_(state)
+        , worker_(worker)
+        , workers_(workers)
+    {
+    }
+
+    void run() override
+    {
+        search(*state_, worker_, workers_, nullptr);
+    }
+
+private:
+    const QSharedPointer<Search> state_;
+    const int worker_;
+    const int workers_;
+};
+
+// a proper divisor of the composite n, false if canceled
+bool split(mpz_ptr divisor, mpz_srcptr n, const QAtomicInt *canceled)
+{
+    QSharedPointer<Search> state(new Search);
+    mpz_set(state->n, n);
+
+    // only idle threads help, the caller searches in any case
+    QThreadPool *const pool = QThreadPool::globalInstance();
+    const int workers = qMax(1, pool->maxThreadCount());
+    for (int i = 1; i < workers; ++i) {
+        auto helper = new Helper(state, i, workers);
+        if (!pool->tryStart(helper)) {
+            delete helper;
+            break;
+        }
+    }
+
+    search(*state, 0, workers, canceled);
+
+    QMutexLocker locker(&state->mutex);
+    if (!state->found) {
+        return false;
+    }
+    mpz_set(divisor, state->divisor);
+    return true;
+}
+
+const QRegularExpression &factorRegex()
+{
+    static const QRegularExpression regex(QStringLiteral("^\\s*factor\\s*\\((.*)\\)\\s*$"),
+                                          QRegularExpression::CaseInsensitiveOption);
+    return regex;
+}
+}
+
+class KCalcFactor::Driver : public QRunnable
+{
+public:
+    Driver(KCalcFactor *factor, const KNumber &number)
+        : factor_(factor)
+        , number_(number)
+    {
+    }
+
+    void run() override
+    {
+        KCalcFactor *const factor = factor_;
+        const bool complete = KCalcFactor::factor(number_, [factor](const KNumber &prime, int exponent) {
+            emit factor->factorFound(prime, exponent);
+        }, &factor->canceled_);
+
+        emit factor->finished(complete);
+    }
+
+private:
+    KCalcFactor *const factor_;
+    const KNumber number_;
+};
+
+KCalcFactor::KCalcFactor(QObject *parent)
+    : QObject(parent)
+{
+    qRegisterMetaType<KNumber>();
+
+    // the driver splits into the global pool itself
+    pool_.setMaxThreadCount(1);
+}
+
+KCalcFactor::~KCalcFactor()
+{
+    cancel();
+    waitForFinished();
+}
+
+bool KCalcFactor::isFactorization(const QString &text)
+{
+    return factorRegex().match(text).hasMatch();
+}
+
+bool KCalcFactor::start(KCalcParser &parser, const QString &text)
+{
+    const auto match = factorRegex().match(text);
+    if (!match.hasMatch()) {
+        return false;
+    }
+
+    int errors = 0;
+    const auto connection = connect(&parser, &KCalcParser::foundInvalidToken, [&errors](int) { ++errors; });
+    const KNumber number = parser.parseExpression(match.captured(1));
+    disconnect(connection);
+
+    if (errors > 0 || !start(number)) {
+        return false;
+    }
+
+    expression_ = match.captured(1).trimmed();
+    return true;
+}
+
+bool KCalcFactor::start(const KNumber &number)
+{
+    if (number.type() != KNumber::TYPE_INTEGER) {
+        return false;
+    }
+
+    cancel();
+    waitForFinished();
+
+    canceled_.store(0);
+    pool_.start(new Driver(this, number));
+    return true;
+}
+
+void KCalcFactor::cancel()
+{
+    canceled_.store(1);
+}
+
+void KCalcFactor::waitForFinished()
+{
+    pool_.waitForDone();
+}
+
+QString KCalcFactor::expression() const
+{
+    return expression_;
+}
+
+bool KCalcFactor::factor(const KNumber &number, const Found &found, const QAtomicInt *canceled)
+{
+    if (number.type() != KNumber::TYPE_INTEGER) {
+        return false;
+    }
+
+    Integer remaining;
+    fromKNumber(remaining, number);
+
+    // 0 and +-1 are their own factorization
+    if (mpz_cmpabs_ui(remaining, 1) <= 0) {
+        found(number, 1);
+        return true;
+    }
+
+    if (isBelow(remaining, 0)) {
+        found(KNumber::NegOne, 1);
+        mpz_neg(remaining, remaining);
+    }
+
+    QVector<Integer> composites;
+
+    // divides every power of the prime out of what is left, so each
+    // prime is reported once with its exponent
+    const auto report = [&](const Integer prime) {
+        const auto exponent = mpz_remove(remaining, remaining, prime);
+        if (exponent == 0) {
+            return;
+        }
+        for (Integer &composite : composites) {
+            mpz_remove(composite, composite, prime);
+        }
+        found(toKNumber(prime), static_cast<int>(exponent));
+    };
+
+    const QVector<unsigned long> &primes = smallPrimes();
+    for (int i = 0; i < primes.size() && primes.at(i) < trialBound; ++i) {
+        const unsigned long p = primes.at(i);
+        if (isBelow(remaining, p * p)) {
+            break;
+        }
+        if (mpz_divisible_ui_p(remaining, p)) {
+            report(Integer(p));
+        }
+        if (i % pollInterval == 0 && canceled && canceled->load()) {
+            return false;
+        }
+    }
+
+    if (isOne(remaining)) {
+        return true;
+    }
+
+    // no factor below the square root is left
+    if (isBelow(remaining, trialBound * trialBound)) {
+        report(remaining);
+        return true;
+    }
+
+    composites.push_back(remaining);
+    while (!composites.isEmpty()) {
+        if (canceled && canceled->load()) {
+            return false;
+        }
+
+        Integer n = composites.takeLast();
+        if (isOne(n)) {
+            continue;
+        }
+
+        if (isPrime(n)) {
+            report(n);
+            continue;
+        }
+
+        if (mpz_perfect_power_p(n)) {
+            Integer root;
+            for (unsigned long k = 2; !mpz_root(root, n, k); ++k) {
+            }
+            composites.push_back(root);
+            continue;
+        }
+
+        Integer divisor;
+        if (!split(divisor, n, canceled)) {
+            return false;
+        }
+        mpz_divexact(n, n, divisor);
+        composites.push_back(divisor);
+        composites.push_back(n);
+    }
+
+    return true;
+}
+
+QVector<KCalcFactor::Factor> KCalcFactor::factors(const KNumber &number, const QAtomicInt *canceled)
+{
+    QVector<Factor> result;
+    if (!factor(number, [&result](const KNumber &prime, int exponent) { result.push_back(Factor{prime, exponent}); }, canceled)) {
+        return QVector<Factor>();
+    }
+    return result;
+}
+
+QString KCalcFactor::toString(QVector<Factor> factors, const std::function<QString(const KNumber &)> &format)
+{
+    std::sort(factors.begin(), factors.end(), [](const Factor &lhs, const Factor &rhs) { return lhs.prime < rhs.prime; });
+
+    QStringList terms;
+    for (const Factor &factor : factors) {
+        QString term = format ? format(factor.prime) : factor.prime.toQString();
+        if (factor.exponent > 1) {
+            term += QLatin1Char('^') + QString::number(factor.exponent);
+        }
+        terms.push_back(term);
+    }
+    return terms.join(QStringLiteral(" * "));
+}
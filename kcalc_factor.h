@@ -0,0 +1,70 @@
+#ifndef KCALC_FACTOR_H
+#define KCALC_FACTOR_H value
+
+#include "kcalc_parser.h"
+#include <QAtomicInt>
+#include <QObject>
+#include <QThreadPool>
+#include <QVector>
+
+#include <functional>
+
+// Factors an integer into primes, e.g. "factor(2^128 + 1)".
+//
+// Primes below 2^16 are divided out first. Every composite left is split
+// by Pollard rho walks and then by elliptic curves (Montgomery curves,
+// stage 1 and a baby-step giant-step stage 2) of growing bounds. The
+// walks and curves are independent, the caller and idle threads of the
+// global pool each take their own; the first factor found stops all of
+// them. There is no bound on the work, a hard number is factored until
+// canceled.
+//
+// factorFound() is emitted for every prime as soon as it is known, so
+// partial results can be shown while the rest is still being searched.
+class KCalcFactor : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Factor {
+        KNumber prime;
+        int exponent;
+    };
+
+    // called on the factoring thread
+    using Found = std::function<void(const KNumber &prime, int exponent)>;
+
+    explicit KCalcFactor(QObject *parent = nullptr);
+    ~KCalcFactor() override;
+
+    static bool isFactorization(const QString &text);
+
+    bool start(KCalcParser &parser, const QString &text);
+    bool start(const KNumber &number);
+    void cancel();
+    void waitForFinished();
+
+    QString expression() const;
+
+    // Blocks until the number is factored, -1 is a factor of negative
+    // numbers. False if canceled or the number is no integer.
+    static bool factor(const KNumber &number, const Found &found, const QAtomicInt *canceled = nullptr);
+    static QVector<Factor> factors(const KNumber &number, const QAtomicInt *canceled = nullptr);
+
+    // "2^3 * 3 * 5^2", ordered by the primes, which are written by
+    // format if given
+    static QString toString(QVector<Factor> factors, const std::function<QString(const KNumber &)> &format = nullptr);
+
+Q_SIGNALS:
+    void factorFound(const KNumber &prime, int exponent);
+    void finished(bool complete);
+
+private:
+    class Driver;
+
+    QThreadPool pool_;
+    QAtomicInt canceled_;
+    QString expression_;
+};
+
+#endif
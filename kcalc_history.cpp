@@ -0,0 +1,100 @@
+#include "kcalc_history.h"
+
+namespace {
+
+// list node and bookkeeping of an entry
+const qint64 entryOverhead = 32;
+
+qint64 memoryUsage(const KCalcHistory::State &state)
+{
+    return entryOverhead + sizeof(KCalcHistory::State) + state.core.memoryUsage()
+        + state.input.size() * sizeof(QChar) + state.memory.memoryUsage();
+}
+}
+
+bool KCalcHistory::State::operator==(const State &other) const
+{
+    return input == other.input && cursor == other.cursor && memory == other.memory && core == other.core;
+}
+
+KCalcHistory::KCalcHistory(qint64 budget)
+    : budget_(budget)
+{
+}
+
+void KCalcHistory::record(const State &state)
+{
+    if (current_ >= 0 && entries_.at(current_).state == state) {
+        return;
+    }
+
+    while (entries_.size() > current_ + 1) {
+        bytes_ -= entries_.last().bytes;
+        entries_.removeLast();
+    }
+
+    entries_.append(Entry{state, memoryUsage(state)});
+    bytes_ += entries_.last().bytes;
+    current_ = entries_.size() - 1;
+    trim();
+}
+
+bool KCalcHistory::canUndo() const
+{
+    return current_ > 0;
+}
+
+bool KCalcHistory::canRedo() const
+{
+    return current_ + 1 < entries_.size();
+}
+
+const KCalcHistory::State &KCalcHistory::undo()
+{
+    Q_ASSERT(canUndo());
+    return entries_.at(--current_).state;
+}
+
+const KCalcHistory::State &KCalcHistory::redo()
+{
+    Q_ASSERT(canRedo());
+    return entries_.at(++current_).state;
+}
+
+void KCalcHistory::clear()
+{
+    entries_.clear();
+    current_ = -1;
+    bytes_ = 0;
+}
+
+int KCalcHistory::count() const
+{
+    return entries_.size();
+}
+
+qint64 KCalcHistory::bytes() const
+{
+    return bytes_;
+}
+
+void KCalcHistory::setBudget(qint64 bytes)
+{
+    budget_ = bytes;
+    trim();
+}
+
+qint64 KCalcHistory::budget() const
+{
+    return budget_;
+}
+
+void KCalcHistory::trim()
+{
+    // the current state always stays
+    while (bytes_ > budget_ && current_ > 0) {
+        bytes_ -= entries_.first().bytes;
+        entries_.removeFirst();
+        --current_;
+    }
+}
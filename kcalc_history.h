@@ -0,0 +1,58 @@
+#ifndef KCALC_HISTORY_H
+#define KCALC_HISTORY_H value
+
+#include "kcalc_core.h"
+#include <QList>
+#include <QString>
+
+// Undo and redo over snapshots of the whole calculator: the engine with
+// its statistics, the typed input and the memory.
+//
+// States share their data with each other and with the live calculator,
+// recording one per keystroke costs O(1) in the history and in the data.
+// There is no limit on the depth, the oldest states are dropped once the
+// recorded ones hold more than the budget.
+class KCalcHistory
+{
+public:
+    struct State {
+        CalcEngine::Snapshot core;
+        QString input;
+        int cursor = 0;
+        KNumber memory;
+
+        bool operator==(const State &other) const;
+    };
+
+    explicit KCalcHistory(qint64 budget = 16 << 20);
+
+    // a state equal to the current one is not recorded again, any other
+    // drops the states which could be redone
+    void record(const State &state);
+
+    bool canUndo() const;
+    bool canRedo() const;
+    const State &undo();
+    const State &redo();
+    void clear();
+
+    int count() const;
+    qint64 bytes() const;
+    void setBudget(qint64 bytes);
+    qint64 budget() const;
+
+private:
+    struct Entry {
+        State state;
+        qint64 bytes;
+    };
+
+    void trim();
+
+    QList<Entry> entries_;
+    int current_ = -1;
+    qint64 bytes_ = 0;
+    qint64 budget_;
+};
+
+#endif
@@ -0,0 +1,434 @@
+#include "kcalc_import.h"
+
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QtEndian>
+
+#include <cstring>
+
+namespace {
+
+// values parsed between two looks at the cancel flag
+const int cancelInterval = 4096;
+
+bool isSeparator(char c)
+{
+    return c == ',' || c == ';' || c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+int widthOf(KCalcImport::Format format)
+{
+    switch (format) {
+    case KCalcImport::Double:
+    case KCalcImport::Int64:
+        return 8;
+    case KCalcImport::Int32:
+        return 4;
+    case KCalcImport::Text:
+        break;
+    }
+    return 1;
+}
+
+// "-12", "3.25e-4" or "1/3", anything else is NaN. Integers which fit
+// are taken directly, the rest goes through the same constructor as
+// typed input.
+KNumber toNumber(const char *begin, const char *end)
+{
+    if (begin != end && *begin == '+') {
+        ++begin;
+    }
+
+    const char *p = begin;
+    if (p != end && *p == '-') {
+        ++p;
+    }
+
+    const char *const digits = p;
+    while (p != end && isDigit(*p)) {
+        ++p;
+    }
+
+    if (p == end && p != digits && p - digits <= 18) {
+        qint64 value = 0;
+        for (const char *q = digits; q != end; ++q) {
+            value = value * 10 + (*q - '0');
+        }
+        return KNumber(digits == begin ? value : -value);
+    }
+
+    int mantissa = static_cast<int>(p - digits);
+
+    if (p != end && *p == '/') {
+        const char *const denominator = ++p;
+        while (p != end && isDigit(*p)) {
+            ++p;
+        }
+        if (mantissa == 0 || p == denominator) {
+            return KNumber::NaN;
+        }
+    } else {
+        if (p != end && *p == '.') {
+            for (++p; p != end && isDigit(*p); ++p) {
+                ++mantissa;
+            }
+        }
+        if (mantissa == 0) {
+            return KNumber::NaN;
+        }
+        if (p != end && (*p == 'e' || *p == 'E')) {
+            if (++p != end && (*p == '+' || *p == '-')) {
+                ++p;
+            }
+            const char *const exponent = p;
+            while (p != end && isDigit(*p)) {
+                ++p;
+            }
+            if (p == exponent) {
+                return KNumber::NaN;
+            }
+        }
+    }
+
+    if (p != end) {
+        return KNumber::NaN;
+    }
+
+    QString text = QString::fromLatin1(begin, end - begin);
+    text.replace(QLatin1Char('.'), KNumber::decimalSeparator());
+    text.replace(QLatin1Char('E'), QLatin1Char('e'));
+    return KNumber(text);
+}
+}
+
+class KCalcImport::Worker : public QRunnable
+{
+public:
+    explicit Worker(KCalcImport *import)
+        : import_(import)
+    {
+    }
+
+    void run() override
+    {
+        while (!import_->canceled_.load()) {
+            const qint64 chunk = import_->nextChunk_.fetchAndAddRelaxed(1);
+            if (chunk >= import_->chunks_) {
+                break;
+            }
+
+            const qint64 begin = chunk * import_->step_;
+            const qint64 end = qMin(begin + import_->step_, import_->size_);
+
+            QVector<KNumber> values;
+            qint64 skipped = 0;
+            if (import_->format_ == Text) {
+                import_->parseText(begin, end, values, skipped);
+            } else {
+                import_->parseBinary(begin, end, values, skipped);
+            }
+
+            import_->deliver(chunk, values, end - begin, skipped);
+        }
+
+        import_->leave();
+    }
+
+private:
+    KCalcImport *const import_;
+};
+
+KCalcImport::KCalcImport(QObject *parent)
+    : QObject(parent)
+{
+}
+
+KCalcImport::~KCalcImport()
+{
+    cancel();
+    waitForFinished();
+}
+
+KCalcImport::Format KCalcImport::formatFor(const QString &fileName)
+{
+    const QString suffix = QFileInfo(fileName).suffix().toLower();
+
+    if (suffix == QLatin1String("f64") || suffix == QLatin1String("bin")) {
+        return Double;
+    }
+    if (suffix == QLatin1String("i32")) {
+        return Int32;
+    }
+    if (suffix == QLatin1String("i64")) {
+        return Int64;
+    }
+    return Text;
+}
+
+bool KCalcImport::start(const QString &fileName)
+{
+    return start(fileName, formatFor(fileName));
+}
+
+bool KCalcImport::start(const QString &fileName, Format format)
+{
+    cancel();
+    waitForFinished();
+
+    // closing unmaps the last file
+    file_.close();
+    file_.setFileName(fileName);
+    buffer_.clear();
+    data_ = nullptr;
+
+    if (!file_.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    size_ = file_.size();
+    if (size_ > 0) {
+        data_ = reinterpret_cast<const char *>(file_.map(0, size_));
+    }
+    if (!data_) {
+        // not every file can be mapped, a pipe for one
+        buffer_ = file_.readAll();
+        data_ = buffer_.constData();
+        size_ = buffer_.size();
+    }
+
+    format_ = format;
+
+    // a UTF-8 byte order mark is no data
+    if (format_ == Text && size_ >= 3 && std::memcmp(data_, "\xEF\xBB\xBF", 3) == 0) {
+        data_ += 3;
+        size_ -= 3;
+    }
+
+    // binary chunks hold whole values
+    const int width = widthOf(format_);
+    step_ = qMax(width, chunkSize_ - chunkSize_ % width);
+    chunks_ = qMax<qint64>(1, (size_ + step_ - 1) / step_);
+
+    values_ = QVector<QVector<KNumber>>(static_cast<int>(chunks_));
+    done_ = 0;
+    skipped_ = 0;
+    nextChunk_.store(0);
+    canceled_.store(0);
+
+    const int workers = static_cast<int>(qMin<qint64>(pool_.maxThreadCount(), chunks_));
+    running_.store(workers);
+    for (int i = 0; i < workers; ++i) {
+        pool_.start(new Worker(this));
+    }
+
+    return true;
+}
+
+void KCalcImport::cancel()
+{
+    canceled_.store(1);
+}
+
+void KCalcImport::waitForFinished()
+{
+    pool_.waitForDone();
+}
+
+void KCalcImport::setColumn(int column)
+{
+    column_ = qMax(-1, column);
+}
+
+int KCalcImport::column() const
+{
+    return column_;
+}
+
+void KCalcImport::setChunkSize(int bytes)
+{
+    chunkSize_ = qMax(1, bytes);
+}
+
+int KCalcImport::chunkSize() const
+{
+    return chunkSize_;
+}
+
+qint64 KCalcImport::size() const
+{
+    return size_;
+}
+
+qint64 KCalcImport::skipped() const
+{
+    QMutexLocker locker(&mutex_);
+    return skipped_;
+}
+
+QVector<KNumber> KCalcImport::takeValues()
+{
+    QMutexLocker locker(&mutex_);
+
+    int count = 0;
+    for (const QVector<KNumber> &chunk : qAsConst(values_)) {
+        count += chunk.size();
+    }
+
+    QVector<KNumber> values;
+    values.reserve(count);
+    for (QVector<KNumber> &chunk : values_) {
+        for (KNumber &number : chunk) {
+            values.append(std::move(number));
+        }
+        chunk.clear();
+    }
+
+    return values;
+}
+
+// Takes the lines starting in [begin, end), the last one may reach into
+// the next chunk.
+void KCalcImport::parseText(qint64 begin, qint64 end, QVector<KNumber> &values, qint64 &skipped) const
+{
+    const char *p = data_ + begin;
+    const char *const stop = data_ + end;
+    const char *const last = data_ + size_;
+
+    // the line cut by the chunk start belongs to the chunk before
+    while (p > data_ && p < last && p[-1] != '\n') {
+        ++p;
+    }
+
+    while (p < stop) {
+        // fields are delimited by a comma or semicolon each, or by white
+        // space between two values
+        int field = 0;
+        bool inField = false;
+
+        while (p < last && *p != '\n') {
+            const char c = *p;
+            if (c == ',' || c == ';') {
+                ++field;
+                inField = false;
+                ++p;
+                continue;
+            }
+            if (isSeparator(c)) {
+                ++p;
+                continue;
+            }
+
+            if (inField) {
+                ++field;
+            }
+            inField = true;
+
+            const char *token = p;
+            const char *tokenEnd;
+            if (c == '"') {
+                token = ++p;
+                while (p < last && *p != '"' && *p != '\n') {
+                    ++p;
+                }
+                tokenEnd = p;
+                if (p < last && *p == '"') {
+                    ++p;
+                }
+            } else {
+                while (p < last && !isSeparator(*p)) {
+                    ++p;
+                }
+                tokenEnd = p;
+            }
+
+            if (column_ >= 0 && field != column_) {
+                continue;
+            }
+
+            KNumber number = toNumber(token, tokenEnd);
+            if (number.type() == KNumber::TYPE_ERROR) {
+                ++skipped;
+                continue;
+            }
+
+            values.append(std::move(number));
+            if (values.size() % cancelInterval == 0 && canceled_.load()) {
+                return;
+            }
+        }
+
+        ++p;
+    }
+}
+
+void KCalcImport::parseBinary(qint64 begin, qint64 end, QVector<KNumber> &values, qint64 &skipped) const
+{
+    const int width = widthOf(format_);
+    values.reserve(static_cast<int>((end - begin) / width));
+
+    const char *p = data_ + begin;
+    for (; p + width <= data_ + end; p += width) {
+        const uchar *const bytes = reinterpret_cast<const uchar *>(p);
+
+        switch (format_) {
+        case Double: {
+            const quint64 bits = qFromLittleEndian<quint64>(bytes);
+            double value;
+            std::memcpy(&value, &bits, sizeof(value));
+            if (qIsFinite(value)) {
+                values.append(KNumber(value));
+            } else {
+                ++skipped;
+            }
+            break;
+        }
+        case Int32:
+            values.append(KNumber(qFromLittleEndian<qint32>(bytes)));
+            break;
+        case Int64:
+            values.append(KNumber(qFromLittleEndian<qint64>(bytes)));
+            break;
+        case Text:
+            break;
+        }
+
+        if (values.size() % cancelInterval == 0 && canceled_.load()) {
+            return;
+        }
+    }
+
+    // a value cut off at the end of the file
+    if (p != data_ + end) {
+        ++skipped;
+    }
+}
+
+void KCalcImport::deliver(qint64 chunk, QVector<KNumber> &values, qint64 bytes, qint64 skipped)
+{
+    QMutexLocker locker(&mutex_);
+
+    if (canceled_.load()) {
+        return;
+    }
+
+    values_[static_cast<int>(chunk)].swap(values);
+    done_ += bytes;
+    skipped_ += skipped;
+
+    // emitting under the lock keeps the progress increasing
+    emit progress(done_, size_);
+}
+
+void KCalcImport::leave()
+{
+    // the last worker to stop reports
+    if (!running_.deref()) {
+        emit finished(!canceled_.load());
+    }
+}
@@ -0,0 +1,96 @@
+#ifndef KCALC_IMPORT_H
+#define KCALC_IMPORT_H value
+
+#include "knumber/knumber.h"
+#include <QAtomicInt>
+#include <QFile>
+#include <QMutex>
+#include <QObject>
+#include <QThreadPool>
+#include <QVector>
+
+// Reads a file of samples for the statistic mode.
+//
+// Text files hold numbers written the C way ("-12", "3.25e-4", "1/3")
+// separated by commas, semicolons or white space, so CSV files and
+// plain columns both work; fields which are no number, like a header,
+// are skipped and counted. Binary files are arrays of little endian
+// doubles, 32 or 64 bit integers, told apart by formatFor().
+//
+// The file is mapped into memory and cut into chunks, text chunks at
+// line starts, which the workers of a private pool parse straight into
+// KNumber. progress() is emitted for every chunk done, finished() once
+// all workers are idle; takeValues() then returns the values in file
+// order.
+class KCalcImport : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Format {
+        Text,
+        Double,
+        Int32,
+        Int64
+    };
+
+    explicit KCalcImport(QObject *parent = nullptr);
+    ~KCalcImport() override;
+
+    // "*.f64" and "*.bin" are doubles, "*.i32" and "*.i64" integers,
+    // everything else is text
+    static Format formatFor(const QString &fileName);
+
+    bool start(const QString &fileName);
+    bool start(const QString &fileName, Format format);
+    void cancel();
+    void waitForFinished();
+
+    // the field of every text line to read, counting from 0, or -1 for
+    // all of them
+    void setColumn(int column);
+    int column() const;
+
+    void setChunkSize(int bytes);
+    int chunkSize() const;
+
+    qint64 size() const;
+    qint64 skipped() const;
+    QVector<KNumber> takeValues();
+
+Q_SIGNALS:
+    void progress(qint64 done, qint64 total);
+    void finished(bool complete);
+
+private:
+    class Worker;
+    friend class Worker;
+
+    void parseText(qint64 begin, qint64 end, QVector<KNumber> &values, qint64 &skipped) const;
+    void parseBinary(qint64 begin, qint64 end, QVector<KNumber> &values, qint64 &skipped) const;
+    void deliver(qint64 chunk, QVector<KNumber> &values, qint64 bytes, qint64 skipped);
+    void leave();
+
+    QThreadPool pool_;
+    QFile file_;
+    QByteArray buffer_;
+    const char *data_ = nullptr;
+    qint64 size_ = 0;
+    Format format_ = Text;
+    int column_ = -1;
+    int chunkSize_ = 1 << 20;
+    qint64 step_ = 0;
+    qint64 chunks_ = 0;
+
+    QAtomicInteger<qint64> nextChunk_;
+    QAtomicInt running_;
+    QAtomicInt canceled_;
+
+    // guarded by mutex_
+    mutable QMutex mutex_;
+    QVector<QVector<KNumber>> values_;
+    qint64 done_ = 0;
+    qint64 skipped_ = 0;
+};
+
+#endif
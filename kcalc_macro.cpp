@@ -0,0 +1,213 @@
+#include "kcalc_macro.h"
+
+namespace {
+
+using EngineFunction = void (CalcEngine::*)(const KNumber &);
+
+// in the order of KCalcMacro::Function
+const EngineFunction functions[] = {
+    &CalcEngine::ArcCosDeg,
+    &CalcEngine::ArcCosRad,
+    &CalcEngine::ArcCosGrad,
+    &CalcEngine::ArcSinDeg,
+    &CalcEngine::ArcSinRad,
+    &CalcEngine::ArcSinGrad,
+    &CalcEngine::ArcTangensDeg,
+    &CalcEngine::ArcTangensRad,
+    &CalcEngine::ArcTangensGrad,
+    &CalcEngine::AreaCosHyp,
+    &CalcEngine::AreaSinHyp,
+    &CalcEngine::AreaTangensHyp,
+    &CalcEngine::Complement,
+    &CalcEngine::CosDeg,
+    &CalcEngine::CosRad,
+    &CalcEngine::CosGrad,
+    &CalcEngine::CosHyp,
+    &CalcEngine::Cube,
+    &CalcEngine::CubeRoot,
+    &CalcEngine::Exp,
+    &CalcEngine::Exp10,
+    &CalcEngine::Factorial,
+    &CalcEngine::Gamma,
+    &CalcEngine::InvertSign,
+    &CalcEngine::Ln,
+    &CalcEngine::Log10,
+    &CalcEngine::ParenOpen,
+    &CalcEngine::Reciprocal,
+    &CalcEngine::SinDeg,
+    &CalcEngine::SinGrad,
+    &CalcEngine::SinRad,
+    &CalcEngine::SinHyp,
+    &CalcEngine::Square,
+    &CalcEngine::SquareRoot,
+    &CalcEngine::StatClearAll,
+    &CalcEngine::StatCount,
+    &CalcEngine::StatDataNew,
+    &CalcEngine::StatDataDel,
+    &CalcEngine::StatMean,
+    &CalcEngine::StatMedian,
+    &CalcEngine::StatStdDeviation,
+    &CalcEngine::StatStdSample,
+    &CalcEngine::StatSum,
+    &CalcEngine::StatSumSquares,
+    &CalcEngine::TangensDeg,
+    &CalcEngine::TangensRad,
+    &CalcEngine::TangensGrad,
+    &CalcEngine::TangensHyp,
+};
+
+static_assert(sizeof(functions) / sizeof(functions[0]) == KCalcMacro::FunctionCount,
+              "one engine function per KCalcMacro::Function");
+}
+
+KCalcMacro::Recorder::Recorder(KCalcMacro &macro, NumBase base)
+    : macro_(macro)
+    , base_(base)
+{
+}
+
+KCalcMacro::Recorder::~Recorder()
+{
+    typed();
+}
+
+void KCalcMacro::Recorder::setBase(NumBase base)
+{
+    // the number typed so far is in the old base
+    typed();
+    base_ = base;
+}
+
+void KCalcMacro::Recorder::digit(int digit)
+{
+    keys_ += QString::number(digit, 16);
+}
+
+void KCalcMacro::Recorder::point()
+{
+    keys_ += QLatin1Char('.');
+}
+
+void KCalcMacro::Recorder::exponent()
+{
+    keys_ += QLatin1Char('e');
+}
+
+void KCalcMacro::Recorder::backspace()
+{
+    keys_.chop(1);
+}
+
+void KCalcMacro::Recorder::enterOperation(CalcEngine::Operation operation)
+{
+    typed();
+    macro_.steps_.push_back(Step{OPERATION, static_cast<quint8>(operation)});
+}
+
+void KCalcMacro::Recorder::apply(Function function)
+{
+    typed();
+    macro_.steps_.push_back(Step{FUNCTION, static_cast<quint8>(function)});
+}
+
+void KCalcMacro::Recorder::parenClose()
+{
+    typed();
+    macro_.steps_.push_back(Step{PAREN_CLOSE, 0});
+}
+
+void KCalcMacro::Recorder::typed()
+{
+    if (keys_.isEmpty()) {
+        return;
+    }
+
+    KNumber number = KNumber::Zero;
+    if (base_ == NB_DECIMAL) {
+        // a trailing exponent key adds nothing, a lone point is 0
+        QString text = keys_;
+        if (text.endsWith(QLatin1Char('e'))) {
+            text.chop(1);
+        }
+        if (text.startsWith(QLatin1Char('e'))) {
+            text.prepend(QLatin1Char('1'));
+        }
+        if (!text.isEmpty() && text != QLatin1String(".")) {
+            text.replace(QLatin1Char('.'), KNumber::decimalSeparator());
+            number = KNumber(text);
+        }
+    } else {
+        const KNumber base(static_cast<int>(base_));
+        for (const QChar c : qAsConst(keys_)) {
+            number = number * base + KNumber(QString(c).toInt(nullptr, 16));
+        }
+    }
+
+    keys_.clear();
+    macro_.steps_.push_back(Step{NUMBER, 0});
+    macro_.numbers_.push_back(number);
+}
+
+bool KCalcMacro::isEmpty() const
+{
+    return steps_.isEmpty();
+}
+
+int KCalcMacro::size() const
+{
+    return steps_.size();
+}
+
+void KCalcMacro::clear()
+{
+    steps_.clear();
+    numbers_.clear();
+}
+
+KNumber KCalcMacro::run(CalcEngine &core, const KNumber &input) const
+{
+    KNumber display = input;
+    int number = 0;
+    bool error;
+
+    for (const Step &step : steps_) {
+        switch (step.kind) {
+        case NUMBER:
+            display = numbers_.at(number++);
+            continue;
+        case OPERATION:
+            core.enterOperation(display, CalcEngine::Operation(step.id));
+            break;
+        case FUNCTION:
+            (core.*functions[step.id])(display);
+            if (step.id == ParenOpen) {
+                continue;
+            }
+            break;
+        case PAREN_CLOSE:
+            core.ParenClose(display);
+            break;
+        }
+        display = core.lastOutput(error);
+    }
+
+    return display;
+}
+
+QVector<KNumber> KCalcMacro::run(const QVector<KNumber> &inputs, const CalcEngine::Settings &settings,
+                                 const QAtomicInt *canceled) const
+{
+    CalcEngine core(settings);
+    QVector<KNumber> results;
+    results.reserve(inputs.size());
+
+    for (const KNumber &input : inputs) {
+        if (canceled && canceled->load()) {
+            break;
+        }
+        core.Reset();
+        results.push_back(run(core, input));
+    }
+
+    return results;
+}
@@ -0,0 +1,132 @@
+#ifndef KCALC_MACRO_H
+#define KCALC_MACRO_H value
+
+#include "kcalc_core.h"
+#include "kcalc_modes.h"
+#include <QAtomicInt>
+#include <QString>
+#include <QVector>
+
+// A recorded key sequence, replayed straight against a CalcEngine.
+//
+// Every step works on the value the display would show: a typed number
+// replaces it, operations and functions are entered with it and leave
+// the engine's output in it. Steps are two bytes of ids, the typed
+// numbers are kept apart in the order they are used. A replay starts
+// with its input as the value, so a sequence recorded on one number
+// applies to any other.
+class KCalcMacro
+{
+public:
+    // the functions of CalcEngine taking the displayed value
+    enum Function : quint8 {
+        ArcCosDeg,
+        ArcCosRad,
+        ArcCosGrad,
+        ArcSinDeg,
+        ArcSinRad,
+        ArcSinGrad,
+        ArcTangensDeg,
+        ArcTangensRad,
+        ArcTangensGrad,
+        AreaCosHyp,
+        AreaSinHyp,
+        AreaTangensHyp,
+        Complement,
+        CosDeg,
+        CosRad,
+        CosGrad,
+        CosHyp,
+        Cube,
+        CubeRoot,
+        Exp,
+        Exp10,
+        Factorial,
+        Gamma,
+        InvertSign,
+        Ln,
+        Log10,
+        ParenOpen,
+        Reciprocal,
+        SinDeg,
+        SinGrad,
+        SinRad,
+        SinHyp,
+        Square,
+        SquareRoot,
+        StatClearAll,
+        StatCount,
+        StatDataNew,
+        StatDataDel,
+        StatMean,
+        StatMedian,
+        StatStdDeviation,
+        StatStdSample,
+        StatSum,
+        StatSumSquares,
+        TangensDeg,
+        TangensRad,
+        TangensGrad,
+        TangensHyp,
+        FunctionCount
+    };
+
+    // Records the keys pressed. Digits, the point and the exponent type
+    // a number, which is replayed as it is; a step without one works on
+    // the value the replay passes along, whatever it is. A number typed
+    // last is recorded when the recorder goes away.
+    class Recorder
+    {
+    public:
+        explicit Recorder(KCalcMacro &macro, NumBase base = NB_DECIMAL);
+        ~Recorder();
+
+        void setBase(NumBase base);
+
+        void digit(int digit);
+        void point();
+        void exponent();
+        void backspace();
+
+        void enterOperation(CalcEngine::Operation operation);
+        void apply(Function function);
+        void parenClose();
+
+    private:
+        void typed();
+
+        KCalcMacro &macro_;
+        NumBase base_;
+        QString keys_;
+    };
+
+    bool isEmpty() const;
+    int size() const;
+    void clear();
+
+    // from the current state of core, returns the value left displayed
+    KNumber run(CalcEngine &core, const KNumber &input) const;
+
+    // every input on a reset engine, the results in the same order and
+    // fewer only if canceled
+    QVector<KNumber> run(const QVector<KNumber> &inputs, const CalcEngine::Settings &settings = CalcEngine::Settings(),
+                         const QAtomicInt *canceled = nullptr) const;
+
+private:
+    enum Kind : quint8 {
+        NUMBER,
+        OPERATION,
+        FUNCTION,
+        PAREN_CLOSE
+    };
+
+    struct Step {
+        Kind kind;
+        quint8 id;
+    };
+
+    QVector<Step> steps_;
+    QVector<KNumber> numbers_;
+};
+
+#endif
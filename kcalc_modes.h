@@ -0,0 +1,20 @@
+#ifndef KCALC_MODES_H
+#define KCALC_MODES_H value
+
+// Modes shared by the engine and the user interface, kept apart so
+// the engine does not depend on any widget header.
+
+enum NumBase {
+    NB_BINARY = 2,
+    NB_OCTAL = 8,
+    NB_DECIMAL = 10,
+    NB_HEX = 16
+};
+
+enum AngleMode {
+    A_DEG,
+    A_RAD,
+    A_GRAD
+};
+
+#endif
@@ -0,0 +1,181 @@
+#include "kcalc_operators.h"
+
+namespace {
+
+void evaluateOr(KNumber &lhs, const KNumber &rhs)
+{
+    lhs |= rhs;
+}
+
+void evaluateXor(KNumber &lhs, const KNumber &rhs)
+{
+    lhs ^= rhs;
+}
+
+void evaluateAnd(KNumber &lhs, const KNumber &rhs)
+{
+    lhs &= rhs;
+}
+
+void evaluateLsh(KNumber &lhs, const KNumber &rhs)
+{
+    lhs <<= rhs;
+}
+
+void evaluateRsh(KNumber &lhs, const KNumber &rhs)
+{
+    lhs >>= rhs;
+}
+
+void evaluateAdd(KNumber &lhs, const KNumber &rhs)
+{
+    lhs += rhs;
+}
+
+void evaluateSubtract(KNumber &lhs, const KNumber &rhs)
+{
+    lhs -= rhs;
+}
+
+void evaluateMultiply(KNumber &lhs, const KNumber &rhs)
+{
+    lhs *= rhs;
+}
+
+void evaluateDivide(KNumber &lhs, const KNumber &rhs)
+{
+    lhs /= rhs;
+}
+
+void evaluateMod(KNumber &lhs, const KNumber &rhs)
+{
+    lhs %= rhs;
+}
+
+void evaluateIntDiv(KNumber &lhs, const KNumber &rhs)
+{
+    lhs = (lhs / rhs).integerPart();
+}
+
+void evaluateBinom(KNumber &lhs, const KNumber &rhs)
+{
+    lhs = lhs.bin(rhs);
+}
+
+void evaluatePower(KNumber &lhs, const KNumber &rhs)
+{
+    lhs = lhs.pow(rhs);
+}
+
+void evaluatePwrRoot(KNumber &lhs, const KNumber &rhs)
+{
+    lhs = lhs.pow(KNumber::One / rhs);
+}
+
+void percentAdd(KNumber &lhs, const KNumber &rhs)
+{
+    lhs *= KNumber::One + rhs / KNumber(100);
+}
+
+void percentSubtract(KNumber &lhs, const KNumber &rhs)
+{
+    lhs *= KNumber::One - rhs / KNumber(100);
+}
+
+void percentMultiply(KNumber &lhs, const KNumber &rhs)
+{
+    lhs = lhs * rhs / KNumber(100);
+}
+
+void percentDivide(KNumber &lhs, const KNumber &rhs)
+{
+    lhs = lhs * KNumber(100) / rhs;
+}
+
+using KCalcOperators::Operator;
+
+// indexed by KCalcOperators::Id
+constexpr Operator operators[] = {
+    { KCalcOperators::OR,       "|",     1, true,  evaluateOr,       nullptr },
+    { KCalcOperators::XOR,      "xor",   2, true,  evaluateXor,      nullptr },
+    { KCalcOperators::AND,      "&",     3, true,  evaluateAnd,      nullptr },
+    { KCalcOperators::LSH,      "<<",    4, true,  evaluateLsh,      nullptr },
+    { KCalcOperators::RSH,      ">>",    4, true,  evaluateRsh,      nullptr },
+    { KCalcOperators::ADD,      "+",     5, true,  evaluateAdd,      percentAdd },
+    { KCalcOperators::SUBTRACT, "-",     5, true,  evaluateSubtract, percentSubtract },
+    { KCalcOperators::MULTIPLY, "*",     6, true,  evaluateMultiply, percentMultiply },
+    { KCalcOperators::DIVIDE,   "/",     6, true,  evaluateDivide,   percentDivide },
+    { KCalcOperators::MOD,      "mod",   6, true,  evaluateMod,      nullptr },
+    { KCalcOperators::INTDIV,   "div",   6, true,  evaluateIntDiv,   nullptr },
+    { KCalcOperators::BINOM,    "nCr",   7, true,  evaluateBinom,    nullptr },
+    { KCalcOperators::POWER,    "^",     7, false, evaluatePower,    nullptr },
+    { KCalcOperators::PWR_ROOT, "root",  7, true,  evaluatePwrRoot,  nullptr }
+};
+
+static_assert(sizeof(operators) / sizeof(operators[0]) == KCalcOperators::COUNT,
+              "every operator needs an entry");
+static_assert(operators[KCalcOperators::PWR_ROOT].id == KCalcOperators::PWR_ROOT,
+              "operators are indexed by id");
+
+}
+
+const KCalcOperators::Operator &KCalcOperators::get(Id id)
+{
+    Q_ASSERT(id >= 0 && id < COUNT);
+    return operators[id];
+}
+
+void KCalcOperators::apply(Id id, KNumber &lhs, const KNumber &rhs)
+{
+    switch (id) {
+    case OR:       evaluateOr(lhs, rhs); break;
+    case XOR:      evaluateXor(lhs, rhs); break;
+    case AND:      evaluateAnd(lhs, rhs); break;
+    case LSH:      evaluateLsh(lhs, rhs); break;
+    case RSH:      evaluateRsh(lhs, rhs); break;
+    case ADD:      evaluateAdd(lhs, rhs); break;
+    case SUBTRACT: evaluateSubtract(lhs, rhs); break;
+    case MULTIPLY: evaluateMultiply(lhs, rhs); break;
+    case DIVIDE:   evaluateDivide(lhs, rhs); break;
+    case MOD:      evaluateMod(lhs, rhs); break;
+    case INTDIV:   evaluateIntDiv(lhs, rhs); break;
+    case BINOM:    evaluateBinom(lhs, rhs); break;
+    case POWER:    evaluatePower(lhs, rhs); break;
+    case PWR_ROOT: evaluatePwrRoot(lhs, rhs); break;
+    case COUNT:    Q_ASSERT(false); break;
+    }
+}
+
+void KCalcOperators::applyPercent(Id id, KNumber &lhs, const KNumber &rhs)
+{
+    switch (id) {
+    case ADD:      percentAdd(lhs, rhs); break;
+    case SUBTRACT: percentSubtract(lhs, rhs); break;
+    case MULTIPLY: percentMultiply(lhs, rhs); break;
+    case DIVIDE:   percentDivide(lhs, rhs); break;
+    default:       apply(id, lhs, rhs); break;
+    }
+}
+
+void KCalcOperators::negate(KNumber &operand)
+{
+    operand = -operand;
+}
+
+void KCalcOperators::powerMod(KNumber *operands, int count)
+{
+    Q_ASSERT(count == 3);
+    Q_UNUSED(count);
+
+    KNumber &base = operands[0];
+    const KNumber &exponent = operands[1];
+    const KNumber &modulus = operands[2];
+
+    if (base.type() == KNumber::TYPE_INTEGER && exponent.type() == KNumber::TYPE_INTEGER
+        && modulus.type() == KNumber::TYPE_INTEGER && exponent > KNumber::Zero) {
+        base = base.powmod(exponent, modulus);
+    } else {
+        evaluatePower(base, exponent);
+        evaluateMod(base, modulus);
+    }
+}
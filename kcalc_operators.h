@@ -0,0 +1,59 @@
+#ifndef KCALC_OPERATORS_H
+#define KCALC_OPERATORS_H value
+
+#include "knumber/knumber.h"
+
+// The binary operators of the key pad, shared by CalcEngine and the
+// parser so both agree on precedence and results.
+//
+// Precedences follow the key pad: 1 binds loosest (OR), 7 tightest
+// (POWER). The key pad evaluates everything left to right, typed
+// expressions honour the associativity.
+namespace KCalcOperators
+{
+enum Id {
+    OR,
+    XOR,
+    AND,
+    LSH,
+    RSH,
+    ADD,
+    SUBTRACT,
+    MULTIPLY,
+    DIVIDE,
+    MOD,
+    INTDIV,
+    BINOM,
+    POWER,
+    PWR_ROOT,
+    COUNT
+};
+
+// works in place like the evaluators of the parser
+using Evaluate = void (*)(KNumber &lhs, const KNumber &rhs);
+
+struct Operator {
+    Id id;
+    const char *symbol;       // as typed in expressions
+    int precedence;
+    bool leftassociative;
+    Evaluate evaluate;
+    Evaluate percent;         // with the percent key, or nullptr
+};
+
+const Operator &get(Id id);
+
+// dispatches on the id without going through the table
+void apply(Id id, KNumber &lhs, const KNumber &rhs);
+void applyPercent(Id id, KNumber &lhs, const KNumber &rhs);
+
+// the sign change of the +/- key and of a leading minus
+void negate(KNumber &operand);
+
+// "(base ^ exponent) mod modulus" on operands in that order, with the
+// results of the two operators. Integers with a positive exponent never
+// form the power, which makes it feasible at key sizes.
+void powerMod(KNumber *operands, int count);
+}
+
+#endif
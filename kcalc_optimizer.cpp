@@ -0,0 +1,430 @@
+#include "kcalc_optimizer.h"
+#include "kcalc_operators.h"
+
+#include <QStack>
+#include <QStringList>
+
+KCalcOptimizer::KCalcOptimizer(const KCalcParser &parser)
+    : parser_(parser)
+    , functions_(parser.functions())
+{
+    // The rewrite rules only apply to the operators registered under
+    // these names, whatever their implementation is.
+    if (const auto *infix = parser.infixParser(QStringLiteral("+"))) {
+        add_ = infix->eval;
+    }
+    if (const auto *infix = parser.infixParser(QStringLiteral("-"))) {
+        subtract_ = infix->eval;
+    }
+    if (const auto *infix = parser.infixParser(QStringLiteral("*"))) {
+        multiply_ = infix->eval;
+    }
+    if (const auto *infix = parser.infixParser(QStringLiteral("/"))) {
+        divide_ = infix->eval;
+    }
+    if (const auto *infix = parser.infixParser(QStringLiteral("^"))) {
+        power_ = infix->eval;
+    }
+    // fused only if both are the key pad operators
+    const auto *power = parser.infixParser(QStringLiteral("^"));
+    const auto *mod = parser.infixParser(QStringLiteral("mod"));
+    if (power && mod && power->eval == KCalcOperators::get(KCalcOperators::POWER).evaluate
+        && mod->eval == KCalcOperators::get(KCalcOperators::MOD).evaluate) {
+        mod_ = mod->eval;
+    }
+    if (const auto *prefix = parser.prefixParser(QStringLiteral("-"))) {
+        negate_ = prefix->eval;
+    }
+}
+
+KCalcParser::Program KCalcOptimizer::optimize(const KCalcParser::Program &program)
+{
+    Bodies optimized;
+    return optimize(program, optimized);
+}
+
+KCalcParser::Program KCalcOptimizer::optimize(const KCalcParser::Program &program, Bodies &optimized)
+{
+    // A body shares the bodies compiled before it with the program, each
+    // is rewritten once. They go first, rewriting one resets the DAG.
+    QVector<QSharedPointer<const KCalcParser::Program>> bodies;
+    bodies.reserve(program.bodies.size());
+    for (const auto &body : program.bodies) {
+        auto it = optimized.constFind(body.data());
+        if (it == optimized.constEnd()) {
+            const QSharedPointer<const KCalcParser::Program> rewritten(new KCalcParser::Program(optimize(*body, optimized)));
+            it = optimized.insert(body.data(), rewritten);
+        }
+        bodies.push_back(it.value());
+    }
+
+    KCalcParser::Program result = rewrite(program);
+    result.bodies = bodies;
+    return result;
+}
+
+KCalcParser::Program KCalcOptimizer::rewrite(const KCalcParser::Program &program)
+{
+    nodes_.clear();
+    constants_.clear();
+    ids_.clear();
+    constantIds_.clear();
+
+    QVector<int> stack;
+    QVector<int> locals(program.locals, -1);
+
+    for (const auto &instruction : program.code) {
+        switch (instruction.opcode) {
+        case KCalcParser::PUSH_NUMBER:
+            stack.push_back(constant(program.constants.at(instruction.index)));
+            break;
+        case KCalcParser::PUSH_ARGUMENT:
+            stack.push_back(intern(Node { KCalcParser::PUSH_ARGUMENT, instruction.index, nullptr, nullptr, nullptr, QVector<int>() }));
+            break;
+        case KCalcParser::UNARY:
+            if (stack.isEmpty()) {
+                return program;
+            }
+            stack.last() = simplifyUnary(instruction.unary, stack.last());
+            break;
+        case KCalcParser::BINARY: {
+            if (stack.size() < 2) {
+                return program;
+            }
+            const int rhs = stack.takeLast();
+            stack.last() = simplifyBinary(instruction.binary, stack.last(), rhs);
+            break;
+        }
+        case KCalcParser::NARY:
+        case KCalcParser::CALL: {
+            if (stack.size() < instruction.operands) {
+                return program;
+            }
+            const QVector<int> children = stack.mid(stack.size() - instruction.operands);
+            stack.resize(stack.size() - instruction.operands);
+            stack.push_back(instruction.opcode == KCalcParser::NARY
+                            ? simplifyNary(instruction.nary, children)
+                            : simplifyCall(instruction.index, children));
+            break;
+        }
+        case KCalcParser::STORE_LOCAL:
+            locals[instruction.index] = stack.last();
+            break;
+        case KCalcParser::LOAD_LOCAL:
+            stack.push_back(locals.at(instruction.index));
+            break;
+        case KCalcParser::SUM:
+        case KCalcParser::PRODUCT:
+        case KCalcParser::SOLVE:
+        case KCalcParser::INTEGRATE: {
+            // the body is rewritten on its own, here only the operands are
+            if (stack.size() < instruction.operands) {
+                return program;
+            }
+            const QVector<int> children = stack.mid(stack.size() - instruction.operands);
+            stack.resize(stack.size() - instruction.operands);
+            stack.push_back(intern(Node { instruction.opcode, instruction.index, nullptr, nullptr, nullptr, children }));
+            break;
+        }
+        }
+    }
+
+    if (stack.isEmpty()) {
+        return program;
+    }
+
+    return emitProgram(stack.last(), program.arguments);
+}
+
+int KCalcOptimizer::intern(const Node &node)
+{
+    const auto it = ids_.constFind(node);
+    if (it != ids_.constEnd()) {
+        return it.value();
+    }
+
+    nodes_.push_back(node);
+    ids_.insert(node, nodes_.size() - 1);
+    return nodes_.size() - 1;
+}
+
+int KCalcOptimizer::constant(const KNumber &value)
+{
+    // the string is only a hash key, equality is decided by KNumber
+    const QString key = value.toQString();
+
+    for (auto it = constantIds_.constFind(key); it != constantIds_.constEnd() && it.key() == key; ++it) {
+        const KNumber &existing = this->value(it.value());
+        if (existing.type() == value.type() && (value.type() == KNumber::TYPE_ERROR || existing == value)) {
+            return it.value();
+        }
+    }
+
+    constants_.push_back(value);
+    const int id = intern(Node { KCalcParser::PUSH_NUMBER, constants_.size() - 1, nullptr, nullptr, nullptr, QVector<int>() });
+    constantIds_.insert(key, id);
+    return id;
+}
+
+bool KCalcOptimizer::isConstant(int id) const
+{
+    return nodes_.at(id).opcode == KCalcParser::PUSH_NUMBER;
+}
+
+bool KCalcOptimizer::isConstant(int id, const KNumber &value) const
+{
+    return isConstant(id) && this->value(id).type() != KNumber::TYPE_ERROR && this->value(id) == value;
+}
+
+const KNumber &KCalcOptimizer::value(int id) const
+{
+    return constants_.at(nodes_.at(id).index);
+}
+
+int KCalcOptimizer::simplifyUnary(KCalcParser::UnaryEvaluateFunc unary, int child)
+{
+    if (isConstant(child)) {
+        KNumber result = value(child);
+        unary(result);
+        return constant(result);
+    }
+
+    // -(-x) => x
+    const Node &inner = nodes_.at(child);
+    if (negate_ && unary == negate_ && inner.opcode == KCalcParser::UNARY && inner.unary == negate_) {
+        return inner.children.front();
+    }
+
+    return intern(Node { KCalcParser::UNARY, 0, unary, nullptr, nullptr, QVector<int> { child } });
+}
+
+int KCalcOptimizer::simplifyBinary(KCalcParser::BinaryEvaluateFunc binary, int lhs, int rhs)
+{
+    if (isConstant(lhs) && isConstant(rhs)) {
+        KNumber result = value(lhs);
+        binary(result, value(rhs));
+        // a power too large to form is left to a following mod
+        if (!(binary == power_ && mod_ && result.type() == KNumber::TYPE_ERROR)) {
+            return constant(result);
+        }
+    }
+
+    if (binary == add_) {
+        if (isConstant(rhs, KNumber::Zero)) {
+            return lhs;
+        }
+        if (isConstant(lhs, KNumber::Zero)) {
+            return rhs;
+        }
+    } else if (binary == subtract_) {
+        if (isConstant(rhs, KNumber::Zero)) {
+            return lhs;
+        }
+    } else if (binary == multiply_) {
+        if (isConstant(rhs, KNumber::One)) {
+            return lhs;
+        }
+        if (isConstant(lhs, KNumber::One)) {
+            return rhs;
+        }
+    } else if (binary == divide_) {
+        if (isConstant(rhs, KNumber::One)) {
+            return lhs;
+        }
+        // x / c => x * (1 / c), only for floats where the division
+        // is inexact anyway; integers and fractions stay exact
+        if (multiply_ && isConstant(rhs) && value(rhs).type() == KNumber::TYPE_FLOAT && value(rhs) != KNumber::Zero) {
+            return simplifyBinary(multiply_, lhs, constant(KNumber::One / value(rhs)));
+        }
+    } else if (binary == power_) {
+        if (isConstant(rhs, KNumber::One)) {
+            return lhs;
+        }
+        // x^2 => x * x, both operands are the same node
+        if (multiply_ && isConstant(rhs, KNumber(2))) {
+            return simplifyBinary(multiply_, lhs, lhs);
+        }
+    } else if (mod_ && binary == mod_) {
+        // (x ^ y) mod m => powmod, the power is never formed
+        const Node &inner = nodes_.at(lhs);
+        if (inner.opcode == KCalcParser::BINARY && inner.binary == power_) {
+            return simplifyNary(KCalcOperators::powerMod, QVector<int> { inner.children.at(0), inner.children.at(1), rhs });
+        }
+    }
+
+    return intern(Node { KCalcParser::BINARY, 0, nullptr, binary, nullptr, QVector<int> { lhs, rhs } });
+}
+
+int KCalcOptimizer::simplifyNary(KCalcParser::NaryEvaluateFunc nary, const QVector<int> &children)
+{
+    bool folded = true;
+    for (const int child : children) {
+        folded = folded && isConstant(child);
+    }
+
+    if (folded) {
+        QVector<KNumber> operands;
+        for (const int child : children) {
+            operands.push_back(value(child));
+        }
+        nary(operands.data(), operands.size());
+        return constant(operands.front());
+    }
+
+    return intern(Node { KCalcParser::NARY, 0, nullptr, nullptr, nary, children });
+}
+
+int KCalcOptimizer::simplifyCall(int function, const QVector<int> &children)
+{
+    bool folded = true;
+    for (const int child : children) {
+        folded = folded && isConstant(child);
+    }
+
+    if (folded) {
+        QVector<KNumber> arguments;
+        for (const int child : children) {
+            arguments.push_back(value(child));
+        }
+        return constant(KCalcParser::run(functions_.at(function).body, functions_, arguments));
+    }
+
+    return intern(Node { KCalcParser::CALL, function, nullptr, nullptr, nullptr, children });
+}
+
+KCalcParser::Program KCalcOptimizer::emitProgram(int root, int arguments) const
+{
+    // count the references to every node reachable from the root
+    QVector<int> uses(nodes_.size(), 0);
+    QVector<int> pending { root };
+    uses[root] = 1;
+
+    while (!pending.isEmpty()) {
+        const int id = pending.takeLast();
+        for (const int child : nodes_.at(id).children) {
+            if (uses[child]++ == 0) {
+                pending.push_back(child);
+            }
+        }
+    }
+
+    KCalcParser::Program program;
+    program.arguments = arguments;
+
+    QVector<int> locals(nodes_.size(), -1);
+    QVector<int> constants(constants_.size(), -1);
+
+    struct Frame {
+        int id;
+        int next;
+    };
+
+    QStack<Frame> stack;
+    stack.push(Frame { root, 0 });
+
+    while (!stack.isEmpty()) {
+        const int id = stack.top().id;
+        const Node &node = nodes_.at(id);
+
+        if (locals.at(id) != -1) {
+            program.code.push_back(KCalcParser::Instruction { KCalcParser::LOAD_LOCAL, locals.at(id), 0, nullptr, nullptr, nullptr });
+            stack.pop();
+            continue;
+        }
+
+        if (stack.top().next < node.children.size()) {
+            const int child = node.children.at(stack.top().next++);
+            stack.push(Frame { child, 0 });
+            continue;
+        }
+
+        stack.pop();
+
+        switch (node.opcode) {
+        case KCalcParser::PUSH_NUMBER:
+            if (constants.at(node.index) == -1) {
+                constants[node.index] = program.constants.size();
+                program.constants.push_back(constants_.at(node.index));
+            }
+            program.code.push_back(KCalcParser::Instruction { KCalcParser::PUSH_NUMBER, constants.at(node.index), 0, nullptr, nullptr, nullptr });
+            continue;
+        case KCalcParser::PUSH_ARGUMENT:
+            program.code.push_back(KCalcParser::Instruction { KCalcParser::PUSH_ARGUMENT, node.index, 0, nullptr, nullptr, nullptr });
+            continue;
+        case KCalcParser::UNARY:
+        case KCalcParser::BINARY:
+        case KCalcParser::NARY:
+        case KCalcParser::CALL:
+        case KCalcParser::SUM:
+        case KCalcParser::PRODUCT:
+        case KCalcParser::SOLVE:
+        case KCalcParser::INTEGRATE:
+            program.code.push_back(KCalcParser::Instruction { node.opcode, node.index, node.children.size(),
+                                                              node.unary, node.binary, node.nary });
+            break;
+        default:
+            break;
+        }
+
+        // shared sub-expressions are evaluated once
+        if (uses.at(id) > 1) {
+            locals[id] = program.locals++;
+            program.code.push_back(KCalcParser::Instruction { KCalcParser::STORE_LOCAL, locals.at(id), 0, nullptr, nullptr, nullptr });
+        }
+    }
+
+    return program;
+}
+
+QString KCalcOptimizer::dump(const KCalcParser::Program &program) const
+{
+    const auto indented = [](const QStringList &lines) {
+        QStringList result;
+        for (const auto &line : lines) {
+            result.push_back(QStringLiteral("  ") + line);
+        }
+        return result;
+    };
+
+    QVector<QStringList> stack;
+
+    for (const auto &instruction : program.code) {
+        switch (instruction.opcode) {
+        case KCalcParser::PUSH_NUMBER:
+            stack.push_back(QStringList(program.constants.at(instruction.index).toQString()));
+            break;
+        case KCalcParser::PUSH_ARGUMENT:
+            stack.push_back(QStringList(QStringLiteral("$%1").arg(instruction.index)));
+            break;
+        case KCalcParser::UNARY:
+        case KCalcParser::BINARY:
+        case KCalcParser::NARY:
+        case KCalcParser::CALL:
+        case KCalcParser::SUM:
+        case KCalcParser::PRODUCT:
+        case KCalcParser::SOLVE:
+        case KCalcParser::INTEGRATE: {
+            const int count = instruction.operands;
+            if (stack.size() < count) {
+                return QString();
+            }
+
+            QStringList lines(parser_.instructionName(instruction));
+            for (int i = stack.size() - count; i < stack.size(); ++i) {
+                lines += indented(stack.at(i));
+            }
+            stack.resize(stack.size() - count);
+            stack.push_back(lines);
+            break;
+        }
+        case KCalcParser::STORE_LOCAL:
+            stack.last()[0].prepend(QStringLiteral("[t%1] ").arg(instruction.index));
+            break;
+        case KCalcParser::LOAD_LOCAL:
+            stack.push_back(QStringList(QStringLiteral("t%1").arg(instruction.index)));
+            break;
+        }
+    }
+
+    return stack.isEmpty() ? QString() : stack.last().join(QLatin1Char('\n'));
+}
@@ -0,0 +1,92 @@
+#ifndef KCALC_OPTIMIZER_H
+#define KCALC_OPTIMIZER_H value
+
+#include "kcalc_parser.h"
+#include <QHash>
+#include <QMultiHash>
+#include <QVector>
+
+// Rewrites a compiled KCalcParser::Program. The postfix code is lifted
+// into an expression DAG in which identical sub-expressions share one
+// node, constant sub-trees are folded and simple algebraic identities are
+// removed; a power taken mod something becomes one modular power. The
+// DAG is then emitted again, shared sub-expressions are computed once
+// and kept in a local slot.
+//
+// The bodies of sum, prod, solve and integrate are rewritten as well,
+// they run many times.
+//
+// The operators and user functions are taken from the parser when the
+// optimizer is constructed, so optimize() may run on another thread
+// while the parser goes on compiling.
+class KCalcOptimizer
+{
+public:
+    explicit KCalcOptimizer(const KCalcParser &parser);
+
+    KCalcParser::Program optimize(const KCalcParser::Program &program);
+    QString dump(const KCalcParser::Program &program) const;
+
+private:
+    // the rewritten bodies by the ones they were rewritten from
+    using Bodies = QHash<const KCalcParser::Program *, QSharedPointer<const KCalcParser::Program>>;
+
+    struct Node {
+        KCalcParser::OpCode opcode;
+        int index;
+        KCalcParser::UnaryEvaluateFunc unary;
+        KCalcParser::BinaryEvaluateFunc binary;
+        KCalcParser::NaryEvaluateFunc nary;
+        QVector<int> children;
+
+        friend bool operator==(const Node &lhs, const Node &rhs)
+        {
+            return lhs.opcode == rhs.opcode && lhs.index == rhs.index
+                   && lhs.unary == rhs.unary && lhs.binary == rhs.binary
+                   && lhs.nary == rhs.nary && lhs.children == rhs.children;
+        }
+
+        friend uint qHash(const Node &node, uint seed = 0)
+        {
+            return qHash(node.children, seed)
+                   ^ qHash(reinterpret_cast<quintptr>(node.unary))
+                   ^ qHash(reinterpret_cast<quintptr>(node.binary))
+                   ^ qHash(reinterpret_cast<quintptr>(node.nary))
+                   ^ qHash((node.index << 4) | node.opcode);
+        }
+    };
+
+    KCalcParser::Program optimize(const KCalcParser::Program &program, Bodies &optimized);
+    KCalcParser::Program rewrite(const KCalcParser::Program &program);
+
+    int intern(const Node &node);
+    int constant(const KNumber &value);
+    bool isConstant(int id) const;
+    bool isConstant(int id, const KNumber &value) const;
+    const KNumber &value(int id) const;
+
+    int simplifyUnary(KCalcParser::UnaryEvaluateFunc unary, int child);
+    int simplifyBinary(KCalcParser::BinaryEvaluateFunc binary, int lhs, int rhs);
+    int simplifyNary(KCalcParser::NaryEvaluateFunc nary, const QVector<int> &children);
+    int simplifyCall(int function, const QVector<int> &children);
+
+    KCalcParser::Program emitProgram(int root, int arguments) const;
+
+    const KCalcParser &parser_;
+    const QVector<KCalcParser::Function> functions_;
+
+    KCalcParser::BinaryEvaluateFunc add_ = nullptr;
+    KCalcParser::BinaryEvaluateFunc subtract_ = nullptr;
+    KCalcParser::BinaryEvaluateFunc multiply_ = nullptr;
+    KCalcParser::BinaryEvaluateFunc divide_ = nullptr;
+    KCalcParser::BinaryEvaluateFunc power_ = nullptr;
+    KCalcParser::BinaryEvaluateFunc mod_ = nullptr;
+    KCalcParser::UnaryEvaluateFunc negate_ = nullptr;
+
+    QVector<Node> nodes_;
+    QVector<KNumber> constants_;
+    QHash<Node, int> ids_;
+    QMultiHash<QString, int> constantIds_;
+};
+
+#endif
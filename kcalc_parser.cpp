@@ -1,10 +1,16 @@
 #include "kcalc_parser.h"
+#include "kcalc_calculus.h"
+#include "kcalc_operators.h"
+#include "kcalc_optimizer.h"
+#include "kcalc_series.h"
+#include "kcalc_trig.h"
 
 #include <QLocale>
 #include <QChar>
 #include <QQueue>
+#include <QRegularExpression>
 
-#include <tuple>
+#include <utility>
 
 namespace {
 template<typename T>
@@ -18,6 +24,86 @@ constexpr bool isOneOf(T &&t, B &&b, R &&... r)
 {
     return t == b || isOneOf(t, r...);
 }
+
+// Bodies up to this many instructions are copied into the caller
+// instead of being executed through a CALL instruction.
+const int inlineLimit = 16;
+
+const QRegularExpression &functionHeadRegex()
+{
+    static const QRegularExpression regex(QStringLiteral(
+        "^\\s*([A-Za-z_]\\w*)\\s*\\(\\s*([A-Za-z_]\\w*(?:\\s*,\\s*[A-Za-z_]\\w*)*)?\\s*\\)\\s*(=)?"));
+    return regex;
+}
+
+// Constructs which bind a variable in one of their arguments, the body.
+// The variable itself is written as another argument.
+struct Binding {
+    KCalcParser::PrefixKind kind;
+    KCalcParser::OpCode opcode;
+    int arguments;  // as written, including variable and body
+    int variable;
+    int body;
+};
+
+const Binding bindings[] = {
+    { KCalcParser::SERIES_SUM,     KCalcParser::SUM,       4, 0, 3 },
+    { KCalcParser::SERIES_PRODUCT, KCalcParser::PRODUCT,   4, 0, 3 },
+    { KCalcParser::SOLVER,         KCalcParser::SOLVE,     3, 1, 0 },
+    { KCalcParser::INTEGRAL,       KCalcParser::INTEGRATE, 4, 1, 0 }
+};
+
+const Binding *findBinding(KCalcParser::PrefixKind kind)
+{
+    for (const auto &binding : bindings) {
+        if (binding.kind == kind) {
+            return &binding;
+        }
+    }
+    return nullptr;
+}
+
+const Binding *findBinding(KCalcParser::OpCode opcode)
+{
+    for (const auto &binding : bindings) {
+        if (binding.opcode == opcode) {
+            return &binding;
+        }
+    }
+    return nullptr;
+}
+
+// The name written as the given argument of the construct whose "(" is
+// at offset or after some whitespace, empty if it is not a plain name
+QString boundName(const QString &expression, int offset, int argument)
+{
+    static const QRegularExpression name(QStringLiteral("\\G\\s*([A-Za-z_]\\w*)\\s*,"));
+
+    while (offset < expression.size() && expression.at(offset).isSpace()) {
+        ++offset;
+    }
+    if (offset == expression.size() || expression.at(offset) != QLatin1Char('(')) {
+        return QString();
+    }
+    ++offset;
+
+    int depth = 0;
+    while (argument > 0 && offset < expression.size()) {
+        const QChar ch = expression.at(offset++);
+        if (ch == QLatin1Char('(')) {
+            ++depth;
+        } else if (ch == QLatin1Char(')')) {
+            if (--depth < 0) {
+                return QString();
+            }
+        } else if (ch == QLatin1Char(',') && depth == 0) {
+            --argument;
+        }
+    }
+
+    const auto match = name.match(expression, offset);
+    return match.hasMatch() ? match.captured(1) : QString();
+}
 }
 
 bool KCalcParser::isValidDigit(const QChar &ch, NumBase numberMode)
@@ -52,21 +138,37 @@ bool KCalcParser::isValidDigit(const QChar &ch, NumBase numberMode)
 
 QStringView KCalcParser::findOperator(QString::Iterator position) const
 {
-    // TODO FIXME cosh <=> cos
     const QStringView current(position, currentExpression.end() - position);
-    for (const auto &key : infixParsers.keys()) {
-        if (current.startsWith(key, Qt::CaseInsensitive)) {
-            return key;
+    QStringView found;
+
+    // Prefer the longest match so "cosh" is not split into "cos" and "h"
+    const auto match = [&current, &found](const QString &key) {
+        if (key.length() > found.length() && current.startsWith(key, Qt::CaseInsensitive)) {
+            found = key;
         }
+    };
+
+    for (auto it = infixParsers.constBegin(); it != infixParsers.constEnd(); ++it) {
+        match(it.key());
     }
 
-    for (const auto &key : prefixParsers.keys()) {
-        if (current.startsWith(key, Qt::CaseInsensitive)) {
-            return key;
-        }
+    for (auto it = prefixParsers.constBegin(); it != prefixParsers.constEnd(); ++it) {
+        match(it.key());
+    }
+
+    for (auto it = functionNames_.constBegin(); it != functionNames_.constEnd(); ++it) {
+        match(it.key());
+    }
+
+    for (const auto &argument : arguments_) {
+        match(argument);
+    }
+
+    for (const auto &variable : variables_) {
+        match(variable);
     }
 
-    return QStringView();
+    return found;
 }
 
 void KCalcParser::tokenize()
@@ -91,6 +193,17 @@ void KCalcParser::tokenize()
 
             position += foundFunction.length();
             tokens_.push_back(token);
+
+            // the bound variable is a name from here on, even where it is
+            // used before it is written
+            const auto *parser = prefixParser(token.value);
+            if (const Binding *binding = parser ? findBinding(parser->kind) : nullptr) {
+                const QString variable = boundName(currentExpression, position - start, binding->variable);
+                if (!variable.isEmpty() && !isReservedName(variable)) {
+                    variables_.push_back(variable);
+                    variableNames_[token.debugPos] = variable;
+                }
+            }
             continue;
         }
 
@@ -118,6 +231,39 @@ void KCalcParser::tokenize()
     }
 }
 
+QString KCalcParser::resultKey() const
+{
+    // Whitespace is gone after tokenizing, the settings which change
+    // how numbers are read or rounded come first
+    QString key = QStringLiteral("%1:%2:%3:%4%5%6:")
+                      .arg(numberBase_)
+                      .arg(angleMode_)
+                      .arg(KNumber::defaultFloatPrecision())
+                      .arg(int(KNumber::defaultFractionalInput()))
+                      .arg(int(KNumber::defaultFloatOutput()))
+                      .arg(int(KNumber::splitoffIntegerForFractionOutput()));
+
+    for (const auto &token : tokens_) {
+        if (token.type == INVALID) {
+            return QString();
+        }
+        key += token.value;
+        key += QLatin1Char(' ');
+    }
+    return key;
+}
+
+void KCalcParser::invalidToken(int position)
+{
+    ++invalidTokens_;
+    emit foundInvalidToken(position);
+}
+
+KCalcResultCache &KCalcParser::resultCache()
+{
+    return resultCache_;
+}
+
 void KCalcParser::setNumBase(NumBase numbase)
 {
     numberBase_ = numbase;
@@ -131,6 +277,11 @@ NumBase KCalcParser::getNumBase() const
 void KCalcParser::setAngleMode(AngleMode anglemode)
 {
     angleMode_ = anglemode;
+
+    // compiled programs keep the evaluators they were compiled with
+    for (auto it = angleFunctions_.constBegin(); it != angleFunctions_.constEnd(); ++it) {
+        prefixParsers[it.key()].eval = it->at(angleMode_);
+    }
 }
 
 AngleMode KCalcParser::getAngleMode() const
@@ -138,6 +289,16 @@ AngleMode KCalcParser::getAngleMode() const
     return angleMode_;
 }
 
+void KCalcParser::setOptimize(bool optimize)
+{
+    optimize_ = optimize;
+}
+
+bool KCalcParser::getOptimize() const
+{
+    return optimize_;
+}
+
 const KCalcParser::Token &KCalcParser::peak() const
 {
     return tokens_.front();
@@ -153,134 +314,743 @@ KCalcParser::Token KCalcParser::consume()
 void KCalcParser::expect(TokenType token)
 {
     if (tokens_.size() == 0) {
-        emit foundInvalidToken(currentExpression.length());
+        invalidToken(currentExpression.length());
         return;
     }
 
     auto next = consume();
     if (next.type != token) {
-        emit foundInvalidToken(next.debugPos);
+        invalidToken(next.debugPos);
     }
 }
 void KCalcParser::expect(TokenType type, const QString &value)
 {
     if (tokens_.size() == 0) {
-        emit foundInvalidToken(currentExpression.length());
+        invalidToken(currentExpression.length());
         return;
     }
 
     auto next = consume();
     if (next.type != type || next.value != value) {
-        emit foundInvalidToken(next.debugPos);
+        invalidToken(next.debugPos);
     }
 }
 
 KNumber KCalcParser::parseExpression(const QString &expression)
+{
+    if (defineFunction(expression)) {
+        return KNumber::Zero;
+    }
+
+    // Tokenizing is linear and cheap, the tokens are reused on a miss.
+    // Expressions with errors are never cached so every call reports
+    // them.
+    prepare(expression, 0, QStringList());
+    const QString key = resultKey();
+
+    KNumber result;
+    if (!key.isEmpty() && resultCache_.find(key, result)) {
+        tokens_.clear();
+        return result;
+    }
+
+    const int errors = invalidTokens_;
+    result = evaluate(finish());
+    if (!key.isEmpty() && invalidTokens_ == errors) {
+        resultCache_.insert(key, result);
+    }
+    return result;
+}
+
+KCalcParser::Program KCalcParser::compile(const QString &expression, const QStringList &arguments)
+{
+    return compile(expression, 0, arguments);
+}
+
+KCalcParser::Program KCalcParser::compile(const QString &expression, QString &key)
+{
+    prepare(expression, 0, QStringList());
+    key = resultKey();
+
+    const int errors = invalidTokens_;
+    const Program program = finish();
+    if (invalidTokens_ != errors) {
+        key.clear();
+    }
+    return program;
+}
+
+KCalcParser::Program KCalcParser::compile(const QString &expression, int offset, const QStringList &arguments)
+{
+    prepare(expression, offset, arguments);
+    return finish();
+}
+
+void KCalcParser::prepare(const QString &expression, int offset, const QStringList &arguments)
 {
     currentExpression = expression;
-    position = currentExpression.begin();
+    position = currentExpression.begin() + offset;
     tokens_.clear();
-    operands_.clear();
+    arguments_ = arguments;
+    variables_.clear();
+    variableNames_.clear();
+    boundVariables_.clear();
+    program_ = Program();
+    program_.arguments = arguments.size();
+    depth_ = 0;
     tokenize();
+}
+
+KCalcParser::Program KCalcParser::finish()
+{
     parse();
 
     for (const auto &remainder : tokens_) {
-        foundInvalidToken(remainder.debugPos);
+        invalidToken(remainder.debugPos);
+    }
+
+    arguments_.clear();
+    variables_.clear();
+    variableNames_.clear();
+    boundVariables_.clear();
+
+    Program program = program_;
+    program_ = Program();
+
+    if (optimize_) {
+        program = KCalcOptimizer(*this).optimize(program);
+    }
+
+    return program;
+}
+
+KNumber KCalcParser::evaluate(const Program &program, const QVector<KNumber> &arguments) const
+{
+    return run(program, functions_, arguments);
+}
+
+KNumber KCalcParser::run(const Program &program, const QVector<Function> &functions,
+                         const QVector<KNumber> &arguments, const QAtomicInt *canceled)
+{
+    QVector<KNumber> operands;
+    QVector<KNumber> locals(program.locals);
+
+    // The stack never holds more values than there are instructions.
+    // Operators replace their first operand in place, so no operation
+    // allocates a container.
+    operands.reserve(program.code.size());
+
+    for (const auto &instruction : program.code) {
+        if (canceled && canceled->load()) {
+            return KNumber::NaN;
+        }
+
+        switch (instruction.opcode) {
+        case PUSH_NUMBER:
+            operands.push_back(program.constants.at(instruction.index));
+            break;
+        case PUSH_ARGUMENT:
+            operands.push_back(arguments.value(instruction.index));
+            break;
+        case UNARY:
+            instruction.unary(operands.last());
+            break;
+        case BINARY:
+            instruction.binary(operands[operands.size() - 2], operands.last());
+            operands.removeLast();
+            break;
+        case NARY: {
+            const int first = operands.size() - instruction.operands;
+            instruction.nary(operands.data() + first, instruction.operands);
+            operands.resize(first + 1);
+            break;
+        }
+        case CALL: {
+            const int first = operands.size() - instruction.operands;
+            QVector<KNumber> callArguments;
+            callArguments.reserve(instruction.operands);
+            for (int i = first; i < operands.size(); ++i) {
+                callArguments.push_back(std::move(operands[i]));
+            }
+            operands.resize(first);
+            operands.push_back(run(functions.at(instruction.index).body, functions, callArguments, canceled));
+            break;
+        }
+        case STORE_LOCAL:
+            locals[instruction.index] = operands.last();
+            break;
+        case LOAD_LOCAL:
+            operands.push_back(locals.at(instruction.index));
+            break;
+        case SUM:
+        case PRODUCT: {
+            const KNumber to = operands.takeLast();
+            operands.last() = KCalcSeries::evaluate(instruction.opcode == PRODUCT, *program.bodies.at(instruction.index),
+                                                    functions, arguments, operands.last(), to, canceled);
+            break;
+        }
+        case SOLVE:
+            operands.last() = KCalcCalculus::solve(*program.bodies.at(instruction.index),
+                                                   functions, arguments, operands.last(), canceled);
+            break;
+        case INTEGRATE: {
+            const KNumber to = operands.takeLast();
+            operands.last() = KCalcCalculus::integrate(*program.bodies.at(instruction.index),
+                                                       functions, arguments, operands.last(), to, canceled);
+            break;
+        }
+        }
     }
 
-    if (operands_.size() > 0) {
-        return operands_.top();
+    if (operands.size() > 0) {
+        return std::move(operands.last());
     }
 
     return KNumber::Zero;
 }
 
-void KCalcParser::parse(int p)
+void KCalcParser::emitInstruction(const Instruction &instruction)
 {
-    if (tokens_.size() == 0) {
-        return;
+    program_.code.push_back(instruction);
+
+    switch (instruction.opcode) {
+    case PUSH_NUMBER:
+    case PUSH_ARGUMENT:
+    case LOAD_LOCAL:
+        ++depth_;
+        break;
+    case STORE_LOCAL:
+        break;
+    case UNARY:
+    case BINARY:
+    case NARY:
+    case CALL:
+    case SUM:
+    case PRODUCT:
+    case SOLVE:
+    case INTEGRATE:
+        depth_ -= instruction.operands - 1;
+        break;
     }
+}
 
-    const auto start = consume();
+bool KCalcParser::isReservedName(const QString &name) const
+{
+    return infixParsers.contains(name) || prefixParsers.contains(name);
+}
 
-    if (start.type == OPERATOR) {
-        auto *parser = findPrefixParser(start.value);
+bool KCalcParser::parseHead(const QRegularExpressionMatch &match, QStringList &parameters) const
+{
+    const QString name = match.captured(1);
+    if (isReservedName(name)) {
+        return false;
+    }
 
-        if (!parser) {
-            emit foundInvalidToken(start.debugPos);
-            return;
+    for (const auto &parameter : match.captured(2).split(QLatin1Char(','), QString::SkipEmptyParts)) {
+        const QString trimmed = parameter.trimmed();
+        if (isReservedName(trimmed) || trimmed == name || parameters.contains(trimmed)) {
+            return false;
         }
+        parameters.push_back(trimmed);
+    }
 
-        parser->parse(*this, start, parser->precedence);
+    return true;
+}
 
-        if (operands_.size() < 1) {
-            // todo error
-            return;
-        }
+bool KCalcParser::isFunctionHead(const QString &text) const
+{
+    const auto match = functionHeadRegex().match(text);
+    if (!match.hasMatch() || match.capturedLength(3) != 0
+        || !text.mid(match.capturedEnd(0)).trimmed().isEmpty()) {
+        return false;
+    }
+
+    // "five()" calls a function without parameters once it is defined
+    QStringList parameters;
+    return parseHead(match, parameters) && (!parameters.isEmpty() || !hasFunction(match.captured(1)));
+}
+
+bool KCalcParser::defineFunction(const QString &definition)
+{
+    // most input is no definition, this spares the regex
+    if (!definition.contains(QLatin1Char('='))) {
+        return false;
+    }
 
-        operands_.push(parser->eval(operands_.pop()));
-    } else if (start.type == NUMBER) {
+    const auto match = functionHeadRegex().match(definition);
+    if (!match.hasMatch() || match.capturedLength(3) == 0) {
+        return false;
+    }
 
-        bool ok;
-        // The old kcalcdisplay did the conversion like this
-        // but KNumber *should* be able to do this directly
-        const auto number = start.value.toULongLong(&ok, getNumBase());
-        if (!ok) {
-            emit foundInvalidToken(start.debugPos);
+    const QString name = match.captured(1);
+    QStringList parameters;
+    if (!parseHead(match, parameters)) {
+        return false;
+    }
+
+    // The body is compiled once; calls only run (or inline) the program.
+    // Functions are bound early, so redefining a function does not
+    // change the meaning of functions defined on top of it.
+    const int errors = invalidTokens_;
+    Function function { name, parameters, compile(definition, match.capturedEnd(0), parameters) };
+    if (invalidTokens_ != errors) {
+        return false;
+    }
+
+    functionNames_[name] = functions_.size();
+    functions_.push_back(function);
+    resultCache_.invalidate();
+
+    emit functionDefined(name);
+    return true;
+}
+
+bool KCalcParser::hasFunction(const QString &name) const
+{
+    return functionNames_.contains(name);
+}
+
+void KCalcParser::clearFunctions()
+{
+    functionNames_.clear();
+    functions_.clear();
+    resultCache_.invalidate();
+}
+
+const KCalcParser::Function &KCalcParser::function(int index) const
+{
+    return functions_.at(index);
+}
+
+QVector<KCalcParser::Function> KCalcParser::functions() const
+{
+    return functions_;
+}
+
+QString KCalcParser::dump(const Program &program) const
+{
+    return KCalcOptimizer(*this).dump(program);
+}
+
+QString KCalcParser::instructionName(const Instruction &instruction) const
+{
+    switch (instruction.opcode) {
+    case UNARY:
+        for (auto it = prefixParsers.constBegin(); it != prefixParsers.constEnd(); ++it) {
+            if (it->eval == instruction.unary) {
+                return it.key();
+            }
+        }
+        for (auto it = infixParsers.constBegin(); it != infixParsers.constEnd(); ++it) {
+            if (it->postfix == instruction.unary) {
+                return it.key();
+            }
+        }
+        // compiled in another angle mode
+        for (auto it = angleFunctions_.constBegin(); it != angleFunctions_.constEnd(); ++it) {
+            if (it->contains(instruction.unary)) {
+                return it.key();
+            }
+        }
+        break;
+    case BINARY:
+        for (auto it = infixParsers.constBegin(); it != infixParsers.constEnd(); ++it) {
+            if (it->eval == instruction.binary) {
+                return it.key();
+            }
         }
-        operands_.push(KNumber(number));
-    } else if (start.type == INVALID) {
-        emit foundInvalidToken(start.debugPos);
-        parse(p);
+        break;
+    case NARY:
+        for (auto it = prefixParsers.constBegin(); it != prefixParsers.constEnd(); ++it) {
+            if (it->nary == instruction.nary) {
+                return it.key();
+            }
+        }
+        // fused by the optimizer
+        if (instruction.nary == KCalcOperators::powerMod) {
+            return QStringLiteral("^ mod");
+        }
+        break;
+    case CALL:
+        return functions_.at(instruction.index).name;
+    case SUM:
+    case PRODUCT:
+    case SOLVE:
+    case INTEGRATE:
+        for (auto it = prefixParsers.constBegin(); it != prefixParsers.constEnd(); ++it) {
+            if (it->kind == findBinding(instruction.opcode)->kind) {
+                return it.key();
+            }
+        }
+        break;
+    default:
+        break;
     }
 
-    while (tokens_.size() > 0) {
-        auto next = peak();
+    return QStringLiteral("?");
+}
 
-        if (next.value == QStringLiteral(")")) {
-            break;
+void KCalcParser::emitCall(long position, int function, int depth, const QVector<int> &starts)
+{
+    const Function &callee = functions_.at(function);
+    const int count = callee.parameters.size();
+
+    if (depth_ != depth + count) {
+        invalidToken(position);
+        return;
+    }
+
+    const Program &body = callee.body;
+
+    // bound bodies take the arguments of the callee
+    bool inlineable = body.code.size() <= inlineLimit && body.bodies.isEmpty();
+    if (inlineable) {
+        // Do not duplicate the evaluation of non trivial arguments
+        QVector<int> uses(count, 0);
+        for (const auto &instruction : body.code) {
+            if (instruction.opcode == PUSH_ARGUMENT) {
+                ++uses[instruction.index];
+            }
         }
 
-        if (next.type == INVALID) {
-            emit foundInvalidToken(consume().debugPos);
-            continue;
+        for (int i = 0; i < count; ++i) {
+            if (uses[i] > 1 && starts[i + 1] - starts[i] > 1) {
+                inlineable = false;
+            }
         }
+    }
+
+    if (!inlineable) {
+        emitInstruction(Instruction { CALL, function, count, nullptr, nullptr, nullptr });
+        return;
+    }
+
+    QVector<QVector<Instruction>> arguments;
+    for (int i = 0; i < count; ++i) {
+        arguments.push_back(program_.code.mid(starts[i], starts[i + 1] - starts[i]));
+    }
+    program_.code.resize(starts.front());
+    depth_ = depth;
+
+    const int constantOffset = program_.constants.size();
+    program_.constants += body.constants;
 
-        auto *infparser = findInfixParser(next.value);
+    const int localOffset = program_.locals;
+    program_.locals += body.locals;
 
-        if (!infparser) {
-            foundInvalidToken(consume().debugPos);
+    for (auto instruction : body.code) {
+        if (instruction.opcode == PUSH_ARGUMENT) {
+            for (const auto &argument : arguments.at(instruction.index)) {
+                program_.code.push_back(argument);
+            }
+            ++depth_;
             continue;
         }
 
-        if (infparser->precedence <= p) {
-            break;
+        if (instruction.opcode == PUSH_NUMBER) {
+            instruction.index += constantOffset;
+        } else if (instruction.opcode == STORE_LOCAL || instruction.opcode == LOAD_LOCAL) {
+            instruction.index += localOffset;
         }
+        emitInstruction(instruction);
+    }
+}
+
+void KCalcParser::emitBinding(long position, OpCode opcode, int depth, const QVector<int> &starts)
+{
+    const Binding *binding = findBinding(opcode);
+
+    // the variable is the one argument without code
+    if (depth_ != depth + binding->arguments - 1) {
+        invalidToken(position);
+        return;
+    }
+
+    // The body becomes a program of its own which shares the constants
+    // and bodies compiled so far, the other arguments stay in the code.
+    // Its variable went out of scope with it and follows the ones still
+    // bound. It is optimized along with the program.
+    const int first = starts.at(binding->body);
+    const int last = starts.at(binding->body + 1);
+
+    Program body;
+    body.code = program_.code.mid(first, last - first);
+    body.constants = program_.constants;
+    body.bodies = program_.bodies;
+    body.arguments = program_.arguments + boundVariables_.size() + 1;
+    body.locals = program_.locals;
+
+    program_.code.remove(first, last - first);
+    --depth_;
+
+    program_.bodies.push_back(QSharedPointer<const Program>(new Program(body)));
+    emitInstruction(Instruction { opcode, program_.bodies.size() - 1, binding->arguments - 2, nullptr, nullptr, nullptr });
+}
+
+void KCalcParser::emitNumber(const Token &token)
+{
+    bool ok;
+    KNumber number;
+    if (getNumBase() == NB_DECIMAL) {
+        // KNumber handles arbitrary size and the fractional part
+        number = KNumber(QString(token.value).replace(QLocale().decimalPoint(), KNumber::decimalSeparator()));
+        ok = number.type() != KNumber::TYPE_ERROR;
+    } else {
+        // The old kcalcdisplay did the conversion like this
+        number = KNumber(token.value.toULongLong(&ok, getNumBase()));
+    }
+    if (!ok) {
+        invalidToken(token.debugPos);
+    }
+    program_.constants.push_back(number);
+    emitInstruction(Instruction { PUSH_NUMBER, program_.constants.size() - 1, 0, nullptr, nullptr, nullptr });
+}
 
-        int opCount = infparser->parse(*this, consume(), infparser->precedence);
-        if (operands_.size() < opCount) {
-            // todo error
+void KCalcParser::parse()
+{
+    // A Pratt parser which keeps its state on an explicit stack instead
+    // of recursing, so the nesting depth is only limited by the heap.
+    // Every frame is a construct waiting for its operand; the operand
+    // ends before the first operator which does not bind tighter than
+    // the precedence of the frame.
+    struct Frame {
+        enum Kind {
+            Root,
+            Prefix,
+            Group,
+            Infix,
+            Argument
+        } kind;
+        int precedence;
+        long position;
+        int function;  // called user function, -1 for built-in functions
+        int operands;  // arguments of a call
+        UnaryEvaluateFunc unary;
+        BinaryEvaluateFunc binary;
+        NaryEvaluateFunc nary;
+        int depth;
+        QVector<int> starts;  // start of the code of every call argument
+        OpCode opcode;        // CALL, NARY or a binding of an Argument
+        QString variable;     // bound in the body of a binding
+    };
+
+    // Reads the variable of a binding when it is the next argument and
+    // brings it into scope before the body
+    const auto nextArgument = [this](Frame &frame) {
+        const Binding *binding = findBinding(frame.opcode);
+        if (!binding) {
             return;
         }
 
-        QList<KNumber> ops;
-        for (int i = 0; i < opCount; ++i) {
-            ops.push_front(operands_.pop());
+        if (frame.starts.size() - 1 == binding->variable) {
+            const Token variable = tokens_.isEmpty() ? Token { INVALID, QString(), currentExpression.length() } : consume();
+            if (variable.type != OPERATOR || variable.value != frame.variable) {
+                invalidToken(variable.debugPos);
+            }
+            frame.starts.push_back(program_.code.size());
+            expect(INVALID, QStringLiteral(","));
+        }
+
+        if (frame.starts.size() - 1 == binding->body) {
+            boundVariables_.push_back(frame.variable);
+        }
+    };
+
+    QVector<Frame> frames;
+    frames.push_back(Frame { Frame::Root, 0, 0, -1, 0, nullptr, nullptr, nullptr, 0, QVector<int>(), NARY, QString() });
+
+    bool expectOperand = true;
+
+    while (!frames.isEmpty()) {
+        bool complete = false;
+
+        if (expectOperand) {
+            if (tokens_.isEmpty()) {
+                complete = true;
+            } else {
+                const auto start = consume();
+
+                if (start.type == OPERATOR) {
+                    const int bound = boundVariables_.lastIndexOf(start.value);
+                    const int argument = arguments_.indexOf(start.value);
+                    const auto function = functionNames_.constFind(start.value);
+                    const auto *parser = findPrefixParser(start.value);
+
+                    if (bound != -1) {
+                        // bound variables follow the arguments, innermost last
+                        emitInstruction(Instruction { PUSH_ARGUMENT, program_.arguments + bound, 0, nullptr, nullptr, nullptr });
+                        expectOperand = false;
+                    } else if (argument != -1) {
+                        emitInstruction(Instruction { PUSH_ARGUMENT, argument, 0, nullptr, nullptr, nullptr });
+                        expectOperand = false;
+                    } else if (function != functionNames_.constEnd()) {
+                        expect(OPERATOR, QStringLiteral("("));
+
+                        const Frame call { Frame::Argument, 0, start.debugPos, function.value(),
+                                           functions_.at(function.value()).parameters.size(),
+                                           nullptr, nullptr, nullptr, depth_, QVector<int> { program_.code.size() },
+                                           CALL, QString() };
+                        if (call.operands == 0) {
+                            expect(INVALID, QStringLiteral(")"));
+                            emitCall(call.position, call.function, call.depth, call.starts);
+                            expectOperand = false;
+                        } else {
+                            frames.push_back(call);
+                        }
+                    } else if (parser && parser->nary) {
+                        expect(OPERATOR, QStringLiteral("("));
+                        frames.push_back(Frame { Frame::Argument, 0, start.debugPos, -1, parser->operands,
+                                                 nullptr, nullptr, parser->nary, depth_, QVector<int> { program_.code.size() },
+                                                 NARY, QString() });
+                    } else if (const Binding *binding = parser ? findBinding(parser->kind) : nullptr) {
+                        expect(OPERATOR, QStringLiteral("("));
+
+                        Frame frame { Frame::Argument, 0, start.debugPos, -1, binding->arguments,
+                                      nullptr, nullptr, nullptr, depth_, QVector<int> { program_.code.size() },
+                                      binding->opcode, variableNames_.value(start.debugPos) };
+                        nextArgument(frame);
+                        frames.push_back(frame);
+                    } else if (parser) {
+                        if (parser->kind == FUNCTION) {
+                            expect(OPERATOR, QStringLiteral("("));
+                        }
+
+                        frames.push_back(Frame { parser->kind == PREFIX_UNARY ? Frame::Prefix : Frame::Group,
+                                                 parser->kind == PREFIX_UNARY ? parser->precedence : 0,
+                                                 start.debugPos, -1, 0, parser->eval, nullptr, nullptr, 0, QVector<int>(),
+                                                 NARY, QString() });
+                    } else {
+                        invalidToken(start.debugPos);
+                        complete = true;
+                    }
+                } else if (start.type == NUMBER) {
+                    emitNumber(start);
+                    expectOperand = false;
+                } else {
+                    invalidToken(start.debugPos);
+                }
+            }
+        } else if (tokens_.isEmpty()) {
+            complete = true;
+        } else {
+            const auto &next = peak();
+
+            if (next.value == QStringLiteral(")") || next.value == QStringLiteral(",")) {
+                complete = true;
+            } else if (next.type == INVALID) {
+                invalidToken(consume().debugPos);
+            } else if (const auto *infparser = findInfixParser(next.value)) {
+                if (infparser->precedence <= frames.last().precedence) {
+                    complete = true;
+                } else {
+                    const auto token = consume();
+
+                    if (infparser->postfix) {
+                        // postfix operators apply to the operand on the stack
+                        if (depth_ < 1) {
+                            complete = true;
+                        } else {
+                            emitInstruction(Instruction { UNARY, 0, 1, infparser->postfix, nullptr, nullptr });
+                        }
+                    } else {
+                        // a right associative operator lets its own kind bind the right operand
+                        frames.push_back(Frame { Frame::Infix,
+                                                 infparser->precedence - (infparser->leftassociative ? 0 : 1),
+                                                 token.debugPos, -1, 0, nullptr, infparser->eval, nullptr, 0,
+                                                 QVector<int>(), NARY, QString() });
+                        expectOperand = true;
+                    }
+                }
+            } else {
+                invalidToken(consume().debugPos);
+            }
+        }
+
+        // A missing operand also completes the construct around it
+        while (complete && !frames.isEmpty()) {
+            Frame frame = frames.takeLast();
+            complete = false;
+            expectOperand = false;
+
+            switch (frame.kind) {
+            case Frame::Root:
+                break;
+            case Frame::Group:
+                expect(INVALID, QStringLiteral(")"));
+                // fall through
+            case Frame::Prefix:
+                if (depth_ < 1) {
+                    complete = true;
+                } else if (frame.unary) {
+                    emitInstruction(Instruction { UNARY, 0, 1, frame.unary, nullptr, nullptr });
+                }
+                break;
+            case Frame::Infix:
+                if (depth_ < 2) {
+                    complete = true;
+                } else {
+                    emitInstruction(Instruction { BINARY, 0, 2, nullptr, frame.binary, nullptr });
+                }
+                break;
+            case Frame::Argument:
+                frame.starts.push_back(program_.code.size());
+                if (findBinding(frame.opcode) && frame.starts.size() - 2 == findBinding(frame.opcode)->body) {
+                    boundVariables_.removeLast();
+                }
+
+                if (frame.starts.size() <= frame.operands) {
+                    expect(INVALID, QStringLiteral(","));
+                    nextArgument(frame);
+                    frames.push_back(frame);
+                    expectOperand = true;
+                    break;
+                }
+
+                expect(INVALID, QStringLiteral(")"));
+                if (frame.opcode == CALL) {
+                    emitCall(frame.position, frame.function, frame.depth, frame.starts);
+                } else if (findBinding(frame.opcode)) {
+                    emitBinding(frame.position, frame.opcode, frame.depth, frame.starts);
+                } else if (depth_ != frame.depth + frame.operands) {
+                    invalidToken(frame.position);
+                } else {
+                    emitInstruction(Instruction { NARY, 0, frame.operands, nullptr, nullptr, frame.nary });
+                }
+                break;
+            }
         }
-        operands_.push(infparser->eval(ops));
     }
 }
 
 void KCalcParser::registerInfixParser(const QString &name, int precedence,
-                                      ParseFunc parse, EvaluateFunc eval, bool leftassociative)
+                                      BinaryEvaluateFunc eval, bool leftassociative)
 {
-    infixParsers[name] = InfixParser { precedence, leftassociative, parse, eval };
+    infixParsers[name] = InfixParser { precedence, leftassociative, eval, nullptr };
+}
+
+void KCalcParser::registerPostfixParser(const QString &name, int precedence, UnaryEvaluateFunc eval)
+{
+    infixParsers[name] = InfixParser { precedence, true, nullptr, eval };
 }
 
 void KCalcParser::registerPrefixParser(const QString &name, int precedence,
-                                       PrefParseFunc parse, PrefEvaluateFunc eval)
+                                       PrefixKind kind, UnaryEvaluateFunc eval)
+{
+    prefixParsers[name] = PrefixParser { precedence, kind, eval, 0, nullptr };
+}
+
+void KCalcParser::registerFunction(const QString &name, int operands, NaryEvaluateFunc eval)
+{
+    Q_ASSERT(operands > 0);
+    prefixParsers[name] = PrefixParser { 50, FUNCTION, nullptr, operands, eval };
+}
+
+void KCalcParser::registerAngleFunction(const QString &name, UnaryEvaluateFunc deg,
+                                        UnaryEvaluateFunc rad, UnaryEvaluateFunc grad)
 {
-    prefixParsers[name] = PrefixParser { precedence, parse, eval };
+    // indexed by AngleMode
+    angleFunctions_[name] = QVector<UnaryEvaluateFunc> { deg, rad, grad };
+    registerPrefixParser(name, 50, FUNCTION, angleFunctions_[name].at(angleMode_));
 }
 
 KCalcParser::PrefixParser *KCalcParser::findPrefixParser(const QString &name)
@@ -295,66 +1065,57 @@ KCalcParser::InfixParser *KCalcParser::findInfixParser(const QString &name)
     return parser != infixParsers.end() ? &(*parser) : nullptr;
 }
 
-void KCalcParser::addDefaultParser()
+const KCalcParser::PrefixParser *KCalcParser::prefixParser(const QString &name) const
 {
-    registerInfixParser(QStringLiteral("+"), 10, [](KCalcParser &parser, const KCalcParser::Token &, int precedence) {
-        parser.parse(precedence);
-        return 2; }, [](const QList<KNumber> &operands) { return operands[0] + operands[1]; });
-
-    registerInfixParser(QStringLiteral("-"), 10, [](KCalcParser &parser, const KCalcParser::Token &, int precedence) {
-        parser.parse(precedence);
-        return 2; }, [](const QList<KNumber> &operands) { return operands[0] - operands[1]; });
-
-    registerInfixParser(QStringLiteral("*"), 20, [](KCalcParser &parser, const KCalcParser::Token &, int precedence) {
-        parser.parse(precedence);
-        return 2; }, [](const QList<KNumber> &operands) { return operands[0] * operands[1]; });
-
-    registerInfixParser(QStringLiteral("/"), 20, [](KCalcParser &parser, const KCalcParser::Token &, int precedence) {
-        parser.parse(precedence); return 2; }, [](const QList<KNumber> &operands) { return operands[0] / operands[1]; });
-
-    registerInfixParser(QStringLiteral("^"), 25, [](KCalcParser &parser, const KCalcParser::Token &, int precedence) {
-        parser.parse(precedence); return 2; }, [](const QList<KNumber> &operands) { return operands[0].pow(operands[1]); },
-                        false);
-
-    registerPrefixParser(QStringLiteral("-"), 30, [](KCalcParser &parser, const KCalcParser::Token &, int precedence) { parser.parse(precedence); }, [](KNumber operand) { return -operand; });
-
-    registerPrefixParser(QStringLiteral("("), 0, [](KCalcParser &parser, const KCalcParser::Token &, int) {
-        parser.parse();
-        parser.expect(KCalcParser::INVALID, QStringLiteral(")")); }, [](KNumber operand) { return operand; });
-
-    registerPrefixParser(QStringLiteral("sin"), 50, [](KCalcParser &parser, const KCalcParser::Token &, int) {
-        parser.expect(KCalcParser::OPERATOR, QStringLiteral("("));
-        parser.parse();
-        parser.expect(KCalcParser::INVALID, QStringLiteral(")")); }, [](KNumber operand) { return operand.sin(); });
-
-    registerPrefixParser(QStringLiteral("cos"), 50, [](KCalcParser &parser, const KCalcParser::Token &, int) {
-        parser.expect(KCalcParser::OPERATOR, QStringLiteral("("));
-        parser.parse();
-        parser.expect(KCalcParser::INVALID, QStringLiteral(")")); }, [](KNumber operand) { return operand.cos(); });
-
-    registerPrefixParser(QStringLiteral("func"), 50, [](KCalcParser &parser, const KCalcParser::Token &, int) {
-        parser.expect(KCalcParser::OPERATOR, QStringLiteral("("));
-        parser.parse();
-        parser.expect(KCalcParser::INVALID, QStringLiteral(")")); }, [](KNumber operand) { return operand + KNumber(10); });
-
-    registerPrefixParser(QStringLiteral("tan"), 50, [](KCalcParser &parser, const KCalcParser::Token &, int) {
-        parser.expect(KCalcParser::OPERATOR, QStringLiteral("("));
-        parser.parse();
-        parser.expect(KCalcParser::INVALID, QStringLiteral(")")); }, [](KNumber operand) { return operand.tan(); });
-
-    registerPrefixParser(QStringLiteral("log"), 50, [](KCalcParser &parser, const KCalcParser::Token &, int) {
-        parser.expect(KCalcParser::OPERATOR, QStringLiteral("("));
-        parser.parse();
-        parser.expect(KCalcParser::INVALID, QStringLiteral(")")); }, [](KNumber operand) { return operand.log10(); });
-
-    registerPrefixParser(QStringLiteral("ln"), 50, [](KCalcParser &parser, const KCalcParser::Token &, int) {
-        parser.expect(KCalcParser::OPERATOR, QStringLiteral("("));
-        parser.parse();
-        parser.expect(KCalcParser::INVALID, QStringLiteral(")")); }, [](KNumber operand) { return operand.ln(); });
+    const auto parser = prefixParsers.constFind(name);
+    return parser != prefixParsers.constEnd() ? &(*parser) : nullptr;
+}
 
-    registerInfixParser(QStringLiteral("!"), 50, [](KCalcParser &, const KCalcParser::Token &, int) { return 1; }, [](const QList<KNumber> &operand) { return operand[0].factorial(); });
+const KCalcParser::InfixParser *KCalcParser::infixParser(const QString &name) const
+{
+    const auto parser = infixParsers.constFind(name);
+    return parser != infixParsers.constEnd() ? &(*parser) : nullptr;
+}
 
-    registerInfixParser(QStringLiteral("mod"), 5, [](KCalcParser &parser, const KCalcParser::Token &, int precedence) { 
-            parser.parse(precedence);
-            return 2; }, [](const QList<KNumber> &operand) { return operand[0] % operand[1]; });
+void KCalcParser::addDefaultParser()
+{
+    // the key pad operators, one precedence step of CalcEngine is ten here
+    for (int id = 0; id < KCalcOperators::COUNT; ++id) {
+        const KCalcOperators::Operator &op = KCalcOperators::get(KCalcOperators::Id(id));
+        registerInfixParser(QLatin1String(op.symbol), op.precedence * 10, op.evaluate, op.leftassociative);
+    }
+    registerPostfixParser(QStringLiteral("!"), 80, [](KNumber &operand) { operand = operand.factorial(); });
+
+    registerPrefixParser(QStringLiteral("-"), 75, PREFIX_UNARY, KCalcOperators::negate);
+    registerPrefixParser(QStringLiteral("("), 0, GROUP, nullptr);
+    registerAngleFunction(QStringLiteral("sin"),
+                          [](KNumber &operand) { operand = KCalcTrig::sin(operand, A_DEG); },
+                          [](KNumber &operand) { operand = KCalcTrig::sin(operand, A_RAD); },
+                          [](KNumber &operand) { operand = KCalcTrig::sin(operand, A_GRAD); });
+    registerAngleFunction(QStringLiteral("cos"),
+                          [](KNumber &operand) { operand = KCalcTrig::cos(operand, A_DEG); },
+                          [](KNumber &operand) { operand = KCalcTrig::cos(operand, A_RAD); },
+                          [](KNumber &operand) { operand = KCalcTrig::cos(operand, A_GRAD); });
+    registerPrefixParser(QStringLiteral("func"), 50, FUNCTION, [](KNumber &operand) { operand += KNumber(10); });
+    registerAngleFunction(QStringLiteral("tan"),
+                          [](KNumber &operand) { operand = KCalcTrig::tan(operand, A_DEG); },
+                          [](KNumber &operand) { operand = KCalcTrig::tan(operand, A_RAD); },
+                          [](KNumber &operand) { operand = KCalcTrig::tan(operand, A_GRAD); });
+    registerPrefixParser(QStringLiteral("log"), 50, FUNCTION, [](KNumber &operand) { operand = operand.log10(); });
+    registerPrefixParser(QStringLiteral("ln"), 50, FUNCTION, [](KNumber &operand) { operand = operand.ln(); });
+    registerPrefixParser(QStringLiteral("sum"), 50, SERIES_SUM, nullptr);
+    registerPrefixParser(QStringLiteral("prod"), 50, SERIES_PRODUCT, nullptr);
+    registerPrefixParser(QStringLiteral("solve"), 50, SOLVER, nullptr);
+    registerPrefixParser(QStringLiteral("integrate"), 50, INTEGRAL, nullptr);
+
+    // number theory on integers, NaN for anything else
+    registerFunction(QStringLiteral("powmod"), 3, [](KNumber *operands, int) { operands[0] = operands[0].powmod(operands[1], operands[2]); });
+    registerFunction(QStringLiteral("invmod"), 2, [](KNumber *operands, int) { operands[0] = operands[0].invmod(operands[1]); });
+    registerFunction(QStringLiteral("gcd"), 2, [](KNumber *operands, int) { operands[0] = operands[0].gcd(operands[1]); });
+    registerFunction(QStringLiteral("lcm"), 2, [](KNumber *operands, int) { operands[0] = operands[0].lcm(operands[1]); });
+    registerFunction(QStringLiteral("jacobi"), 2, [](KNumber *operands, int) { operands[0] = operands[0].jacobi(operands[1]); });
+    registerPrefixParser(QStringLiteral("isprime"), 50, FUNCTION, [](KNumber &operand) {
+        operand = operand.isPrime() ? KNumber::One : KNumber::Zero;
+    });
+    registerPrefixParser(QStringLiteral("nextprime"), 50, FUNCTION, [](KNumber &operand) { operand = operand.nextPrime(); });
 }
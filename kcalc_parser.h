@@ -2,17 +2,18 @@
 #define KCALC_PARSER_H value
 
 #include "knumber/knumber.h"
-#include "kcalcdisplay2.h"
+#include "kcalc_cache.h"
+#include "kcalc_modes.h"
+#include <QAtomicInt>
+#include <QSharedPointer>
 #include <QStack>
 #include <QMap>
+#include <QVector>
+#include <QStringList>
 #include <QObject>
 #include <QDebug>
 
-enum AngleMode {
-    A_DEG,
-    A_RAD,
-    A_GRAD
-};
+class QRegularExpressionMatch;
 
 class KCalcParser : public QObject
 {
@@ -31,43 +32,133 @@ public:
         long debugPos;
     };
 
-    using ParseFunc = int (*)(KCalcParser &, const Token &, int);
-    using EvaluateFunc = KNumber (*)(const QList<KNumber> &operands);
-
-    using PrefParseFunc = void (*)(KCalcParser &, const Token &, int);
-    using PrefEvaluateFunc = KNumber (*)(KNumber operand);
+    // Evaluators work in place on the operand stack: the result replaces
+    // the first operand, the remaining operands are dropped afterwards.
+    using UnaryEvaluateFunc = void (*)(KNumber &operand);
+    using BinaryEvaluateFunc = void (*)(KNumber &lhs, const KNumber &rhs);
+    using NaryEvaluateFunc = void (*)(KNumber *operands, int count);
+
+    // How the operand of a prefix parser is read
+    enum PrefixKind {
+        PREFIX_UNARY,   // "-x", an expression binding tighter than the operator
+        GROUP,          // "(x)"
+        FUNCTION,       // "sin(x)"
+        SERIES_SUM,     // "sum(i, a, b, x)", x for every integer i from a to b
+        SERIES_PRODUCT, // "prod(i, a, b, x)"
+        SOLVER,         // "solve(x^2 - 2, x, 1)", a root near the guess
+        INTEGRAL        // "integrate(x^2, x, a, b)"
+    };
 
     struct InfixParser {
         int precedence;
         bool leftassociative;
-        ParseFunc parse;
-        EvaluateFunc eval;
+        BinaryEvaluateFunc eval;
+        UnaryEvaluateFunc postfix;  // set for postfix operators instead of eval
     };
 
     struct PrefixParser {
         int precedence;
-        PrefParseFunc parse;
-        PrefEvaluateFunc eval;
+        PrefixKind kind;
+        UnaryEvaluateFunc eval;
+        int operands;            // arguments of a FUNCTION with nary set
+        NaryEvaluateFunc nary;
+    };
+
+    // Expressions are compiled into a postfix program which is then run
+    // on an operand stack. Built-in operators and user defined functions
+    // share this representation.
+    enum OpCode {
+        PUSH_NUMBER,
+        PUSH_ARGUMENT,
+        UNARY,
+        BINARY,
+        NARY,
+        CALL,
+        STORE_LOCAL,
+        LOAD_LOCAL,
+        SUM,
+        PRODUCT,
+        SOLVE,
+        INTEGRATE
+    };
+
+    struct Instruction {
+        OpCode opcode;
+        int index;     // constant, argument, function, local or body index
+        int operands;  // number of operands consumed by NARY and CALL
+        UnaryEvaluateFunc unary;
+        BinaryEvaluateFunc binary;
+        NaryEvaluateFunc nary;
+    };
+
+    struct Program {
+        QVector<Instruction> code;
+        QVector<KNumber> constants;
+        // of SUM, PRODUCT, SOLVE and INTEGRATE, called with the arguments
+        // of this program followed by the bound variable
+        QVector<QSharedPointer<const Program>> bodies;
+        int arguments = 0;
+        int locals = 0;
+    };
+
+    struct Function {
+        QString name;
+        QStringList parameters;
+        Program body;
     };
 
     void registerInfixParser(const QString &name,
                              int precedence,
-                             ParseFunc parse,
-                             EvaluateFunc eval,
+                             BinaryEvaluateFunc eval,
                              bool leftassociative = true);
 
+    void registerPostfixParser(const QString &name,
+                               int precedence,
+                               UnaryEvaluateFunc eval);
+
     void registerPrefixParser(const QString &name,
                               int precedence,
-                              PrefParseFunc parse,
-                              PrefEvaluateFunc eval);
+                              PrefixKind kind,
+                              UnaryEvaluateFunc eval);
+
+    void registerFunction(const QString &name,
+                          int operands,
+                          NaryEvaluateFunc eval);
+
+    // A function of an angle; expressions are compiled with the
+    // evaluator of the angle mode set at that time
+    void registerAngleFunction(const QString &name,
+                               UnaryEvaluateFunc deg,
+                               UnaryEvaluateFunc rad,
+                               UnaryEvaluateFunc grad);
 
     KNumber parseExpression(const QString &expression);
 
-    Token consume();
-    const Token &peak() const;
-    void parse(int p = 0);
-    void expect(TokenType token);
-    void expect(TokenType type, const QString &value);
+    Program compile(const QString &expression, const QStringList &arguments = QStringList());
+
+    // Like compile(), key is set to the key of the result in the cache,
+    // empty if the result can not be cached
+    Program compile(const QString &expression, QString &key);
+    KNumber evaluate(const Program &program, const QVector<KNumber> &arguments = QVector<KNumber>()) const;
+
+    // Evaluates against a snapshot of the user functions, for use from
+    // other threads while the parser keeps changing. Returns NaN once
+    // canceled is set.
+    static KNumber run(const Program &program, const QVector<Function> &functions,
+                       const QVector<KNumber> &arguments = QVector<KNumber>(),
+                       const QAtomicInt *canceled = nullptr);
+
+    bool defineFunction(const QString &definition);
+    bool isFunctionHead(const QString &text) const;
+    bool hasFunction(const QString &name) const;
+    void clearFunctions();
+    const Function &function(int index) const;
+    QVector<Function> functions() const;
+
+    QString dump(const Program &program) const;
+    QString instructionName(const Instruction &instruction) const;
+    const InfixParser *infixParser(const QString &name) const;
+    const PrefixParser *prefixParser(const QString &name) const;
 
     void addDefaultParser();
 
@@ -75,14 +166,39 @@ public:
     NumBase getNumBase() const;
     void setAngleMode(AngleMode anglemode);
     AngleMode getAngleMode() const;
+    void setOptimize(bool optimize);
+    bool getOptimize() const;
+
+    // results of parseExpression() and of whoever compiles with a key,
+    // functions invalidate it themselves
+    KCalcResultCache &resultCache();
 
 Q_SIGNALS:
     void foundInvalidToken(int pos);
+    void functionDefined(const QString &name);
 
 private:
     static bool isValidDigit(const QChar &ch, NumBase base);
     void tokenize();
 
+    Token consume();
+    const Token &peak() const;
+    void expect(TokenType token);
+    void expect(TokenType type, const QString &value);
+
+    Program compile(const QString &expression, int offset, const QStringList &arguments);
+    void prepare(const QString &expression, int offset, const QStringList &arguments);
+    Program finish();
+    QString resultKey() const;
+    void invalidToken(int position);
+    void parse();
+    void emitNumber(const Token &token);
+    void emitCall(long position, int function, int depth, const QVector<int> &starts);
+    void emitBinding(long position, OpCode opcode, int depth, const QVector<int> &starts);
+    void emitInstruction(const Instruction &instruction);
+    bool isReservedName(const QString &name) const;
+    bool parseHead(const QRegularExpressionMatch &match, QStringList &parameters) const;
+
     QStringView findOperator(QString::Iterator position) const;
     InfixParser *findInfixParser(const QString &value);
     PrefixParser *findPrefixParser(const QString &value);
@@ -91,12 +207,24 @@ private:
     QString::Iterator position;
     QMap<QString, InfixParser> infixParsers;
     QMap<QString, PrefixParser> prefixParsers;
+    QMap<QString, QVector<UnaryEvaluateFunc>> angleFunctions_;
     QList<Token> tokens_;
-    QStack<KNumber> operands_;
+    QStringList arguments_;
+    QStringList variables_;               // bound by sum(), solve() etc. anywhere
+    QMap<long, QString> variableNames_;   // by the position of the construct
+    QStringList boundVariables_;          // in scope while parsing
+    Program program_;
+    int depth_ = 0;
+    QVector<Function> functions_;
+    QMap<QString, int> functionNames_;
     NumBase numberBase_ = NumBase::NB_HEX;
     AngleMode angleMode_ = AngleMode::A_DEG;
+    bool optimize_ = true;
+    int invalidTokens_ = 0;
+    KCalcResultCache resultCache_;
 };
 
+Q_DECLARE_METATYPE(KNumber);
 Q_DECLARE_METATYPE(KCalcParser::TokenType);
 Q_DECLARE_METATYPE(KCalcParser::Token);
 #endif
@@ -0,0 +1,122 @@
+#include "kcalc_preview.h"
+#include "kcalc_optimizer.h"
+
+#include <QRunnable>
+#include <QScopedPointer>
+
+class KCalcPreview::Job : public QRunnable
+{
+public:
+    Job(KCalcPreview *preview, const KCalcParser::Program &program, const QVector<KCalcParser::Function> &functions,
+        KCalcOptimizer *optimizer, quint64 generation, const QSharedPointer<QAtomicInt> &canceled)
+        : preview_(preview)
+        , program_(program)
+        , functions_(functions)
+        , optimizer_(optimizer)
+        , generation_(generation)
+        , canceled_(canceled)
+    {
+    }
+
+    void run() override
+    {
+        const KNumber result = KCalcParser::run(optimizer_ ? optimizer_->optimize(program_) : program_,
+                                                functions_, QVector<KNumber>(), canceled_.data());
+        if (canceled_->load()) {
+            return;
+        }
+
+        // delivered on the thread of the preview, dropped if it is gone
+        KCalcPreview *const preview = preview_;
+        const quint64 generation = generation_;
+        QMetaObject::invokeMethod(preview, [preview, generation, result]() {
+            preview->deliver(generation, result);
+        }, Qt::QueuedConnection);
+    }
+
+private:
+    KCalcPreview *const preview_;
+    const KCalcParser::Program program_;
+    const QVector<KCalcParser::Function> functions_;
+    const QScopedPointer<KCalcOptimizer> optimizer_;
+    const quint64 generation_;
+    const QSharedPointer<QAtomicInt> canceled_;
+};
+
+KCalcPreview::KCalcPreview(KCalcParser &parser, QObject *parent)
+    : QObject(parent)
+    , parser_(parser)
+{
+    timer_.setSingleShot(true);
+    timer_.setInterval(150);
+    connect(&timer_, &QTimer::timeout, this, &KCalcPreview::start);
+}
+
+KCalcPreview::~KCalcPreview()
+{
+    cancel();
+    pool_.waitForDone();
+}
+
+void KCalcPreview::setDelay(int msec)
+{
+    timer_.setInterval(msec);
+}
+
+int KCalcPreview::delay() const
+{
+    return timer_.interval();
+}
+
+void KCalcPreview::setExpression(const QString &expression)
+{
+    expression_ = expression;
+    ++generation_;
+    cancel();
+    emit cleared();
+
+    timer_.start();
+}
+
+void KCalcPreview::cancel()
+{
+    if (canceled_) {
+        canceled_->store(1);
+    }
+    pool_.clear();
+}
+
+void KCalcPreview::start()
+{
+    if (expression_.trimmed().isEmpty()) {
+        return;
+    }
+
+    int errors = 0;
+    const auto connection = connect(&parser_, &KCalcParser::foundInvalidToken, [&errors](int) { ++errors; });
+
+    // Folding constants evaluates, the job does it
+    const bool optimize = parser_.getOptimize();
+    parser_.setOptimize(false);
+    const auto program = parser_.compile(expression_);
+    parser_.setOptimize(optimize);
+
+    disconnect(connection);
+
+    // Nothing to show for invalid input or a plain number
+    if (errors > 0 || program.code.isEmpty()
+        || (program.code.size() == 1 && program.code.front().opcode == KCalcParser::PUSH_NUMBER)) {
+        return;
+    }
+
+    canceled_.reset(new QAtomicInt(0));
+    pool_.start(new Job(this, program, parser_.functions(), optimize ? new KCalcOptimizer(parser_) : nullptr,
+                        generation_, canceled_));
+}
+
+void KCalcPreview::deliver(quint64 generation, const KNumber &result)
+{
+    if (generation == generation_) {
+        emit resultReady(result);
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef KCALC_PREVIEW_H
+#define KCALC_PREVIEW_H value
+
+#include "kcalc_parser.h"
+#include <QObject>
+#include <QSharedPointer>
+#include <QThreadPool>
+#include <QTimer>
+
+// Evaluates the expression being typed in the background.
+//
+// Every change restarts a short debounce timer. When it fires, the text
+// is compiled on the calling thread, which is linear in its length, and
+// the program is evaluated on a worker against a snapshot of the user
+// functions. A newer change cancels the running evaluation; results for
+// stale text are never delivered.
+class KCalcPreview : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit KCalcPreview(KCalcParser &parser, QObject *parent = nullptr);
+    ~KCalcPreview() override;
+
+    void setDelay(int msec);
+    int delay() const;
+
+public Q_SLOTS:
+    void setExpression(const QString &expression);
+
+Q_SIGNALS:
+    void resultReady(const KNumber &result);
+    void cleared();
+
+private:
+    class Job;
+
+    void start();
+    void cancel();
+    void deliver(quint64 generation, const KNumber &result);
+
+    KCalcParser &parser_;
+    QThreadPool pool_;
+    QTimer timer_;
+    QString expression_;
+    quint64 generation_ = 0;
+    QSharedPointer<QAtomicInt> canceled_;
+};
+
+#endif
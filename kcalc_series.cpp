@@ -0,0 +1,607 @@
+#include "kcalc_series.h"
+#include "kcalc_operators.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QWaitCondition>
+
+#include <limits>
+#include <utility>
+
+namespace {
+
+// Terms per chunk. It is fixed so the merge tree is the same whatever
+// the number of threads.
+const qint64 chunkSize = 1024;
+
+// highest power of the bound variable reduced in closed form
+const int maxDegree = 16;
+
+// exponents beyond this are left to the loop
+const qint64 maxExponent = std::numeric_limits<qint32>::max();
+
+bool isExact(const KNumber &x)
+{
+    return x.type() == KNumber::TYPE_INTEGER || x.type() == KNumber::TYPE_FRACTION;
+}
+
+bool isSmallInteger(const KNumber &x)
+{
+    return x.type() == KNumber::TYPE_INTEGER && x.abs() <= KNumber(maxExponent);
+}
+
+void combine(bool product, KNumber &lhs, const KNumber &rhs)
+{
+    if (product) {
+        lhs *= rhs;
+    } else {
+        lhs += rhs;
+    }
+}
+
+// Merges values pairwise as they come in, like the carries of a binary
+// counter, so operands stay balanced and no term is added to a huge sum
+class Pairwise
+{
+public:
+    explicit Pairwise(bool product)
+        : product_(product)
+    {
+    }
+
+    void add(KNumber value)
+    {
+        int level = 0;
+        while (!levels_.isEmpty() && levels_.last() == level) {
+            KNumber lhs = std::move(values_.last());
+            values_.removeLast();
+            levels_.removeLast();
+            combine(product_, lhs, value);
+            value = std::move(lhs);
+            ++level;
+        }
+        values_.push_back(std::move(value));
+        levels_.push_back(level);
+    }
+
+    KNumber result()
+    {
+        if (values_.isEmpty()) {
+            return product_ ? KNumber::One : KNumber::Zero;
+        }
+
+        KNumber result = std::move(values_.last());
+        for (int i = values_.size() - 2; i >= 0; --i) {
+            combine(product_, values_[i], result);
+            result = std::move(values_[i]);
+        }
+        values_.clear();
+        levels_.clear();
+        return result;
+    }
+
+private:
+    const bool product_;
+    QVector<KNumber> values_;
+    QVector<int> levels_;
+};
+
+//------------------------------------------------------------------------------
+// closed forms
+//------------------------------------------------------------------------------
+
+// Sum of c[k] i^k, or c[0] ratio^i when geometric
+struct Term {
+    QVector<KNumber> coefficients;
+    KNumber ratio;
+    bool geometric;
+
+    bool isConstant() const
+    {
+        return !geometric && coefficients.size() == 1;
+    }
+
+    const KNumber &constant() const
+    {
+        return coefficients.front();
+    }
+};
+
+Term constantTerm(const KNumber &value)
+{
+    return Term { QVector<KNumber> { value }, KNumber::One, false };
+}
+
+void trim(Term &term)
+{
+    while (term.coefficients.size() > 1 && term.coefficients.last().type() == KNumber::TYPE_INTEGER
+           && term.coefficients.last() == KNumber::Zero) {
+        term.coefficients.removeLast();
+    }
+}
+
+bool add(Term &lhs, const Term &rhs, bool subtract)
+{
+    if (lhs.geometric || rhs.geometric) {
+        return false;
+    }
+
+    if (lhs.coefficients.size() < rhs.coefficients.size()) {
+        lhs.coefficients.resize(rhs.coefficients.size());
+    }
+    for (int k = 0; k < rhs.coefficients.size(); ++k) {
+        if (subtract) {
+            lhs.coefficients[k] -= rhs.coefficients.at(k);
+        } else {
+            lhs.coefficients[k] += rhs.coefficients.at(k);
+        }
+    }
+    trim(lhs);
+    return true;
+}
+
+bool multiply(Term &lhs, const Term &rhs)
+{
+    if (lhs.geometric || rhs.geometric) {
+        if (lhs.geometric && rhs.geometric) {
+            lhs.coefficients[0] *= rhs.constant();
+            lhs.ratio *= rhs.ratio;
+        } else if (lhs.geometric && rhs.isConstant()) {
+            lhs.coefficients[0] *= rhs.constant();
+        } else if (rhs.geometric && lhs.isConstant()) {
+            const KNumber factor = lhs.constant();
+            lhs = rhs;
+            lhs.coefficients[0] *= factor;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    const int degree = lhs.coefficients.size() + rhs.coefficients.size() - 2;
+    if (degree > maxDegree) {
+        return false;
+    }
+
+    QVector<KNumber> product(degree + 1, KNumber::Zero);
+    for (int i = 0; i < lhs.coefficients.size(); ++i) {
+        for (int j = 0; j < rhs.coefficients.size(); ++j) {
+            product[i + j] += lhs.coefficients.at(i) * rhs.coefficients.at(j);
+        }
+    }
+    lhs.coefficients = product;
+    trim(lhs);
+    return true;
+}
+
+bool divide(Term &lhs, const Term &rhs)
+{
+    if (rhs.isConstant()) {
+        if (rhs.constant() == KNumber::Zero) {
+            return false;
+        }
+        for (auto &coefficient : lhs.coefficients) {
+            coefficient /= rhs.constant();
+        }
+        return true;
+    }
+
+    // c / (f r^i) = (c / f) (1 / r)^i
+    if (lhs.isConstant() && rhs.geometric && rhs.constant() != KNumber::Zero && rhs.ratio != KNumber::Zero) {
+        const KNumber factor = lhs.constant() / rhs.constant();
+        lhs = Term { QVector<KNumber> { factor }, KNumber::One / rhs.ratio, true };
+        return true;
+    }
+
+    return false;
+}
+
+bool power(Term &lhs, const Term &rhs)
+{
+    if (rhs.isConstant()) {
+        const KNumber &exponent = rhs.constant();
+        if (!isSmallInteger(exponent)) {
+            return false;
+        }
+
+        if (lhs.geometric) {
+            lhs.coefficients[0] = lhs.constant().pow(exponent);
+            lhs.ratio = lhs.ratio.pow(exponent);
+            return true;
+        }
+
+        const qint64 k = exponent.toInt64();
+        if (k < 0 || (lhs.coefficients.size() - 1) * k > maxDegree) {
+            return false;
+        }
+
+        const Term base = lhs;
+        lhs = constantTerm(KNumber::One);
+        for (qint64 i = 0; i < k; ++i) {
+            multiply(lhs, base);
+        }
+        return true;
+    }
+
+    // c^(q + s i) = c^q (c^s)^i
+    if (lhs.isConstant() && !rhs.geometric && rhs.coefficients.size() == 2
+        && isSmallInteger(rhs.coefficients.at(0)) && isSmallInteger(rhs.coefficients.at(1))
+        && lhs.constant() != KNumber::Zero) {
+        const KNumber base = lhs.constant();
+        lhs = Term { QVector<KNumber> { base.pow(rhs.coefficients.at(0)) }, base.pow(rhs.coefficients.at(1)), true };
+        return true;
+    }
+
+    return false;
+}
+
+// Runs the body on terms instead of numbers. Fails on anything which is
+// not built from the arithmetic operators, the bound variable and values
+// that do not depend on it.
+bool analyze(const KCalcParser::Program &body, const QVector<KCalcParser::Function> &functions,
+             const QVector<KNumber> &arguments, Term &result)
+{
+    const int variable = body.arguments - 1;
+
+    QVector<Term> stack;
+    QVector<Term> locals(body.locals);
+
+    for (const auto &instruction : body.code) {
+        switch (instruction.opcode) {
+        case KCalcParser::PUSH_NUMBER:
+            stack.push_back(constantTerm(body.constants.at(instruction.index)));
+            break;
+        case KCalcParser::PUSH_ARGUMENT:
+            if (instruction.index == variable) {
+                stack.push_back(Term { QVector<KNumber> { KNumber::Zero, KNumber::One }, KNumber::One, false });
+            } else {
+                stack.push_back(constantTerm(arguments.value(instruction.index)));
+            }
+            break;
+        case KCalcParser::UNARY: {
+            Term &operand = stack.last();
+            if (operand.isConstant()) {
+                instruction.unary(operand.coefficients[0]);
+            } else if (instruction.unary == KCalcOperators::negate) {
+                for (auto &coefficient : operand.coefficients) {
+                    KCalcOperators::negate(coefficient);
+                }
+            } else {
+                return false;
+            }
+            break;
+        }
+        case KCalcParser::BINARY: {
+            const Term rhs = stack.takeLast();
+            Term &lhs = stack.last();
+            bool ok = true;
+
+            if (lhs.isConstant() && rhs.isConstant()) {
+                instruction.binary(lhs.coefficients[0], rhs.constant());
+            } else if (instruction.binary == KCalcOperators::get(KCalcOperators::ADD).evaluate) {
+                ok = add(lhs, rhs, false);
+            } else if (instruction.binary == KCalcOperators::get(KCalcOperators::SUBTRACT).evaluate) {
+                ok = add(lhs, rhs, true);
+            } else if (instruction.binary == KCalcOperators::get(KCalcOperators::MULTIPLY).evaluate) {
+                ok = multiply(lhs, rhs);
+            } else if (instruction.binary == KCalcOperators::get(KCalcOperators::DIVIDE).evaluate) {
+                ok = divide(lhs, rhs);
+            } else if (instruction.binary == KCalcOperators::get(KCalcOperators::POWER).evaluate) {
+                ok = power(lhs, rhs);
+            } else {
+                ok = false;
+            }
+
+            if (!ok) {
+                return false;
+            }
+            break;
+        }
+        case KCalcParser::NARY:
+        case KCalcParser::CALL: {
+            const int first = stack.size() - instruction.operands;
+            QVector<KNumber> operands;
+            for (int i = first; i < stack.size(); ++i) {
+                if (!stack.at(i).isConstant()) {
+                    return false;
+                }
+                operands.push_back(stack.at(i).constant());
+            }
+            stack.resize(first);
+
+            if (instruction.opcode == KCalcParser::NARY) {
+                instruction.nary(operands.data(), operands.size());
+                stack.push_back(constantTerm(operands.front()));
+            } else {
+                stack.push_back(constantTerm(KCalcParser::run(functions.at(instruction.index).body, functions, operands)));
+            }
+            break;
+        }
+        case KCalcParser::STORE_LOCAL:
+            locals[instruction.index] = stack.last();
+            break;
+        case KCalcParser::LOAD_LOCAL:
+            stack.push_back(locals.at(instruction.index));
+            break;
+        case KCalcParser::SUM:
+        case KCalcParser::PRODUCT:
+        case KCalcParser::SOLVE:
+        case KCalcParser::INTEGRATE:
+            return false;
+        }
+    }
+
+    if (stack.size() != 1) {
+        return false;
+    }
+
+    result = stack.last();
+
+    for (const auto &coefficient : result.coefficients) {
+        if (!isExact(coefficient)) {
+            return false;
+        }
+    }
+    return !result.geometric || isExact(result.ratio);
+}
+
+// The sums of i^k for i from 1 to n and k up to degree. They are
+// polynomials in n, evaluated through
+// sum C(k + 1, j) S_j(n) for j <= k = (n + 1)^(k + 1) - 1,
+// which holds for negative n as well.
+QVector<KNumber> powerSums(const KNumber &n, int degree)
+{
+    QVector<KNumber> sums;
+    QVector<KNumber> binomials { KNumber::One };
+    const KNumber next = n + KNumber::One;
+    KNumber power = next;
+
+    for (int k = 0; k <= degree; ++k) {
+        // row k + 1 of Pascal's triangle
+        QVector<KNumber> row(k + 2, KNumber::One);
+        for (int j = 1; j <= k; ++j) {
+            row[j] = binomials.at(j - 1) + binomials.at(j);
+        }
+        binomials = row;
+
+        KNumber sum = power - KNumber::One;
+        for (int j = 0; j < k; ++j) {
+            sum -= binomials.at(j) * sums.at(j);
+        }
+        sum /= KNumber(k + 1);
+
+        sums.push_back(sum);
+        power *= next;
+    }
+
+    return sums;
+}
+
+bool closedForm(bool product, const Term &term, const KNumber &from, const KNumber &to, KNumber &result)
+{
+    const KNumber count = to - from + KNumber::One;
+
+    if (!product) {
+        if (term.geometric) {
+            const KNumber &ratio = term.ratio;
+            if (ratio == KNumber::One) {
+                result = term.constant() * count;
+                return true;
+            }
+            if (ratio == KNumber::Zero || !isSmallInteger(from) || !isSmallInteger(to + KNumber::One)) {
+                return false;
+            }
+            result = term.constant() * (ratio.pow(to + KNumber::One) - ratio.pow(from)) / (ratio - KNumber::One);
+            return true;
+        }
+
+        const int degree = term.coefficients.size() - 1;
+        const QVector<KNumber> upper = powerSums(to, degree);
+        const QVector<KNumber> lower = powerSums(from - KNumber::One, degree);
+
+        result = KNumber::Zero;
+        for (int k = 0; k <= degree; ++k) {
+            result += term.coefficients.at(k) * (upper.at(k) - lower.at(k));
+        }
+        return true;
+    }
+
+    if (!isSmallInteger(count)) {
+        return false;
+    }
+
+    if (term.isConstant()) {
+        result = term.constant().pow(count);
+        return true;
+    }
+
+    // the product of f r^i is f^n r^(sum of i)
+    if (term.geometric) {
+        const KNumber exponent = (from + to) * count / KNumber(2);
+        if (!isSmallInteger(exponent)) {
+            return false;
+        }
+        result = term.constant().pow(count) * term.ratio.pow(exponent);
+        return true;
+    }
+
+    // the product of i, through factorials while they are not much
+    // longer than the loop
+    if (term.coefficients.size() == 2 && term.coefficients.at(0) == KNumber::Zero
+        && term.coefficients.at(1) == KNumber::One) {
+        if (from <= KNumber::Zero && to >= KNumber::Zero) {
+            result = KNumber::Zero;
+            return true;
+        }
+        if (from >= KNumber::One && from - KNumber::One <= count) {
+            result = to.factorial() / (from - KNumber::One).factorial();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//------------------------------------------------------------------------------
+// loops
+//------------------------------------------------------------------------------
+
+struct Range {
+    bool product;
+    const KCalcParser::Program *body;
+    const QVector<KCalcParser::Function> *functions;
+    QVector<KNumber> arguments;  // the last one is the bound variable
+    KNumber from;
+    qint64 count;
+    int chunks;
+    const QAtomicInt *canceled;
+
+    // chunks are claimed in order, the caller waits until all are done
+    QAtomicInt next;
+    QVector<KNumber> partials;
+    int done;
+    QMutex mutex;
+    QWaitCondition finished;
+};
+
+KNumber evaluateChunk(const Range &range, int chunk)
+{
+    QVector<KNumber> arguments = range.arguments;
+    Pairwise reduction(range.product);
+
+    const qint64 first = chunk * chunkSize;
+    const qint64 last = qMin(first + chunkSize, range.count);
+
+    KNumber variable = range.from + KNumber(first);
+    for (qint64 i = first; i < last; ++i) {
+        if (range.canceled && range.canceled->load()) {
+            return KNumber::NaN;
+        }
+        arguments.last() = variable;
+        reduction.add(KCalcParser::run(*range.body, *range.functions, arguments, range.canceled));
+        variable += KNumber::One;
+    }
+
+    return reduction.result();
+}
+
+void work(Range &range)
+{
+    int chunk;
+    while ((chunk = range.next.fetchAndAddOrdered(1)) < range.chunks) {
+        KNumber partial = evaluateChunk(range, chunk);
+
+        QMutexLocker locker(&range.mutex);
+        range.partials[chunk] = std::move(partial);
+        if (++range.done == range.chunks) {
+            range.finished.wakeAll();
+        }
+    }
+}
+
+class Helper : public QRunnable
+{
+public:
+    explicit Helper(const QSharedPointer<Range> &range)
+        : range_(range)
+    {
+    }
+
+    void run() override
+    {
+        work(*range_);
+    }
+
+private:
+    const QSharedPointer<Range> range_;
+};
+
+KNumber loop(bool product, const KCalcParser::Program &body, const QVector<KCalcParser::Function> &functions,
+             const QVector<KNumber> &arguments, const KNumber &from, qint64 count, const QAtomicInt *canceled)
+{
+    // helpers which start late find no chunk left, so they may outlive
+    // this call and share the state
+    QSharedPointer<Range> range(new Range);
+    range->product = product;
+    range->body = &body;
+    range->functions = &functions;
+    range->arguments = arguments;
+    range->arguments.resize(body.arguments);
+    range->from = from;
+    range->count = count;
+    range->chunks = int((count + chunkSize - 1) / chunkSize);
+    range->canceled = canceled;
+    range->partials.resize(range->chunks);
+    range->done = 0;
+
+    // only idle threads help, the caller works as well and so never
+    // waits for a queue
+    QThreadPool *const pool = QThreadPool::globalInstance();
+    for (int helpers = 1; helpers < qMin(range->chunks, pool->maxThreadCount()); ++helpers) {
+        Helper *const helper = new Helper(range);
+        if (!pool->tryStart(helper)) {
+            delete helper;
+            break;
+        }
+    }
+
+    work(*range);
+
+    QVector<KNumber> partials;
+    {
+        QMutexLocker locker(&range->mutex);
+        while (range->done < range->chunks) {
+            range->finished.wait(&range->mutex);
+        }
+        partials = range->partials;
+    }
+
+    // a balanced tree over the chunks in order
+    while (partials.size() > 1) {
+        QVector<KNumber> merged;
+        merged.reserve((partials.size() + 1) / 2);
+        for (int i = 0; i + 1 < partials.size(); i += 2) {
+            combine(product, partials[i], partials.at(i + 1));
+            merged.push_back(std::move(partials[i]));
+        }
+        if (partials.size() % 2) {
+            merged.push_back(std::move(partials.last()));
+        }
+        partials = merged;
+    }
+
+    return partials.front();
+}
+
+}
+
+KNumber KCalcSeries::evaluate(bool product, const KCalcParser::Program &body,
+                              const QVector<KCalcParser::Function> &functions,
+                              const QVector<KNumber> &arguments,
+                              const KNumber &from, const KNumber &to,
+                              const QAtomicInt *canceled)
+{
+    if (from.type() != KNumber::TYPE_INTEGER || to.type() != KNumber::TYPE_INTEGER) {
+        return KNumber::NaN;
+    }
+
+    if (to < from) {
+        return product ? KNumber::One : KNumber::Zero;
+    }
+
+    Term term;
+    KNumber result;
+    if (analyze(body, functions, arguments, term) && closedForm(product, term, from, to, result)) {
+        return result;
+    }
+
+    // more chunks than that could not be run anyway
+    const KNumber count = to - from + KNumber::One;
+    if (count > KNumber(qint64(std::numeric_limits<int>::max()) * chunkSize)) {
+        return KNumber::NaN;
+    }
+
+    return loop(product, body, functions, arguments, from, count.toInt64(), canceled);
+}
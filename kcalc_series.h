@@ -0,0 +1,29 @@
+#ifndef KCALC_SERIES_H
+#define KCALC_SERIES_H value
+
+#include "kcalc_parser.h"
+
+// Sums and products over a range of integers, run by the SUM and PRODUCT
+// instructions of compiled programs.
+//
+// A body which is a polynomial or a geometric term in the bound variable
+// is reduced in closed form when its coefficients are exact. Any other
+// body runs once per term: the range is cut into chunks of a fixed size,
+// the chunks are spread over the global thread pool and their results
+// are merged pairwise in order, so integers and fractions come out the
+// same as in a serial run and floats do not depend on the thread count.
+namespace KCalcSeries
+{
+// The body is called with the arguments followed by the bound variable;
+// bounds which are not integers give NaN, an empty range the neutral
+// element.
+KNumber evaluate(bool product,
+                 const KCalcParser::Program &body,
+                 const QVector<KCalcParser::Function> &functions,
+                 const QVector<KNumber> &arguments,
+                 const KNumber &from,
+                 const KNumber &to,
+                 const QAtomicInt *canceled = nullptr);
+}
+
+#endif
@@ -0,0 +1,274 @@
+#include "kcalc_server.h"
+
+#include <QDir>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLocalSocket>
+#include <QRunnable>
+
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#endif
+
+namespace {
+
+// longest request line before the connection is dropped
+const int maxLineLength = 1 << 20;
+
+// answers a client has not taken yet before its requests are no longer
+// read, the client then blocks on writing instead of the server growing
+const qint64 maxUnsent = 4 << 20;
+
+// a socket at path which no server answers on, as a crashed one leaves
+// behind; anything else there is not ours to remove
+bool isStaleSocket(const QString &path)
+{
+#ifdef Q_OS_UNIX
+    // resolved like QLocalServer does
+    const QString file = path.startsWith(QLatin1Char('/')) ? path : QDir::tempPath() + QLatin1Char('/') + path;
+    struct stat status;
+    if (::lstat(QFile::encodeName(file).constData(), &status) != 0 || !S_ISSOCK(status.st_mode)) {
+        return false;
+    }
+#endif
+
+    QLocalSocket probe;
+    probe.connectToServer(path);
+    return !probe.waitForConnected(1000);
+}
+
+}
+
+class KCalcServer::Job : public QRunnable
+{
+public:
+    Job(KCalcServer *server, quint64 connection, qint64 first, const QVector<Request> &requests)
+        : server_(server)
+        , connection_(connection)
+        , first_(first)
+        , requests_(requests)
+    {
+    }
+
+    void run() override
+    {
+        // one parser and program cache per worker thread
+        if (!server_->batches_.hasLocalData()) {
+            KCalcBatch *batch = new KCalcBatch;
+            batch->configure(server_->settings_);
+            server_->batches_.setLocalData(batch);
+        }
+        KCalcBatch *const batch = server_->batches_.localData();
+
+        QVector<QByteArray> responses;
+        responses.reserve(requests_.size());
+
+        QString result;
+        for (const Request &request : requests_) {
+            if (batch->evaluate(request.expression, result)) {
+                responses.push_back(respond(request.id, QStringLiteral("result"), result));
+            } else {
+                responses.push_back(respond(request.id, QStringLiteral("error"), QStringLiteral("invalid expression")));
+            }
+        }
+
+        // delivered on the thread of the server, dropped if it is gone
+        KCalcServer *const server = server_;
+        const quint64 connection = connection_;
+        const qint64 first = first_;
+        QMetaObject::invokeMethod(server, [server, connection, first, responses]() {
+            server->deliver(connection, first, responses);
+        }, Qt::QueuedConnection);
+    }
+
+private:
+    KCalcServer *const server_;
+    const quint64 connection_;
+    const qint64 first_;
+    const QVector<Request> requests_;
+};
+
+KCalcServer::KCalcServer(QObject *parent)
+    : QObject(parent)
+{
+    connect(&server_, &QLocalServer::newConnection, this, &KCalcServer::accept);
+}
+
+KCalcServer::~KCalcServer()
+{
+    server_.close();
+    pool_.clear();
+    pool_.waitForDone();
+}
+
+KCalcBatch &KCalcServer::settings()
+{
+    return settings_;
+}
+
+void KCalcServer::setBatchSize(int requests)
+{
+    batchSize_ = qMax(1, requests);
+}
+
+int KCalcServer::batchSize() const
+{
+    return batchSize_;
+}
+
+bool KCalcServer::listen(const QString &path)
+{
+    pool_.setMaxThreadCount(settings_.jobs());
+
+    // a socket left behind by a crashed server would block the name
+    if (isStaleSocket(path)) {
+        QLocalServer::removeServer(path);
+    }
+    return server_.listen(path);
+}
+
+QString KCalcServer::errorString() const
+{
+    return server_.errorString();
+}
+
+int KCalcServer::connectionCount() const
+{
+    return connections_.size();
+}
+
+void KCalcServer::accept()
+{
+    while (QLocalSocket *socket = server_.nextPendingConnection()) {
+        const quint64 id = nextConnection_++;
+        connections_.insert(id, Connection { socket, QByteArray(), 0, 0, QMap<qint64, QByteArray>() });
+
+        // requests left unread stay with the client, not in this buffer
+        socket->setReadBufferSize(maxLineLength);
+
+        connect(socket, &QLocalSocket::readyRead, this, [this, id]() { read(id); });
+        connect(socket, &QLocalSocket::bytesWritten, this, [this, id, socket]() {
+            // reading goes on once the client has taken enough answers
+            if (socket->bytesAvailable() > 0 && socket->bytesToWrite() <= maxUnsent) {
+                read(id);
+            }
+        });
+        connect(socket, &QLocalSocket::disconnected, this, [this, id, socket]() {
+            // results still being computed are dropped on delivery
+            connections_.remove(id);
+            socket->deleteLater();
+        });
+    }
+}
+
+void KCalcServer::read(quint64 id)
+{
+    auto it = connections_.find(id);
+    if (it == connections_.end()) {
+        return;
+    }
+    Connection &connection = *it;
+
+    // a client which does not read its answers is not read either
+    if (connection.socket->bytesToWrite() > maxUnsent) {
+        return;
+    }
+    connection.buffer += connection.socket->readAll();
+
+    // everything complete goes out in batches, the rest waits for more
+    QVector<Request> requests;
+    qint64 first = connection.received;
+    int start = 0;
+
+    for (int end = connection.buffer.indexOf('\n'); end >= 0; end = connection.buffer.indexOf('\n', start)) {
+        const QByteArray line = connection.buffer.mid(start, end - start).trimmed();
+        start = end + 1;
+        if (line.isEmpty()) {
+            continue;
+        }
+
+        const qint64 sequence = connection.received++;
+        const QJsonObject object = QJsonDocument::fromJson(line).object();
+        QJsonValue value = object.value(QStringLiteral("id"));
+        if (value.isUndefined()) {
+            value = QJsonValue(QJsonValue::Null);
+        }
+        const QByteArray requestId = QJsonDocument(QJsonObject { { QStringLiteral("id"), value } }).toJson(QJsonDocument::Compact);
+        const QString expression = object.value(QStringLiteral("expression")).toString();
+
+        // answered right away, in order with the batches around them
+        QString error;
+        if (expression.isEmpty()) {
+            error = QStringLiteral("expected {\"id\": ..., \"expression\": \"...\"}");
+        } else if (expression.contains(QLatin1Char('='))) {
+            error = QStringLiteral("function definitions are not supported");
+        }
+
+        if (!error.isEmpty()) {
+            if (!requests.isEmpty()) {
+                pool_.start(new Job(this, id, first, requests));
+                requests.clear();
+            }
+            connection.pending.insert(sequence, respond(requestId, QStringLiteral("error"), error));
+            first = connection.received;
+            continue;
+        }
+
+        requests.push_back(Request { requestId, expression });
+        if (requests.size() >= batchSize_) {
+            pool_.start(new Job(this, id, first, requests));
+            requests.clear();
+            first = connection.received;
+        }
+    }
+
+    if (!requests.isEmpty()) {
+        pool_.start(new Job(this, id, first, requests));
+    }
+
+    connection.buffer.remove(0, start);
+    if (connection.buffer.size() > maxLineLength) {
+        connection.socket->abort();
+        return;
+    }
+
+    deliver(id, connection.received, QVector<QByteArray>());
+}
+
+void KCalcServer::deliver(quint64 id, qint64 first, const QVector<QByteArray> &responses)
+{
+    auto it = connections_.find(id);
+    if (it == connections_.end()) {
+        return;
+    }
+    Connection &connection = *it;
+
+    for (int i = 0; i < responses.size(); ++i) {
+        connection.pending.insert(first + i, responses.at(i));
+    }
+
+    // pipelined answers go out in request order
+    QByteArray data;
+    auto pending = connection.pending.begin();
+    while (pending != connection.pending.end() && pending.key() == connection.sent) {
+        data += *pending;
+        pending = connection.pending.erase(pending);
+        ++connection.sent;
+    }
+
+    if (!data.isEmpty()) {
+        connection.socket->write(data);
+    }
+}
+
+QByteArray KCalcServer::respond(const QByteArray &id, const QString &key, const QString &value)
+{
+    // id is the compact JSON of {"id": ...}, the value is added to it
+    QByteArray response = id;
+    response.chop(1);
+    response += ',';
+    response += QJsonDocument(QJsonObject { { key, value } }).toJson(QJsonDocument::Compact).mid(1);
+    response += '\n';
+    return response;
+}
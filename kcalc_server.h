@@ -0,0 +1,78 @@
+#ifndef KCALC_SERVER_H
+#define KCALC_SERVER_H value
+
+#include "kcalc_batch.h"
+#include <QHash>
+#include <QLocalServer>
+#include <QMap>
+#include <QObject>
+#include <QThreadPool>
+#include <QThreadStorage>
+
+class QLocalSocket;
+
+// Serves calculations on a local socket, for "kcalc --serve".
+//
+// Clients send one JSON object per line, {"id": 1, "expression": "1+2"},
+// and receive one per line, {"id": 1, "result": "3"} or
+// {"id": 1, "error": "..."}; the id is returned as sent. Requests may
+// be pipelined and are answered in the order they arrived.
+//
+// All connections share one event loop. Everything a read delivers is
+// cut into batches which run on a worker pool, every worker evaluates
+// with a KCalcBatch of its own. Requests are independent, function
+// definitions are refused.
+//
+// A connection is no longer read while too many of its answers wait to
+// be sent, so a client which pipelines without reading is held back.
+// listen() only replaces a socket which no server answers on.
+class KCalcServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit KCalcServer(QObject *parent = nullptr);
+    ~KCalcServer() override;
+
+    // base, angle mode, precision and number of jobs of the workers
+    KCalcBatch &settings();
+
+    void setBatchSize(int requests);
+    int batchSize() const;
+
+    bool listen(const QString &path);
+    QString errorString() const;
+    int connectionCount() const;
+
+private:
+    struct Request {
+        QByteArray id;
+        QString expression;
+    };
+
+    struct Connection {
+        QLocalSocket *socket;
+        QByteArray buffer;
+        qint64 received;
+        qint64 sent;
+        QMap<qint64, QByteArray> pending;
+    };
+
+    class Job;
+
+    void accept();
+    void read(quint64 connection);
+    void deliver(quint64 connection, qint64 first, const QVector<QByteArray> &responses);
+
+    static QByteArray respond(const QByteArray &id, const QString &key, const QString &value);
+
+    KCalcBatch settings_;
+    QThreadStorage<KCalcBatch *> batches_;
+    QThreadPool pool_;
+    QLocalServer server_;
+    QHash<quint64, Connection> connections_;
+    quint64 nextConnection_ = 0;
+    int batchSize_ = 64;
+};
+
+#endif
@@ -30,6 +30,7 @@ KCalcStatusBar::KCalcStatusBar(QWidget *parent)
     , base_indicator_(addIndicator(QList<QString>() << QStringLiteral("DEC") << QStringLiteral("BIN") << QStringLiteral("OCT") << QStringLiteral("HEX")))
     , angle_mode_indicator_(addIndicator(QList<QString>() << QStringLiteral("DEG") << QStringLiteral("RAD") << QStringLiteral("GRA")))
     , memory_indicator_(addIndicator(QList<QString>() << QString() << i18nc("Memory indicator in status bar", "M")))
+    , busy_indicator_(addIndicator(QList<QString>() << QString() << i18nc("Calculation in progress indicator in status bar", "BUSY")))
 {
     setSizeGripEnabled(false);
 }
@@ -114,3 +115,7 @@ void KCalcStatusBar::setMemoryIndicator(bool memory)
     memory_indicator_->setText(memory ? i18nc("Memory indicator in status bar", "M") : QString());
 }
 
+void KCalcStatusBar::setBusyIndicator(bool busy)
+{
+    busy_indicator_->setText(busy ? i18nc("Calculation in progress indicator in status bar", "BUSY") : QString());
+}
@@ -46,6 +46,7 @@ public:
     void setBase(int base);
     void setAngleMode(AngleMode mode);
     void setMemoryIndicator(bool memory);
+    void setBusyIndicator(bool busy);
 
 private:
     QLabel *addIndicator(QList<QString> indicatorTexts);
@@ -55,6 +56,7 @@ private:
     QLabel * const base_indicator_;
     QLabel * const angle_mode_indicator_;
     QLabel * const memory_indicator_;
+    QLabel * const busy_indicator_;
 };
 
 #endif
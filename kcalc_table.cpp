@@ -0,0 +1,283 @@
+#include "kcalc_table.h"
+
+#include <QMutexLocker>
+#include <QRegularExpression>
+#include <QRunnable>
+#include <QTextStream>
+
+namespace {
+
+// more rows would not fit into memory, nor into the dialog
+const qint64 maxRows = 10000000;
+
+// chunks in flight per worker, a slow chunk makes the others wait
+// instead of filling the reorder buffer
+const int chunksPerWorker = 4;
+
+// split at commas which are not nested in parentheses
+QStringList splitArguments(const QString &text)
+{
+    QStringList arguments;
+    QString current;
+    int level = 0;
+
+    for (const QChar ch : text) {
+        if (ch == QLatin1Char('(')) {
+            ++level;
+        } else if (ch == QLatin1Char(')')) {
+            --level;
+        } else if (ch == QLatin1Char(',') && level == 0) {
+            arguments.push_back(current);
+            current.clear();
+            continue;
+        }
+        current.append(ch);
+    }
+
+    arguments.push_back(current);
+    return arguments;
+}
+
+const QRegularExpression &tableRegex()
+{
+    static const QRegularExpression regex(QStringLiteral("^\\s*table\\s*\\((.*)\\)\\s*$"),
+                                          QRegularExpression::CaseInsensitiveOption);
+    return regex;
+}
+}
+
+class KCalcTable::Worker : public QRunnable
+{
+public:
+    explicit Worker(KCalcTable *table)
+        : table_(table)
+    {
+    }
+
+    void run() override
+    {
+        QVector<KNumber> arguments(1);
+        qint64 chunk;
+
+        while (table_->take(chunk)) {
+            const qint64 first = chunk * table_->chunkSize_;
+            const qint64 last = qMin(first + table_->chunkSize_, table_->count_);
+
+            QVector<KNumber> xs;
+            QVector<KNumber> ys;
+            xs.reserve(last - first);
+            ys.reserve(last - first);
+
+            for (qint64 i = first; i < last; ++i) {
+                // computed from the index, so rounding does not accumulate
+                arguments[0] = table_->from_ + table_->step_ * KNumber(i);
+                xs.push_back(arguments[0]);
+                ys.push_back(KCalcParser::run(table_->program_, table_->functions_, arguments, &table_->canceled_));
+            }
+
+            table_->deliver(chunk, xs, ys);
+        }
+    }
+
+private:
+    KCalcTable *const table_;
+};
+
+KCalcTable::KCalcTable(QObject *parent)
+    : QObject(parent)
+{
+    qRegisterMetaType<KNumber>();
+    qRegisterMetaType<QVector<KNumber>>();
+}
+
+KCalcTable::~KCalcTable()
+{
+    cancel();
+    waitForFinished();
+}
+
+bool KCalcTable::isTable(const QString &text)
+{
+    return tableRegex().match(text).hasMatch();
+}
+
+bool KCalcTable::start(KCalcParser &parser, const QString &text)
+{
+    const auto match = tableRegex().match(text);
+    if (!match.hasMatch()) {
+        return false;
+    }
+
+    const QStringList arguments = splitArguments(match.captured(1));
+    if (arguments.size() != 5) {
+        return false;
+    }
+
+    const QString variable = arguments.at(1).trimmed();
+    if (!QRegularExpression(QStringLiteral("^[A-Za-z_]\\w*$")).match(variable).hasMatch()
+        || parser.infixParser(variable) || parser.prefixParser(variable) || parser.hasFunction(variable)) {
+        return false;
+    }
+
+    int errors = 0;
+    const auto connection = connect(&parser, &KCalcParser::foundInvalidToken, [&errors](int) { ++errors; });
+
+    const auto program = parser.compile(arguments.at(0), QStringList(variable));
+    const KNumber from = parser.parseExpression(arguments.at(2));
+    const KNumber to = parser.parseExpression(arguments.at(3));
+    const KNumber step = parser.parseExpression(arguments.at(4));
+
+    disconnect(connection);
+
+    if (errors > 0) {
+        return false;
+    }
+
+    variable_ = variable;
+    expression_ = arguments.at(0).trimmed();
+    return start(parser, program, from, to, step);
+}
+
+bool KCalcTable::start(const KCalcParser &parser, const KCalcParser::Program &program,
+                       const KNumber &from, const KNumber &to, const KNumber &step)
+{
+    if (from.type() == KNumber::TYPE_ERROR || to.type() == KNumber::TYPE_ERROR
+        || step.type() == KNumber::TYPE_ERROR || step == KNumber::Zero) {
+        return false;
+    }
+
+    // the step has to lead from one end to the other
+    const bool ascending = step > KNumber::Zero;
+    if (ascending ? to < from : to > from) {
+        return false;
+    }
+
+    const KNumber steps = ((to - from) / step).integerPart();
+    if (steps.type() == KNumber::TYPE_ERROR || steps >= KNumber(maxRows)) {
+        return false;
+    }
+
+    cancel();
+    waitForFinished();
+
+    program_ = program;
+    functions_ = parser.functions();
+    from_ = from;
+    step_ = step;
+
+    count_ = steps.toInt64() + 1;
+    const KNumber next = from + step * KNumber(count_);
+    if (count_ < maxRows && (ascending ? next <= to : next >= to)) {
+        ++count_;
+    }
+    chunks_ = (count_ + chunkSize_ - 1) / chunkSize_;
+
+    const int workers = static_cast<int>(qMin<qint64>(pool_.maxThreadCount(), chunks_));
+
+    nextChunk_ = 0;
+    window_ = qint64(workers) * chunksPerWorker;
+    emitted_.store(0);
+    canceled_.store(0);
+    nextToEmit_ = 0;
+    pending_.clear();
+
+    for (int i = 0; i < workers; ++i) {
+        pool_.start(new Worker(this));
+    }
+
+    return true;
+}
+
+void KCalcTable::cancel()
+{
+    canceled_.store(1);
+
+    QMutexLocker locker(&windowMutex_);
+    windowOpen_.wakeAll();
+}
+
+void KCalcTable::waitForFinished()
+{
+    pool_.waitForDone();
+}
+
+qint64 KCalcTable::count() const
+{
+    return count_;
+}
+
+QString KCalcTable::variable() const
+{
+    return variable_;
+}
+
+QString KCalcTable::expression() const
+{
+    return expression_;
+}
+
+void KCalcTable::setChunkSize(int size)
+{
+    chunkSize_ = qMax(1, size);
+}
+
+int KCalcTable::chunkSize() const
+{
+    return chunkSize_;
+}
+
+bool KCalcTable::take(qint64 &chunk)
+{
+    QMutexLocker locker(&windowMutex_);
+
+    while (!canceled_.load() && nextChunk_ < chunks_ && nextChunk_ >= emitted_.load() + window_) {
+        windowOpen_.wait(&windowMutex_);
+    }
+
+    if (canceled_.load() || nextChunk_ >= chunks_) {
+        return false;
+    }
+
+    chunk = nextChunk_++;
+    return true;
+}
+
+void KCalcTable::deliver(qint64 chunk, const QVector<KNumber> &arguments, const QVector<KNumber> &results)
+{
+    QMutexLocker locker(&mutex_);
+
+    if (canceled_.load()) {
+        return;
+    }
+
+    pending_.insert(chunk, qMakePair(arguments, results));
+
+    // emitting under the lock keeps the rows in range order
+    while (!pending_.isEmpty() && pending_.firstKey() == nextToEmit_) {
+        const auto rows = pending_.take(nextToEmit_);
+        emit rowsReady(nextToEmit_ * chunkSize_, rows.first, rows.second);
+        ++nextToEmit_;
+    }
+
+    if (nextToEmit_ != emitted_.load()) {
+        emitted_.store(nextToEmit_);
+        QMutexLocker windowLocker(&windowMutex_);
+        windowOpen_.wakeAll();
+    }
+
+    if (nextToEmit_ == chunks_) {
+        emit finished();
+    }
+}
+
+void KCalcTable::writeCsv(QTextStream &stream, const QVector<KNumber> &arguments,
+                          const QVector<KNumber> &results, int precision)
+{
+    // do not clash with a decimal comma
+    const QLatin1Char separator(KNumber::decimalSeparator() == QLatin1String(",") ? ';' : ',');
+
+    for (int i = 0; i < arguments.size() && i < results.size(); ++i) {
+        stream << arguments.at(i).toQString(precision) << separator
+               << results.at(i).toQString(precision) << QLatin1Char('\n');
+    }
+}
@@ -0,0 +1,91 @@
+#ifndef KCALC_TABLE_H
+#define KCALC_TABLE_H value
+
+#include "kcalc_parser.h"
+#include <QMap>
+#include <QMutex>
+#include <QObject>
+#include <QPair>
+#include <QThreadPool>
+#include <QVector>
+#include <QWaitCondition>
+
+class QTextStream;
+
+// Tabulates a compiled expression over an arithmetic range,
+// e.g. "table(x^2, x, 0, 10, 0.001)".
+//
+// The range is cut into chunks which the workers of a private thread
+// pool pick up one after the other, so fast workers simply take more
+// chunks. The program and a snapshot of the user functions are shared
+// read-only, every worker evaluates with its own operand stack.
+// Finished chunks go through a reorder buffer and rowsReady() is
+// emitted strictly in range order while later chunks are still being
+// computed. Workers only run a few chunks ahead of the next one to
+// emit, so a slow chunk holds the others back instead of growing the
+// buffer; ranges of more than ten million rows are refused.
+class KCalcTable : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit KCalcTable(QObject *parent = nullptr);
+    ~KCalcTable() override;
+
+    static bool isTable(const QString &text);
+
+    bool start(KCalcParser &parser, const QString &text);
+    bool start(const KCalcParser &parser, const KCalcParser::Program &program,
+               const KNumber &from, const KNumber &to, const KNumber &step);
+    void cancel();
+    void waitForFinished();
+
+    qint64 count() const;
+    QString variable() const;
+    QString expression() const;
+
+    void setChunkSize(int size);
+    int chunkSize() const;
+
+    static void writeCsv(QTextStream &stream, const QVector<KNumber> &arguments,
+                         const QVector<KNumber> &results, int precision = -1);
+
+Q_SIGNALS:
+    void rowsReady(qint64 first, const QVector<KNumber> &arguments, const QVector<KNumber> &results);
+    void finished();
+
+private:
+    class Worker;
+    friend class Worker;
+
+    bool take(qint64 &chunk);
+    void deliver(qint64 chunk, const QVector<KNumber> &arguments, const QVector<KNumber> &results);
+
+    QThreadPool pool_;
+    KCalcParser::Program program_;
+    QVector<KCalcParser::Function> functions_;
+    KNumber from_;
+    KNumber step_;
+    qint64 count_ = 0;
+    qint64 chunks_ = 0;
+    int chunkSize_ = 256;
+    QString variable_;
+    QString expression_;
+
+    QAtomicInt canceled_;
+
+    // chunks are handed out at most window_ ahead of the next one to
+    // emit, guarded by windowMutex_
+    QMutex windowMutex_;
+    QWaitCondition windowOpen_;
+    qint64 nextChunk_ = 0;
+    qint64 window_ = 0;
+    QAtomicInteger<qint64> emitted_;
+
+    // reorder buffer, guarded by mutex_
+    QMutex mutex_;
+    qint64 nextToEmit_ = 0;
+    QMap<qint64, QPair<QVector<KNumber>, QVector<KNumber>>> pending_;
+};
+
+#endif
@@ -0,0 +1,181 @@
+#include "kcalc_trig.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+
+namespace {
+
+// Irrational constants depend on the float precision, they are parsed
+// again only when it changed
+struct Constants {
+    KNumber pi;
+    KNumber halfPi;
+    KNumber halfSqrt2;
+    KNumber halfSqrt3;
+};
+
+Constants constants()
+{
+    static QMutex mutex;
+    static int precision = -2;
+    static Constants cached;
+
+    QMutexLocker locker(&mutex);
+    if (precision != KNumber::defaultFloatPrecision()) {
+        precision = KNumber::defaultFloatPrecision();
+        cached.pi = KNumber::Pi();
+        cached.halfPi = cached.pi / KNumber(2);
+        cached.halfSqrt2 = KNumber(2).sqrt() / KNumber(2);
+        cached.halfSqrt3 = KNumber(3).sqrt() / KNumber(2);
+    }
+    return cached;
+}
+
+// a quarter turn in the units of the mode
+KNumber quarter(AngleMode mode, const Constants &c)
+{
+    switch (mode) {
+    case A_DEG:
+        return KNumber(90);
+    case A_GRAD:
+        return KNumber(100);
+    case A_RAD:
+        break;
+    }
+    return c.halfPi;
+}
+
+// x = (4n + quadrant) quarter turns + rest, 0 <= rest < quarter
+struct Reduced {
+    int quadrant;
+    KNumber rest;
+};
+
+Reduced reduce(const KNumber &x, const KNumber &quarter)
+{
+    // exact for integers and fractions, so degrees and gradians lose
+    // nothing however large they are
+    const KNumber turns = (x / quarter).floor().integerPart();
+    const KNumber rest = x - turns * quarter;
+
+    const KNumber quadrant = turns - (turns / KNumber(4)).floor().integerPart() * KNumber(4);
+    return Reduced { int(quadrant.toInt64()), rest };
+}
+
+// sine or cosine of a rest within the first quadrant of degrees or
+// gradians
+KNumber firstQuadrant(const KNumber &rest, const KNumber &quarter, const Constants &c, bool cosine)
+{
+    if (rest == KNumber::Zero) {
+        return cosine ? KNumber::One : KNumber::Zero;
+    }
+
+    const KNumber thirds = rest * KNumber(3);
+    if (thirds == quarter) {
+        return cosine ? c.halfSqrt3 : KNumber::One / KNumber(2);
+    }
+    if (rest * KNumber(2) == quarter) {
+        return c.halfSqrt2;
+    }
+    if (thirds == quarter * KNumber(2)) {
+        return cosine ? KNumber::One / KNumber(2) : c.halfSqrt3;
+    }
+
+    const KNumber radians = rest * c.halfPi / quarter;
+    return cosine ? radians.cos() : radians.sin();
+}
+
+// sine of x shifted by a number of quarter turns, cos is a shift by one
+KNumber shiftedSin(const KNumber &x, AngleMode mode, int shift)
+{
+    if (x.type() == KNumber::TYPE_ERROR) {
+        return KNumber::NaN;
+    }
+
+    // a pi of working precision would cost a large argument its digits,
+    // the float functions reduce it themselves
+    if (mode == A_RAD) {
+        return shift % 2 == 0 ? x.sin() : x.cos();
+    }
+
+    const Constants c = constants();
+    const KNumber q = quarter(mode, c);
+    const Reduced reduced = reduce(x, q);
+
+    // sin, cos, -sin, -cos of the rest for the four quadrants
+    const int quadrant = (reduced.quadrant + shift) % 4;
+    const KNumber value = firstQuadrant(reduced.rest, q, c, quadrant % 2 == 1);
+    return quadrant < 2 ? value : -value;
+}
+
+}
+
+namespace KCalcTrig
+{
+
+KNumber sin(const KNumber &x, AngleMode mode)
+{
+    return shiftedSin(x, mode, 0);
+}
+
+KNumber cos(const KNumber &x, AngleMode mode)
+{
+    return shiftedSin(x, mode, 1);
+}
+
+KNumber tan(const KNumber &x, AngleMode mode)
+{
+    if (x.type() == KNumber::TYPE_ERROR) {
+        return KNumber::NaN;
+    }
+
+    if (mode == A_RAD) {
+        return x.sin() / x.cos();
+    }
+
+    const Constants c = constants();
+    const KNumber q = quarter(mode, c);
+    const Reduced reduced = reduce(x, q);
+
+    const KNumber sin = firstQuadrant(reduced.rest, q, c, false);
+    const KNumber cos = firstQuadrant(reduced.rest, q, c, true);
+
+    // tan has a period of half a turn, in odd quadrants it is -cot
+    if (reduced.quadrant % 2 == 0) {
+        return sin / cos;
+    }
+    return cos / -sin;
+}
+
+KNumber toRadians(const KNumber &x, AngleMode mode)
+{
+    switch (mode) {
+    case A_DEG:
+        return x * constants().pi / KNumber(180);
+    case A_GRAD:
+        return x * constants().pi / KNumber(200);
+    case A_RAD:
+        break;
+    }
+    return x;
+}
+
+KNumber fromRadians(const KNumber &x, AngleMode mode)
+{
+    switch (mode) {
+    case A_DEG:
+        return x * KNumber(180) / constants().pi;
+    case A_GRAD:
+        return x * KNumber(200) / constants().pi;
+    case A_RAD:
+        break;
+    }
+    return x;
+}
+
+KNumber pi()
+{
+    return constants().pi;
+}
+
+}
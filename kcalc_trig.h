@@ -0,0 +1,27 @@
+#ifndef KCALC_TRIG_H
+#define KCALC_TRIG_H value
+
+#include "kcalc_modes.h"
+#include "knumber/knumber.h"
+
+// Trigonometry in all angle modes, shared by the parser and CalcEngine.
+//
+// Arguments are reduced to a quarter turn before anything is converted.
+// Degrees and gradians stay exact fractions while reducing, so
+// sin(10^30 + 30) in degrees is exactly 1/2, and the special angles
+// 0, 30, 45, 60 and 90 degrees give the exact or correctly rounded
+// values. Radians go to the float functions unreduced, a pi of working
+// precision would lose the digits of large arguments.
+namespace KCalcTrig
+{
+KNumber sin(const KNumber &x, AngleMode mode);
+KNumber cos(const KNumber &x, AngleMode mode);
+KNumber tan(const KNumber &x, AngleMode mode);
+
+KNumber toRadians(const KNumber &x, AngleMode mode);
+KNumber fromRadians(const KNumber &x, AngleMode mode);
+
+KNumber pi();
+}
+
+#endif
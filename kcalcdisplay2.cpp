@@ -78,6 +78,12 @@ void KCalcDisplay2::paintEvent(QPaintEvent *e) {
 	for (int n = 0; n < 4; ++n) {
 		painter.drawText(5 + n * w, h, str_status_[n]);
 	}
+
+	if (!preview_.isEmpty()) {
+		painter.setPen(palette().color(QPalette::Disabled, QPalette::Text));
+		painter.drawText(rect().adjusted(5, 0, -5, -2), Qt::AlignRight | Qt::AlignBottom,
+		                 fm.elidedText(preview_, Qt::ElideLeft, width() - 10));
+	}
 }
 
 void KCalcDisplay2::changeSettings()
@@ -103,8 +109,9 @@ QSize KCalcDisplay2::sizeHint() const
     QFont fnt(font());
     fnt.setPointSize(qMax(((fnt.pointSize() * 3) / 4), 7));
 
+    // one line for the status texts and one for the preview
     const QFontMetrics fm(fnt);
-    size.setHeight(size.height() + fm.height());
+    size.setHeight(size.height() + 2 * fm.height());
 
     QStyleOptionFrame option;
     initStyleOption(&option);
@@ -114,6 +121,11 @@ QSize KCalcDisplay2::sizeHint() const
 }
 
 void KCalcDisplay2::insert(const KNumber &number, NumBase base)
+{
+    insert(formatNumber(number, base));
+}
+
+QString KCalcDisplay2::formatNumber(const KNumber &number, NumBase base) const
 {
     KNumber display_amount_;
     QString display_str;
@@ -142,7 +154,20 @@ void KCalcDisplay2::insert(const KNumber &number, NumBase base)
 		display_amount_ = number;
 		display_str = display_amount_.toQString(KCalcSettings::precision());
 	}
-    insert(display_str);
+    return display_str;
+}
+
+void KCalcDisplay2::setPreview(const QString &text)
+{
+    if (preview_ != text) {
+        preview_ = text;
+        update();
+    }
+}
+
+QString KCalcDisplay2::preview() const
+{
+    return preview_;
 }
 
 void KCalcDisplay2::setStatusText(int i, const QString &text) {
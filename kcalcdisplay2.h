@@ -3,13 +3,7 @@
 
 #include <QLineEdit>
 #include "knumber.h"
-
-enum NumBase {
-    NB_BINARY = 2,
-    NB_OCTAL = 8,
-    NB_DECIMAL = 10,
-    NB_HEX = 16
-};
+#include "kcalc_modes.h"
 
 class KCalcDisplay2 : public QLineEdit
 {
@@ -44,6 +38,11 @@ public:
 
     using QLineEdit::insert;
     void insert(const KNumber &number, NumBase base);
+    QString formatNumber(const KNumber &number, NumBase base) const;
+
+    // secondary line below the input, e.g. a result preview
+    void setPreview(const QString &text);
+    QString preview() const;
 protected:
     void paintEvent(QPaintEvent *) override;
 
@@ -56,6 +55,7 @@ private:
     NumBase num_base_ = NB_DECIMAL;
 
     QString str_status_[4];
+    QString preview_;
 };
 
 #endif
@@ -30,6 +30,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 QString KNumber::GroupSeparator   = QStringLiteral(",");
 QString KNumber::DecimalSeparator = QStringLiteral(".");
+int     KNumber::DefaultFloatPrecision = -1; // GMP's default until set
 
 const KNumber KNumber::Zero(QStringLiteral("0"));
 const KNumber KNumber::One(QStringLiteral("1"));
@@ -211,6 +212,35 @@ void KNumber::setDefaultFloatPrecision(int precision) {
     // Need to transform decimal digits into binary digits
     const unsigned long int bin_prec = static_cast<unsigned long int>(double(precision) * M_LN10 / M_LN2 + 1);
     mpf_set_default_prec(bin_prec);
+    DefaultFloatPrecision = precision;
+}
+
+//------------------------------------------------------------------------------
+// Name: defaultFloatPrecision
+//------------------------------------------------------------------------------
+int KNumber::defaultFloatPrecision() {
+	return DefaultFloatPrecision;
+}
+
+//------------------------------------------------------------------------------
+// Name: defaultFractionalInput
+//------------------------------------------------------------------------------
+bool KNumber::defaultFractionalInput() {
+	return detail::knumber_fraction::default_fractional_input;
+}
+
+//------------------------------------------------------------------------------
+// Name: defaultFloatOutput
+//------------------------------------------------------------------------------
+bool KNumber::defaultFloatOutput() {
+	return !detail::knumber_fraction::default_fractional_output;
+}
+
+//------------------------------------------------------------------------------
+// Name: splitoffIntegerForFractionOutput
+//------------------------------------------------------------------------------
+bool KNumber::splitoffIntegerForFractionOutput() {
+	return detail::knumber_fraction::split_off_integer_for_fraction_output;
 }
 
 //------------------------------------------------------------------------------
@@ -387,6 +417,14 @@ KNumber::KNumber(const KNumber &other) : value_(nullptr) {
 	}
 }
 
+//------------------------------------------------------------------------------
+// Name: KNumber
+//------------------------------------------------------------------------------
+KNumber::KNumber(KNumber &&other) : value_(new detail::knumber_integer(0)) {
+	// other is left zero, a valid number
+	swap(other);
+}
+
 //------------------------------------------------------------------------------
 // Name: ~KNumber
 //------------------------------------------------------------------------------
@@ -413,6 +451,14 @@ KNumber::Type KNumber::type() const {
 	}
 }
 
+//------------------------------------------------------------------------------
+// Name: memoryUsage
+//------------------------------------------------------------------------------
+qint64 KNumber::memoryUsage() const {
+
+	return sizeof(*this) + value_->memory_usage();
+}
+
 //------------------------------------------------------------------------------
 // Name: operator=
 //------------------------------------------------------------------------------
@@ -421,6 +467,14 @@ KNumber &KNumber::operator=(const KNumber &rhs) {
 	return *this;
 }
 
+//------------------------------------------------------------------------------
+// Name: operator=
+//------------------------------------------------------------------------------
+KNumber &KNumber::operator=(KNumber &&rhs) {
+	swap(rhs);
+	return *this;
+}
+
 //------------------------------------------------------------------------------
 // Name: swap
 //------------------------------------------------------------------------------
@@ -944,3 +998,102 @@ KNumber KNumber::bin(const KNumber &x) const {
 	z.simplify();
 	return z;
 }
+
+//------------------------------------------------------------------------------
+// Name: powmod
+//------------------------------------------------------------------------------
+KNumber KNumber::powmod(const KNumber &exponent, const KNumber &modulus) const {
+
+	const detail::knumber_integer *const e = dynamic_cast<const detail::knumber_integer *>(exponent.value_);
+	const detail::knumber_integer *const m = dynamic_cast<const detail::knumber_integer *>(modulus.value_);
+	if(type() != TYPE_INTEGER || !e || !m) {
+		return NaN;
+	}
+
+	KNumber z(*this);
+	z.value_ = static_cast<detail::knumber_integer *>(z.value_)->powmod(e, m);
+	return z;
+}
+
+//------------------------------------------------------------------------------
+// Name: invmod
+//------------------------------------------------------------------------------
+KNumber KNumber::invmod(const KNumber &modulus) const {
+
+	const detail::knumber_integer *const m = dynamic_cast<const detail::knumber_integer *>(modulus.value_);
+	if(type() != TYPE_INTEGER || !m) {
+		return NaN;
+	}
+
+	KNumber z(*this);
+	z.value_ = static_cast<detail::knumber_integer *>(z.value_)->invmod(m);
+	return z;
+}
+
+//------------------------------------------------------------------------------
+// Name: gcd
+//------------------------------------------------------------------------------
+KNumber KNumber::gcd(const KNumber &x) const {
+
+	const detail::knumber_integer *const p = dynamic_cast<const detail::knumber_integer *>(x.value_);
+	if(type() != TYPE_INTEGER || !p) {
+		return NaN;
+	}
+
+	KNumber z(*this);
+	z.value_ = static_cast<detail::knumber_integer *>(z.value_)->gcd(p);
+	return z;
+}
+
+//------------------------------------------------------------------------------
+// Name: lcm
+//------------------------------------------------------------------------------
+KNumber KNumber::lcm(const KNumber &x) const {
+
+	const detail::knumber_integer *const p = dynamic_cast<const detail::knumber_integer *>(x.value_);
+	if(type() != TYPE_INTEGER || !p) {
+		return NaN;
+	}
+
+	KNumber z(*this);
+	z.value_ = static_cast<detail::knumber_integer *>(z.value_)->lcm(p);
+	return z;
+}
+
+//------------------------------------------------------------------------------
+// Name: nextPrime
+//------------------------------------------------------------------------------
+KNumber KNumber::nextPrime() const {
+
+	if(type() != TYPE_INTEGER) {
+		return NaN;
+	}
+
+	KNumber z(*this);
+	z.value_ = static_cast<detail::knumber_integer *>(z.value_)->nextprime();
+	return z;
+}
+
+//------------------------------------------------------------------------------
+// Name: jacobi
+//------------------------------------------------------------------------------
+KNumber KNumber::jacobi(const KNumber &x) const {
+
+	const detail::knumber_integer *const p = dynamic_cast<const detail::knumber_integer *>(x.value_);
+	if(type() != TYPE_INTEGER || !p) {
+		return NaN;
+	}
+
+	KNumber z(*this);
+	z.value_ = static_cast<detail::knumber_integer *>(z.value_)->jacobi(p);
+	return z;
+}
+
+//------------------------------------------------------------------------------
+// Name: isPrime
+//------------------------------------------------------------------------------
+bool KNumber::isPrime() const {
+
+	const detail::knumber_integer *const p = dynamic_cast<const detail::knumber_integer *>(value_);
+	return p && p->is_prime();
+}
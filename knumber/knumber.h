@@ -76,14 +76,17 @@ public:
 	explicit KNumber(double value);
 
 	KNumber(const KNumber &other);
+	KNumber(KNumber &&other);
 	~KNumber();
 
 public:
 	Type type() const;
+	qint64 memoryUsage() const;
 
 public:
 	// assignment
 	KNumber &operator=(const KNumber &rhs);
+	KNumber &operator=(KNumber &&rhs);
 
 public:
 	// basic math operators
@@ -147,6 +150,16 @@ public:
 	KNumber exp() const;
 	KNumber bin(const KNumber &x) const;
 
+public:
+	// number theory, NaN unless all operands are integers
+	KNumber powmod(const KNumber &exponent, const KNumber &modulus) const;
+	KNumber invmod(const KNumber &modulus) const;
+	KNumber gcd(const KNumber &x) const;
+	KNumber lcm(const KNumber &x) const;
+	KNumber nextPrime() const;
+	KNumber jacobi(const KNumber &x) const;
+	bool isPrime() const;
+
 public:
 	static void setDefaultFloatPrecision(int precision);
 	static void setSplitoffIntegerForFractionOutput(bool x);
@@ -157,6 +170,10 @@ public:
 
 	static QString groupSeparator();
 	static QString decimalSeparator();
+	static int defaultFloatPrecision();
+	static bool defaultFractionalInput();
+	static bool defaultFloatOutput();
+	static bool splitoffIntegerForFractionOutput();
 
 public:
 	void swap(KNumber &other);
@@ -170,6 +187,10 @@ private:
 private:
 	static QString GroupSeparator;
 	static QString DecimalSeparator;
+	static int DefaultFloatPrecision;
 };
 
+// only holds a pointer, so it can be relocated with memcpy
+Q_DECLARE_TYPEINFO(KNumber, Q_MOVABLE_TYPE);
+
 #endif
@@ -111,6 +111,10 @@ public:
 public:
 	// comparison
 	virtual int compare(knumber_base *rhs) = 0;
+
+public:
+	// bytes held by the value, including its digits
+	virtual qint64 memory_usage() const = 0;
 };
 
 }
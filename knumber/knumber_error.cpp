@@ -509,6 +509,13 @@ knumber_base *knumber_error::atanh() {
 	return this;
 }
 
+//------------------------------------------------------------------------------
+// Name: memory_usage
+//------------------------------------------------------------------------------
+qint64 knumber_error::memory_usage() const {
+	return sizeof(*this);
+}
+
 //------------------------------------------------------------------------------
 // Name:
 //------------------------------------------------------------------------------
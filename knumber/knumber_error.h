@@ -106,6 +106,9 @@ public:
 public:
 	int compare(knumber_base *rhs) override;
 
+public:
+	qint64 memory_usage() const override;
+
 private:
 	// conversion constructors
 	explicit knumber_error(const knumber_integer *value);
@@ -789,6 +789,13 @@ knumber_base *knumber_float::pow(knumber_base *rhs) {
 	return nullptr;
 }
 
+//------------------------------------------------------------------------------
+// Name: memory_usage
+//------------------------------------------------------------------------------
+qint64 knumber_float::memory_usage() const {
+	return sizeof(*this) + (mpf_get_prec(mpf_) + 7) / 8;
+}
+
 //------------------------------------------------------------------------------
 // Name:
 //------------------------------------------------------------------------------
@@ -110,6 +110,9 @@ public:
 public:
 	int compare(knumber_base *rhs) override;
 
+public:
+	qint64 memory_usage() const override;
+
 public:
 	knumber_base *bitwise_and(knumber_base *rhs) override;
 	knumber_base *bitwise_xor(knumber_base *rhs) override;
@@ -704,6 +704,13 @@ knumber_base *knumber_fraction::atanh() {
 	return f->atanh();
 }
 
+//------------------------------------------------------------------------------
+// Name: memory_usage
+//------------------------------------------------------------------------------
+qint64 knumber_fraction::memory_usage() const {
+	return sizeof(*this) + (mpz_size(mpq_numref(mpq_)) + mpz_size(mpq_denref(mpq_))) * sizeof(mp_limb_t);
+}
+
 //------------------------------------------------------------------------------
 // Name:
 //------------------------------------------------------------------------------
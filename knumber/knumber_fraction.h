@@ -113,6 +113,9 @@ public:
 public:
 	int compare(knumber_base *rhs) override;
 
+public:
+	qint64 memory_usage() const override;
+
 private:
 	knumber_integer *numerator() const;
 	knumber_integer *denominator() const;
@@ -668,6 +668,111 @@ knumber_base *knumber_integer::factorial() {
 	return this;
 }
 
+//------------------------------------------------------------------------------
+// Name: memory_usage
+//------------------------------------------------------------------------------
+qint64 knumber_integer::memory_usage() const {
+	return sizeof(*this) + mpz_size(mpz_) * sizeof(mp_limb_t);
+}
+
+//------------------------------------------------------------------------------
+// Name: powmod
+// Desc: this^exponent mod |modulus|, without ever forming the power; a
+//       negative exponent raises the inverse, if there is one
+//------------------------------------------------------------------------------
+knumber_base *knumber_integer::powmod(const knumber_integer *exponent, const knumber_integer *modulus) {
+
+	if(mpz_sgn(modulus->mpz_) == 0) {
+		delete this;
+		return new knumber_error(knumber_error::ERROR_UNDEFINED);
+	}
+
+	mpz_t m;
+	mpz_init(m);
+	mpz_abs(m, modulus->mpz_);
+
+	if(mpz_sgn(exponent->mpz_) < 0 && mpz_invert(mpz_, mpz_, m) == 0) {
+		mpz_clear(m);
+		delete this;
+		return new knumber_error(knumber_error::ERROR_UNDEFINED);
+	}
+
+	mpz_t e;
+	mpz_init(e);
+	mpz_abs(e, exponent->mpz_);
+	mpz_powm(mpz_, mpz_, e, m);
+	mpz_clear(e);
+	mpz_clear(m);
+	return this;
+}
+
+//------------------------------------------------------------------------------
+// Name: invmod
+// Desc: the inverse of this mod |modulus|, undefined unless both are coprime
+//------------------------------------------------------------------------------
+knumber_base *knumber_integer::invmod(const knumber_integer *modulus) {
+
+	if(mpz_sgn(modulus->mpz_) == 0 || mpz_invert(mpz_, mpz_, modulus->mpz_) == 0) {
+		delete this;
+		return new knumber_error(knumber_error::ERROR_UNDEFINED);
+	}
+
+	return this;
+}
+
+//------------------------------------------------------------------------------
+// Name: gcd
+//------------------------------------------------------------------------------
+knumber_base *knumber_integer::gcd(const knumber_integer *rhs) {
+
+	mpz_gcd(mpz_, mpz_, rhs->mpz_);
+	return this;
+}
+
+//------------------------------------------------------------------------------
+// Name: lcm
+//------------------------------------------------------------------------------
+knumber_base *knumber_integer::lcm(const knumber_integer *rhs) {
+
+	mpz_lcm(mpz_, mpz_, rhs->mpz_);
+	return this;
+}
+
+//------------------------------------------------------------------------------
+// Name: nextprime
+// Desc: the smallest prime greater than this
+//------------------------------------------------------------------------------
+knumber_base *knumber_integer::nextprime() {
+
+	mpz_nextprime(mpz_, mpz_);
+	return this;
+}
+
+//------------------------------------------------------------------------------
+// Name: jacobi
+// Desc: the Jacobi symbol (this/rhs), defined for odd positive rhs
+//------------------------------------------------------------------------------
+knumber_base *knumber_integer::jacobi(const knumber_integer *rhs) {
+
+	if(mpz_sgn(rhs->mpz_) <= 0 || mpz_even_p(rhs->mpz_)) {
+		delete this;
+		return new knumber_error(knumber_error::ERROR_UNDEFINED);
+	}
+
+	mpz_set_si(mpz_, mpz_jacobi(mpz_, rhs->mpz_));
+	return this;
+}
+
+//------------------------------------------------------------------------------
+// Name: is_prime
+// Desc: Baillie-PSW and further Miller-Rabin rounds, composites pass with a
+//       probability below 4^-25
+//------------------------------------------------------------------------------
+bool knumber_integer::is_prime() const {
+
+	return mpz_sgn(mpz_) > 0 && mpz_probab_prime_p(mpz_, 25) != 0;
+}
+
 //------------------------------------------------------------------------------
 // Name: compare
 //------------------------------------------------------------------------------
@@ -104,9 +104,22 @@ public:
 	knumber_base *atanh() override;
 	knumber_base *tgamma() override;
 
+public:
+	// number theory, on integers only
+	knumber_base *powmod(const knumber_integer *exponent, const knumber_integer *modulus);
+	knumber_base *invmod(const knumber_integer *modulus);
+	knumber_base *gcd(const knumber_integer *rhs);
+	knumber_base *lcm(const knumber_integer *rhs);
+	knumber_base *nextprime();
+	knumber_base *jacobi(const knumber_integer *rhs);
+	bool is_prime() const;
+
 public:
 	int compare(knumber_base *rhs) override;
 
+public:
+	qint64 memory_usage() const override;
+
 private:
 	// conversion constructors
 	explicit knumber_integer(const knumber_integer *value);
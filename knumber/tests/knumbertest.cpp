@@ -376,6 +376,41 @@ void testingAndOr() {
 }
 
 
+void testingNumberTheory() {
+
+	std::cout << "\n\n";
+	std::cout << "Testing number theory:\n";
+	std::cout << "----------------------\n";
+
+    checkResult(QStringLiteral("KNumber(4).powmod(KNumber(13), KNumber(497))"), KNumber(4).powmod(KNumber(13), KNumber(497)), QStringLiteral("445"), KNumber::TYPE_INTEGER);
+    checkResult(QStringLiteral("KNumber(-4).powmod(KNumber(13), KNumber(497))"), KNumber(-4).powmod(KNumber(13), KNumber(497)), QStringLiteral("52"), KNumber::TYPE_INTEGER);
+    checkResult(QStringLiteral("KNumber(3).powmod(KNumber(-1), KNumber(7))"), KNumber(3).powmod(KNumber(-1), KNumber(7)), QStringLiteral("5"), KNumber::TYPE_INTEGER);
+    checkResult(QStringLiteral("KNumber(2).powmod(KNumber(-1), KNumber(4))"), KNumber(2).powmod(KNumber(-1), KNumber(4)), QStringLiteral("nan"), KNumber::TYPE_ERROR);
+    checkResult(QStringLiteral("KNumber(2).powmod(KNumber(10), KNumber(0))"), KNumber(2).powmod(KNumber(10), KNumber(0)), QStringLiteral("nan"), KNumber::TYPE_ERROR);
+    checkResult(QStringLiteral("KNumber(2).powmod(KNumber(10^100), KNumber(1000003))"),
+                KNumber(2).powmod(KNumber(QStringLiteral("1") + QString(100, QLatin1Char('0'))), KNumber(1000003)), QStringLiteral("180759"), KNumber::TYPE_INTEGER);
+    checkResult(QStringLiteral("KNumber(2.5).powmod(KNumber(2), KNumber(7))"), KNumber(2.5).powmod(KNumber(2), KNumber(7)), QStringLiteral("nan"), KNumber::TYPE_ERROR);
+
+    checkResult(QStringLiteral("KNumber(3).invmod(KNumber(11))"), KNumber(3).invmod(KNumber(11)), QStringLiteral("4"), KNumber::TYPE_INTEGER);
+    checkResult(QStringLiteral("KNumber(6).invmod(KNumber(9))"), KNumber(6).invmod(KNumber(9)), QStringLiteral("nan"), KNumber::TYPE_ERROR);
+
+    checkResult(QStringLiteral("KNumber(84).gcd(KNumber(-36))"), KNumber(84).gcd(KNumber(-36)), QStringLiteral("12"), KNumber::TYPE_INTEGER);
+    checkResult(QStringLiteral("KNumber(4).lcm(KNumber(6))"), KNumber(4).lcm(KNumber(6)), QStringLiteral("12"), KNumber::TYPE_INTEGER);
+    checkResult(QStringLiteral("KNumber(0).gcd(KNumber(0))"), KNumber(0).gcd(KNumber(0)), QStringLiteral("0"), KNumber::TYPE_INTEGER);
+
+    checkResult(QStringLiteral("KNumber(13).nextPrime()"), KNumber(13).nextPrime(), QStringLiteral("17"), KNumber::TYPE_INTEGER);
+    checkResult(QStringLiteral("KNumber(-5).nextPrime()"), KNumber(-5).nextPrime(), QStringLiteral("2"), KNumber::TYPE_INTEGER);
+
+    checkResult(QStringLiteral("KNumber(2).jacobi(KNumber(7))"), KNumber(2).jacobi(KNumber(7)), QStringLiteral("1"), KNumber::TYPE_INTEGER);
+    checkResult(QStringLiteral("KNumber(3).jacobi(KNumber(7))"), KNumber(3).jacobi(KNumber(7)), QStringLiteral("-1"), KNumber::TYPE_INTEGER);
+    checkResult(QStringLiteral("KNumber(3).jacobi(KNumber(8))"), KNumber(3).jacobi(KNumber(8)), QStringLiteral("nan"), KNumber::TYPE_ERROR);
+
+    checkTruth(QStringLiteral("KNumber(2).isPrime()"), KNumber(2).isPrime(), true);
+    checkTruth(QStringLiteral("KNumber(561).isPrime()"), KNumber(561).isPrime(), false);
+    checkTruth(QStringLiteral("KNumber(2^127 - 1).isPrime()"), (KNumber(2).pow(KNumber(127)) - KNumber::One).isPrime(), true);
+    checkTruth(QStringLiteral("KNumber(-7).isPrime()"), KNumber(-7).isPrime(), false);
+}
+
 void testingAbs() {
 
 	std::cout << "\n\n";
@@ -840,6 +875,7 @@ int main() {
 	testingDivisions();
 	testingAndOr();
 	testingModulus();
+	testingNumberTheory();
 	testingAbs();
 	testingSqrt();
 	testingFactorial();
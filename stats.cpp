@@ -21,11 +21,188 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "stats.h"
 
+//------------------------------------------------------------------------------
+// Name: Order
+// Desc: the values in ascending order, as a treap counting the nodes of
+//       its subtrees. Nodes point to the values in the entries, ties are
+//       broken by address so every value has its own place. Errors do not
+//       compare consistently, they are ordered by kind: -inf before the
+//       finite values, then inf, then nan.
+//------------------------------------------------------------------------------
+class KStats::Order {
+public:
+	~Order() {
+		destroy(root_);
+	}
+
+	int size() const {
+		return size(root_);
+	}
+
+	void insert(const KNumber *value) {
+		Node *const node = new Node{value, nextPriority(), 1, nullptr, nullptr};
+		Node *left;
+		Node *right;
+		split(root_, value, left, right);
+		root_ = merge(merge(left, node), right);
+	}
+
+	void erase(const KNumber *value) {
+		root_ = erase(root_, value);
+	}
+
+	// the value with index values below it
+	const KNumber &at(int index) const {
+		const Node *node = root_;
+		for (;;) {
+			const int left = size(node->left);
+			if (index < left) {
+				node = node->left;
+			} else if (index == left) {
+				return *node->value;
+			} else {
+				index -= left + 1;
+				node = node->right;
+			}
+		}
+	}
+
+	// how many values are at most data
+	int rank(const KNumber &data) const {
+		int result = 0;
+		for (const Node *node = root_; node;) {
+			if (before(data, *node->value)) {
+				node = node->left;
+			} else {
+				result += size(node->left) + 1;
+				node = node->right;
+			}
+		}
+		return result;
+	}
+
+private:
+	struct Node {
+		const KNumber *value;
+		quint32 priority;
+		int size;
+		Node *left;
+		Node *right;
+	};
+
+	static int size(const Node *node) {
+		return node ? node->size : 0;
+	}
+
+	// -inf, the finite values, inf, nan
+	static int kind(const KNumber &value) {
+		if (value.type() != KNumber::TYPE_ERROR) {
+			return 1;
+		}
+		if (value > KNumber::Zero) {
+			return 2;
+		}
+		return -value > KNumber::Zero ? 0 : 3;
+	}
+
+	static bool before(const KNumber &lhs, const KNumber &rhs) {
+		const int left = kind(lhs);
+		const int right = kind(rhs);
+		if (left != right) {
+			return left < right;
+		}
+		return left == 1 && lhs < rhs;
+	}
+
+	// strict and total, so erase() finds every node it looks for
+	static bool less(const KNumber *lhs, const KNumber *rhs) {
+		return before(*lhs, *rhs) || (!before(*rhs, *lhs) && lhs < rhs);
+	}
+
+	static Node *update(Node *node) {
+		node->size = size(node->left) + 1 + size(node->right);
+		return node;
+	}
+
+	// left gets the nodes before value, right the others
+	static void split(Node *node, const KNumber *value, Node *&left, Node *&right) {
+		if (!node) {
+			left = right = nullptr;
+		} else if (less(node->value, value)) {
+			split(node->right, value, node->right, right);
+			left = update(node);
+		} else {
+			split(node->left, value, left, node->left);
+			right = update(node);
+		}
+	}
+
+	static Node *merge(Node *left, Node *right) {
+		if (!left || !right) {
+			return left ? left : right;
+		}
+		if (left->priority > right->priority) {
+			left->right = merge(left->right, right);
+			return update(left);
+		}
+		right->left = merge(left, right->left);
+		return update(right);
+	}
+
+	static Node *erase(Node *node, const KNumber *value) {
+		if (!node) {
+			return nullptr;
+		}
+		if (node->value == value) {
+			Node *const rest = merge(node->left, node->right);
+			delete node;
+			return rest;
+		}
+		if (less(value, node->value)) {
+			node->left = erase(node->left, value);
+		} else {
+			node->right = erase(node->right, value);
+		}
+		return update(node);
+	}
+
+	static void destroy(Node *node) {
+		if (node) {
+			destroy(node->left);
+			destroy(node->right);
+			delete node;
+		}
+	}
+
+	// xorshift, the shape only has to be random enough to stay shallow
+	quint32 nextPriority() {
+		seed_ ^= seed_ << 13;
+		seed_ ^= seed_ >> 17;
+		seed_ ^= seed_ << 5;
+		return seed_;
+	}
+
+	Node *root_ = nullptr;
+	quint32 seed_ = 2463534242u;
+};
+
+namespace {
+// entries between two which keep their totals
+const int checkpointInterval = 64;
+}
+
 //------------------------------------------------------------------------------
 // Name: KStats
 // Desc: constructor
 //------------------------------------------------------------------------------
-KStats::KStats() : error_flag_(false) {
+KStats::KStats() : count_(0), error_flag_(false) {
+}
+
+//------------------------------------------------------------------------------
+// Name: KStats
+// Desc: copy constructor, shares the data but not the order
+//------------------------------------------------------------------------------
+KStats::KStats(const KStats &other) : last_(other.last_), totals_(other.totals_), count_(other.count_), error_flag_(other.error_flag_) {
 }
 
 //------------------------------------------------------------------------------
@@ -35,12 +212,64 @@ KStats::KStats() : error_flag_(false) {
 KStats::~KStats() {
 }
 
+//------------------------------------------------------------------------------
+// Name: operator=
+// Desc: takes the data of other. A tree kept here loses the values only
+//       this data holds and gains those only other holds, which for
+//       undo and redo are a few.
+//------------------------------------------------------------------------------
+KStats &KStats::operator=(const KStats &other) {
+
+	if (order_) {
+		const Entry *mine = last_.get();
+		const Entry *theirs = other.last_.get();
+		QVector<const Entry *> gained;
+
+		while (mine != theirs) {
+			if (theirs == nullptr || (mine && mine->count >= theirs->count)) {
+				order_->erase(&mine->value);
+				mine = mine->previous.get();
+			} else {
+				gained.push_back(theirs);
+				theirs = theirs->previous.get();
+			}
+		}
+
+		for (const Entry *entry : gained) {
+			order_->insert(&entry->value);
+		}
+	}
+
+	last_ = other.last_;
+	totals_ = other.totals_;
+	count_ = other.count_;
+	error_flag_ = other.error_flag_;
+	return *this;
+}
+
+//------------------------------------------------------------------------------
+// Name: ~Entry
+// Desc: unlinks the values no copy shares one by one, destroying a long
+//       list recursively would overflow the stack
+//------------------------------------------------------------------------------
+KStats::Entry::~Entry() {
+
+	std::shared_ptr<Entry> next = std::move(previous);
+	while (next && next.use_count() == 1) {
+		std::shared_ptr<Entry> after = std::move(next->previous);
+		next = std::move(after);
+	}
+}
+
 //------------------------------------------------------------------------------
 // Name: clearAll
 // Desc: empties the data set
 //------------------------------------------------------------------------------
 void KStats::clearAll() {
-	data_.clear();
+	last_.reset();
+	totals_ = Totals();
+	count_ = 0;
+	order_.reset();
 }
 
 //------------------------------------------------------------------------------
@@ -48,7 +277,39 @@ void KStats::clearAll() {
 // Desc: adds an item to the data set
 //------------------------------------------------------------------------------
 void KStats::enterData(const KNumber &data) {
-	data_.push_back(data);
+
+	auto entry = std::make_shared<Entry>();
+	entry->value = data;
+	entry->count = ++count_;
+
+	add(totals_, data, count_);
+	if (count_ % checkpointInterval == 0) {
+		entry->checkpoint.reset(new Totals(totals_));
+	}
+
+	entry->previous = std::move(last_);
+	last_ = std::move(entry);
+
+	if (order_) {
+		order_->insert(&last_->value);
+	}
+}
+
+//------------------------------------------------------------------------------
+// Name: enterData
+// Desc: adds items to the data set in order. A tree is dropped when the
+//       data set more than doubles, it is built again by the next query
+//       for an order statistic instead of being kept up to date
+//------------------------------------------------------------------------------
+void KStats::enterData(const QVector<KNumber> &data) {
+
+	if (data.size() > count_) {
+		order_.reset();
+	}
+
+	for (const KNumber &value : data) {
+		enterData(value);
+	}
 }
 
 //------------------------------------------------------------------------------
@@ -57,24 +318,64 @@ void KStats::enterData(const KNumber &data) {
 //------------------------------------------------------------------------------
 void KStats::clearLast() {
 
-	if(!data_.isEmpty()) {
-		data_.pop_back();
+	if(last_) {
+		if (order_) {
+			order_->erase(&last_->value);
+		}
+		last_ = last_->previous;
+		--count_;
+		totals_ = totalsOf(last_.get());
 	}
 }
 
 //------------------------------------------------------------------------------
-// Name: sum
-// Desc: calculates the SUM of all values in the data set
+// Name: add
+// Desc: updates the totals by data, the count-th value
 //------------------------------------------------------------------------------
-KNumber KStats::sum() const {
+void KStats::add(Totals &totals, const KNumber &data, int count) {
+
+	if (count == 1) {
+		totals.sum = data;
+		totals.sum_of_squares = data * data;
+		totals.mean = data;
+		totals.m2 = KNumber::Zero;
+		return;
+	}
 
-	KNumber result = KNumber::Zero;
-	
-	Q_FOREACH(const KNumber &x, data_) {
-		result += x;
+	const KNumber delta = data - totals.mean;
+	totals.sum += data;
+	totals.sum_of_squares += data * data;
+	totals.mean += delta / KNumber(count);
+	totals.m2 += delta * (data - totals.mean);
+}
+
+//------------------------------------------------------------------------------
+// Name: totalsOf
+// Desc: returns the totals of the data up to entry, from the checkpoint
+//       before it
+//------------------------------------------------------------------------------
+KStats::Totals KStats::totalsOf(const Entry *entry) {
+
+	QVector<const Entry *> after;
+	while (entry && !entry->checkpoint) {
+		after.push_back(entry);
+		entry = entry->previous.get();
 	}
 
-	return result;
+	Totals totals = entry ? *entry->checkpoint : Totals();
+	for (int i = after.size() - 1; i >= 0; --i) {
+		add(totals, after.at(i)->value, after.at(i)->count);
+	}
+	return totals;
+}
+
+//------------------------------------------------------------------------------
+// Name: sum
+// Desc: returns the SUM of all values in the data set, kept up to date
+//------------------------------------------------------------------------------
+KNumber KStats::sum() const {
+
+	return totals_.sum;
 }
 
 //------------------------------------------------------------------------------
@@ -83,78 +384,171 @@ KNumber KStats::sum() const {
 //------------------------------------------------------------------------------
 KNumber KStats::median() {
 
-	KNumber result = KNumber::Zero;
-	size_t index;
-
-	unsigned int bound = count();
+	const int bound = count();
 
 	if (bound == 0) {
 		error_flag_ = true;
 		return KNumber::Zero;
 	}
 
-	if (bound == 1)
-		return data_.at(0);
+	if (bound & 1) {    // odd
+		return at(bound / 2);
+	}
 
-	// need to copy data_-list, because sorting afterwards
-	QVector<KNumber> tmp_data(data_);
-	qSort(tmp_data);
+	return (at(bound / 2 - 1) + at(bound / 2)) / KNumber(2);
+}
 
-	if (bound & 1) {    // odd
-		index = (bound - 1) / 2 + 1;
-		result =  tmp_data.at(index - 1);
-	} else { // even
-		index = bound / 2;
-		result = ((tmp_data.at(index - 1)) + (tmp_data.at(index))) / KNumber(2);
+//------------------------------------------------------------------------------
+// Name: percentile
+// Desc: calculates the PERCENTILE (0 to 100) of the data set, interpolated
+//       between the closest ranks like a spreadsheet's PERCENTILE
+//------------------------------------------------------------------------------
+KNumber KStats::percentile(const KNumber &percent) {
+
+	if (count_ == 0 || percent.type() == KNumber::TYPE_ERROR
+		|| percent < KNumber::Zero || percent > KNumber(100)) {
+		error_flag_ = true;
+		return KNumber::Zero;
 	}
 
-	return result;
+	const KNumber position = KNumber(count_ - 1) * percent / KNumber(100);
+	const int lower = static_cast<int>(position.integerPart().toInt64());
+	const KNumber fraction = position - KNumber(lower);
+
+	if (fraction == KNumber::Zero) {
+		return at(lower);
+	}
+
+	const KNumber low = at(lower);
+	return low + (at(lower + 1) - low) * fraction;
+}
+
+//------------------------------------------------------------------------------
+// Name: minimum
+// Desc: returns the smallest value of the data set
+//------------------------------------------------------------------------------
+KNumber KStats::minimum() {
+
+	if (count_ == 0) {
+		error_flag_ = true;
+		return KNumber::Zero;
+	}
+
+	return at(0);
+}
+
+//------------------------------------------------------------------------------
+// Name: maximum
+// Desc: returns the largest value of the data set
+//------------------------------------------------------------------------------
+KNumber KStats::maximum() {
+
+	if (count_ == 0) {
+		error_flag_ = true;
+		return KNumber::Zero;
+	}
+
+	return at(count_ - 1);
+}
+
+//------------------------------------------------------------------------------
+// Name: rank
+// Desc: returns how many values of the data set are at most data
+//------------------------------------------------------------------------------
+int KStats::rank(const KNumber &data) {
+
+	return order().rank(data);
+}
+
+//------------------------------------------------------------------------------
+// Name: order
+// Desc: returns the tree of the values, built on the first query
+//------------------------------------------------------------------------------
+KStats::Order &KStats::order() {
+
+	if (!order_) {
+		order_.reset(new Order);
+		for (const Entry *entry = last_.get(); entry; entry = entry->previous.get()) {
+			order_->insert(&entry->value);
+		}
+	}
+	return *order_;
+}
+
+//------------------------------------------------------------------------------
+// Name: at
+// Desc: returns the value with index values below it
+//------------------------------------------------------------------------------
+KNumber KStats::at(int index) {
+
+	return order().at(index);
 }
 
 //------------------------------------------------------------------------------
 // Name: std_kernel
-// Desc: calculates the STD Kernel of all values in the data set
+// Desc: returns the STD Kernel, the sum of the squared deviations from the
+//       mean, kept up to date by Welford's method
 //------------------------------------------------------------------------------
 KNumber KStats::std_kernel() {
-	KNumber result           = KNumber::Zero;
-	const KNumber mean_value = mean();
 
-	if(mean_value.type() != KNumber::TYPE_ERROR) {
-		Q_FOREACH(const KNumber &x, data_) {
-			result += (x - mean_value) * (x - mean_value);
-		}
+	if (!last_) {
+		error_flag_ = true;
+		return KNumber::Zero;
 	}
 
-	return result;
+	return totals_.m2;
 }
 
 //------------------------------------------------------------------------------
 // Name: sum_of_squares
-// Desc: calculates the SUM of all values in the data set (each squared)
+// Desc: returns the SUM of all values in the data set (each squared), kept
+//       up to date
 //------------------------------------------------------------------------------
 KNumber KStats::sum_of_squares() const {
 
-	KNumber result = KNumber::Zero;
+	return totals_.sum_of_squares;
+}
 
-	Q_FOREACH(const KNumber &x, data_) {
-		result += (x * x);
+//------------------------------------------------------------------------------
+// Name: mean
+// Desc: returns the MEAN of all values in the data set, kept up to date
+//------------------------------------------------------------------------------
+KNumber KStats::mean() {
+
+	if (count_ == 0) {
+		error_flag_ = true;
+		return KNumber::Zero;
 	}
 
-	return result;
+	return totals_.mean;
 }
 
 //------------------------------------------------------------------------------
-// Name: mean
-// Desc: calculates the MEAN of all values in the data set
+// Name: variance
+// Desc: calculates the VARIANCE of all values in the data set
 //------------------------------------------------------------------------------
-KNumber KStats::mean() {
+KNumber KStats::variance() {
 
-	if (data_.isEmpty()) {
+	if (count_ == 0) {
 		error_flag_ = true;
 		return KNumber::Zero;
 	}
 
-	return (sum() / KNumber(count()));
+	return std_kernel() / KNumber(count());
+}
+
+//------------------------------------------------------------------------------
+// Name: sample_variance
+// Desc: calculates the SAMPLE VARIANCE of all values in the data set
+//------------------------------------------------------------------------------
+KNumber KStats::sample_variance() {
+
+	if (count() < 2) {
+		error_flag_ = true;
+		return KNumber::Zero;
+	}
+
+	return std_kernel() / KNumber(count() - 1);
 }
 
 //------------------------------------------------------------------------------
@@ -163,12 +557,12 @@ KNumber KStats::mean() {
 //------------------------------------------------------------------------------
 KNumber KStats::std() {
 
-	if (data_.isEmpty()) {
+	if (count_ == 0) {
 		error_flag_ = true;
 		return KNumber::Zero;
 	}
 
-	return (std_kernel() / KNumber(count())).sqrt();
+	return variance().sqrt();
 }
 
 //------------------------------------------------------------------------------
@@ -184,7 +578,7 @@ KNumber KStats::sample_std() {
 		return KNumber::Zero;
 	}
 
-	result = (std_kernel() / KNumber(count() - 1)).sqrt();
+	result = sample_variance().sqrt();
 
 	return result;
 }
@@ -195,7 +589,7 @@ KNumber KStats::sample_std() {
 //------------------------------------------------------------------------------
 int KStats::count() const {
 
-	return data_.size();
+	return count_;
 }
 
 //------------------------------------------------------------------------------
@@ -209,5 +603,49 @@ bool KStats::error() {
 	return value;
 }
 
+//------------------------------------------------------------------------------
+// Name: values
+// Desc: returns the data set, oldest value first
+//------------------------------------------------------------------------------
+QVector<KNumber> KStats::values() const {
+
+	QVector<KNumber> result(count_);
+	int index = count_;
+	for (const Entry *entry = last_.get(); entry; entry = entry->previous.get()) {
+		result[--index] = entry->value;
+	}
+	return result;
+}
+
+//------------------------------------------------------------------------------
+// Name: lastEntryUsage
+// Desc: returns the memory of the newest value, older values are shared
+//       with copies taken before it was entered
+//------------------------------------------------------------------------------
+qint64 KStats::lastEntryUsage() const {
+
+	if (!last_) {
+		return 0;
+	}
+
+	const auto usageOf = [](const Totals &totals) {
+		return static_cast<qint64>(sizeof(Totals)) + totals.sum.memoryUsage() + totals.sum_of_squares.memoryUsage()
+			+ totals.mean.memoryUsage() + totals.m2.memoryUsage();
+	};
 
+	// every copy has the totals of its own
+	qint64 usage = static_cast<qint64>(sizeof(Entry)) + last_->value.memoryUsage() + usageOf(totals_);
+	if (last_->checkpoint) {
+		usage += usageOf(*last_->checkpoint);
+	}
+	return usage;
+}
+
+//------------------------------------------------------------------------------
+// Name: sharesData
+// Desc: tells whether both hold the very same data set
+//------------------------------------------------------------------------------
+bool KStats::sharesData(const KStats &other) const {
 
+	return last_ == other.last_;
+}
@@ -25,28 +25,86 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <QVector>
 #include "knumber.h"
 
+#include <memory>
+
+// Copies share the data set, so copying is O(1) and a copy is a
+// snapshot: entering and clearing values never touch what a copy sees.
+//
+// The order statistics come from a tree over the values which only the
+// querying KStats keeps. Copies start without one, assigning a copy
+// back moves the tree along the values that differ.
 class KStats {
 public:
     KStats();
+    KStats(const KStats &other);
     ~KStats();
 
+    KStats &operator=(const KStats &other);
+
 public:
     void clearAll();
     void enterData(const KNumber &data);
+    void enterData(const QVector<KNumber> &data);
     void clearLast();
     KNumber sum() const;
     KNumber sum_of_squares() const;
     KNumber mean();
     KNumber median();
+    KNumber percentile(const KNumber &percent);
+    KNumber minimum();
+    KNumber maximum();
+    int rank(const KNumber &data);
     KNumber std_kernel();
+    KNumber variance();
+    KNumber sample_variance();
     KNumber std();
     KNumber sample_std();
     int count() const;
     bool error();
 
+    // the values, oldest first
+    QVector<KNumber> values() const;
+
+    // what a copy taken after the last enterData() holds on its own
+    qint64 lastEntryUsage() const;
+    bool sharesData(const KStats &other) const;
+
 private:
-    QVector<KNumber> data_;
+    // The running sums and Welford's mean and squared deviations, so
+    // the queries are O(1). The arithmetic is exact where KNumber is.
+    struct Totals {
+        KNumber sum;
+        KNumber sum_of_squares;
+        KNumber mean;
+        KNumber m2;
+    };
+
+    // A persistent list, newest value first. Only every checkpointed
+    // entry keeps the totals of the data up to it; clearing the last
+    // value replays the few values after the checkpoint before it
+    // instead of downdating.
+    struct Entry {
+        ~Entry();
+
+        KNumber value;
+        int count;
+        std::unique_ptr<const Totals> checkpoint;
+        std::shared_ptr<Entry> previous;
+    };
+
+    class Order;
+
+    static void add(Totals &totals, const KNumber &data, int count);
+    static Totals totalsOf(const Entry *entry);
+
+    Order &order();
+    KNumber at(int index);
+
+    std::shared_ptr<Entry> last_;
+    Totals           totals_;
+    int              count_;
     bool             error_flag_;
+    std::unique_ptr<Order> order_;
 };
 
 #endif
@@ -1,7 +1,84 @@
+#include "kcalc_batch.h"
+#include "kcalc_calculus.h"
+#include "kcalc_core.h"
+#include "kcalc_executor.h"
+#include "kcalc_factor.h"
+#include "kcalc_history.h"
+#include "kcalc_import.h"
+#include "kcalc_macro.h"
+#include "kcalc_optimizer.h"
 #include "kcalc_parser.h"
+#include "kcalc_preview.h"
+#include "kcalc_server.h"
+#include "kcalc_table.h"
+#include "kcalc_trig.h"
+#include "stats.h"
+#include <cstring>
 #include <iostream>
 #include <QtTest>
 #include <QSignalSpy>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLocalSocket>
+#include <QTemporaryDir>
+#include <QThreadPool>
+
+// One key pad session on its own engine. Sessions differ in their
+// numbers, settings and errors, so any shared state shows up as wrong
+// results.
+class KeyPadSession : public QRunnable
+{
+public:
+    KeyPadSession(int id, QAtomicInt &failures)
+        : id_(id)
+        , failures_(failures)
+    {
+    }
+
+    void run() override
+    {
+        CalcEngine core(CalcEngine::Settings{id_ % 2 == 0});
+        bool error;
+        bool ok = true;
+
+        for (int round = 0; round < 20; ++round) {
+            // id + (3 * (round + 1)) =
+            core.enterOperation(KNumber(id_), CalcEngine::FUNC_ADD);
+            core.ParenOpen(KNumber::Zero);
+            core.enterOperation(KNumber(3), CalcEngine::FUNC_MULTIPLY);
+            core.ParenClose(KNumber(round + 1));
+            core.enterOperation(core.lastOutput(error), CalcEngine::FUNC_EQUAL);
+            ok = ok && core.lastOutput(error) == KNumber(id_ + 3 * (round + 1)) && !error;
+
+            // "=" again repeats the last operation entered, "* 3", only
+            // where enabled
+            const KNumber last = core.lastOutput(error);
+            core.enterOperation(last, CalcEngine::FUNC_EQUAL);
+            const KNumber expected = id_ % 2 == 0 ? last * KNumber(3 * (round + 1)) : last;
+            ok = ok && core.lastOutput(error) == expected;
+            core.Reset();
+
+            // odd sessions fail on an empty data set, even ones do not
+            if (id_ % 2 == 0) {
+                core.StatDataNew(KNumber(id_));
+                core.StatDataNew(KNumber(id_ + 2));
+            }
+            core.StatMean(KNumber::Zero);
+            const KNumber mean = core.lastOutput(error);
+            ok = ok && error == (id_ % 2 == 1) && (error || mean == KNumber(id_ + 1));
+            core.StatClearAll(KNumber::Zero);
+            core.Reset();
+        }
+
+        if (!ok) {
+            failures_.ref();
+        }
+    }
+
+private:
+    const int id_;
+    QAtomicInt &failures_;
+};
 
 class KCalcParserTest : public QObject
 {
@@ -95,6 +172,17 @@ private Q_SLOTS:
         QTest::addRow("8") << "cos(0)" << 1;
         QTest::addRow("9") << "func(45 * 2) / 2 / 2" << 25;
         QTest::addRow("10") << "100^2" << 10000;
+        QTest::addRow("11") << "2^3^2" << 512;
+        QTest::addRow("12") << "2 * 3! - 1" << 11;
+        QTest::addRow("13") << "6 | 9" << 15;
+        QTest::addRow("14") << "6 xor 3" << 5;
+        QTest::addRow("15") << "6 & 3" << 2;
+        QTest::addRow("16") << "1 << 4 >> 2" << 4;
+        QTest::addRow("17") << "17 div 5" << 3;
+        QTest::addRow("18") << "5 nCr 2" << 10;
+        QTest::addRow("19") << "2 + 7 mod 4" << 5;
+        QTest::addRow("20") << "1 | 2 + 4 & 6" << 7;
+        QTest::addRow("21") << "-2^2 * 3" << 12;
     }
 
     void evaluateExpression()
@@ -110,6 +198,1172 @@ private Q_SLOTS:
         }
     }
 
+    void userFunctions_data()
+    {
+        QTest::addColumn<QStringList>("definitions");
+        QTest::addColumn<QString>("input");
+        QTest::addColumn<int>("result");
+
+        const QString f = QStringLiteral("f(x, y) = x^2 + y");
+
+        QTest::addRow("inlined") << QStringList { f } << "f(3, 4)" << 13;
+        QTest::addRow("nested") << QStringList { f, QStringLiteral("h(a) = f(a, 1) + 1") } << "h(2) * 2" << 12;
+        QTest::addRow("called") << QStringList { QStringLiteral("g(a) = a*a*a*a*a*a*a*a*a + a") } << "g(2) + 1" << 515;
+        QTest::addRow("duplicated argument") << QStringList { QStringLiteral("sq(a) = a * a") } << "sq(1 + 2)" << 9;
+        QTest::addRow("no parameters") << QStringList { f, QStringLiteral("five() = 5") } << "five() + f(1, 1)" << 7;
+    }
+
+    void userFunctions()
+    {
+        QFETCH(QStringList, definitions);
+        QFETCH(QString, input);
+        QFETCH(int, result);
+
+        parser->clearFunctions();
+        for (const QString &definition : definitions) {
+            QVERIFY(parser->defineFunction(definition));
+        }
+
+        QSignalSpy spy(parser, SIGNAL(foundInvalidToken(int)));
+        QCOMPARE(parser->parseExpression(input), KNumber(result));
+        QCOMPARE(spy.count(), 0);
+
+        QBENCHMARK {
+            parser->parseExpression(input);
+        }
+    }
+
+    void functionHead()
+    {
+        KCalcParser local;
+        local.addDefaultParser();
+
+        QVERIFY(local.isFunctionHead(QStringLiteral("f(x, y)")));
+        QVERIFY(!local.isFunctionHead(QStringLiteral("f(x, y) = x + y")));
+        QVERIFY(!local.isFunctionHead(QStringLiteral("sin(x)")));
+        QVERIFY(!local.defineFunction(QStringLiteral("cos(x) = x")));
+
+        // a call once the function is defined
+        QVERIFY(local.isFunctionHead(QStringLiteral("five()")));
+        QVERIFY(local.defineFunction(QStringLiteral("five() = 5")));
+        QVERIFY(!local.isFunctionHead(QStringLiteral("five()")));
+
+        // an invalid body defines nothing
+        QVERIFY(!local.defineFunction(QStringLiteral("bad(x) = x +* 2)")));
+        QVERIFY(!local.hasFunction(QStringLiteral("bad")));
+    }
+
+    void optimizer_data()
+    {
+        QTest::addColumn<QString>("input");
+        QTest::addColumn<int>("instructions");
+        QTest::addColumn<int>("argument");
+        QTest::addColumn<int>("result");
+
+        QTest::addRow("folded") << "2 * 3 + 4" << 1 << 0 << 10;
+        QTest::addRow("partially folded") << "2 * 3 + a" << 3 << 4 << 10;
+        QTest::addRow("identities") << "(a + 0) * 1 - 0" << 1 << 5 << 5;
+        QTest::addRow("double negation") << "-(-a)" << 1 << 5 << 5;
+        QTest::addRow("square") << "a^2" << 3 << 7 << 49;
+        QTest::addRow("common subexpression") << "(a + 1) * (a + 1)" << 6 << 3 << 16;
+        QTest::addRow("inlined call") << "f(a, 2 * 3)" << 5 << 2 << 10;
+    }
+
+    void optimizer()
+    {
+        QFETCH(QString, input);
+        QFETCH(int, instructions);
+        QFETCH(int, argument);
+        QFETCH(int, result);
+
+        const QStringList arguments { QStringLiteral("a") };
+        const QVector<KNumber> values { KNumber(argument) };
+
+        QVERIFY(parser->defineFunction(QStringLiteral("f(x, y) = x^2 + y")));
+        const auto program = parser->compile(input, arguments);
+
+        QCOMPARE(program.code.size(), instructions);
+        QVERIFY(!parser->dump(program).isEmpty());
+        QCOMPARE(parser->evaluate(program, values), KNumber(result));
+
+        parser->setOptimize(false);
+        const auto unoptimized = parser->compile(input, arguments);
+        parser->setOptimize(true);
+
+        QCOMPARE(parser->evaluate(unoptimized, values), KNumber(result));
+
+        QBENCHMARK {
+            parser->evaluate(program, values);
+        }
+    }
+
+    void builtinFunctions()
+    {
+        KCalcParser local;
+        local.addDefaultParser();
+        local.setNumBase(NumBase::NB_DECIMAL);
+        local.registerFunction(QStringLiteral("clamp"), 3, [](KNumber *operands, int) {
+            if (operands[0] < operands[1]) {
+                operands[0] = operands[1];
+            } else if (operands[0] > operands[2]) {
+                operands[0] = operands[2];
+            }
+        });
+
+        QSignalSpy spy(&local, SIGNAL(foundInvalidToken(int)));
+
+        QCOMPARE(local.parseExpression(QStringLiteral("clamp(15, 0, 2 * 5) + 1")), KNumber(11));
+        QCOMPARE(local.parseExpression(QStringLiteral("clamp(-3, 0, 10)")), KNumber::Zero);
+        QCOMPARE(spy.count(), 0);
+
+        local.parseExpression(QStringLiteral("clamp(1, 2)"));
+        QVERIFY(spy.count() > 0);
+
+        const auto program = local.compile(QStringLiteral("clamp(a, 0, 10) * 2"), QStringList(QStringLiteral("a")));
+        QCOMPARE(local.evaluate(program, QVector<KNumber> { KNumber(7) }), KNumber(14));
+        QCOMPARE(local.instructionName(program.code.at(program.code.size() - 3)), QStringLiteral("clamp"));
+
+        QBENCHMARK {
+            local.evaluate(program, QVector<KNumber> { KNumber(7) });
+        }
+    }
+
+    void series_data()
+    {
+        QTest::addColumn<QString>("input");
+        QTest::addColumn<QString>("result");
+
+        QTest::addRow("arithmetic") << "sum(i, 1, 100, i)" << "5050";
+        QTest::addRow("power") << "sum(i, 1, 10, i^2)" << "385";
+        QTest::addRow("polynomial") << "sum(n, -5, 5, 3*n^3 - n + 7)" << "77";
+        QTest::addRow("geometric") << "sum(i, 0, 10, 2^i)" << "2047";
+        QTest::addRow("huge range") << "sum(i, 1, 10^12, i)" << "500000000000500000000000";
+        QTest::addRow("factorial") << "prod(i, 1, 10, i)" << "3628800";
+        QTest::addRow("constant") << "prod(i, 1, 10, 3)" << "59049";
+        QTest::addRow("telescoping") << "prod(i, 1, 5000, 1 + 1/i)" << "5001";
+        QTest::addRow("loop") << "sum(i, 1, 3000, i mod 7)" << "8998";
+        QTest::addRow("nested") << "sum(i, 1, 10, sum(j, 1, i, j))" << "220";
+        QTest::addRow("empty sum") << "sum(i, 5, 1, i)" << "0";
+        QTest::addRow("empty product") << "prod(i, 5, 1, i)" << "1";
+    }
+
+    void series()
+    {
+        QFETCH(QString, input);
+        QFETCH(QString, result);
+
+        QSignalSpy spy(parser, SIGNAL(foundInvalidToken(int)));
+        QCOMPARE(parser->parseExpression(input), KNumber(result));
+        QCOMPARE(spy.count(), 0);
+    }
+
+    void seriesClosedForm()
+    {
+        // "i mod 1" keeps the body from being summed in closed form
+        const KNumber closed = parser->parseExpression(QStringLiteral("sum(i, -50, 50000, 3*i^3 - i + 7)"));
+        const KNumber looped = parser->parseExpression(QStringLiteral("sum(i, -50, 50000, 3*i^3 - i + 7 + i mod 1)"));
+        QCOMPARE(looped, closed);
+
+        QVERIFY(parser->defineFunction(QStringLiteral("g(n) = sum(k, 1, n, k*n)")));
+        QCOMPARE(parser->parseExpression(QStringLiteral("g(4)")), KNumber(40));
+
+        QSignalSpy spy(parser, SIGNAL(foundInvalidToken(int)));
+        parser->parseExpression(QStringLiteral("sum(1, 2, 3, 4)"));
+        QVERIFY(spy.count() > 0);
+
+        // the bodies are optimized too, a shared one once
+        parser->setOptimize(false);
+        const auto nested = parser->compile(QStringLiteral("sum(i, 1, 10, sum(j, 1, i, j mod (2 + 3)))"));
+        parser->setOptimize(true);
+        const auto optimized = KCalcOptimizer(*parser).optimize(nested);
+        QCOMPARE(optimized.bodies.size(), 2);
+        QVERIFY(optimized.bodies.at(0)->code.size() < nested.bodies.at(0)->code.size());
+        QCOMPARE(optimized.bodies.at(1)->bodies.at(0), optimized.bodies.at(0));
+        QCOMPARE(parser->evaluate(optimized), parser->evaluate(nested));
+
+        const auto program = parser->compile(QStringLiteral("sum(i, 1, 100000, i mod 7)"));
+        QBENCHMARK {
+            parser->evaluate(program);
+        }
+    }
+
+    void calculus_data()
+    {
+        QTest::addColumn<QString>("input");
+        QTest::addColumn<KNumber>("result");
+
+        QTest::addRow("square root") << "solve(x^2 - 2, x, 1)" << KNumber(2).sqrt();
+        QTest::addRow("far guess") << "solve(x^3 - 8, x, 100)" << KNumber(2);
+        QTest::addRow("logarithm") << "solve(ln(x) - 1, x, 2)" << KNumber::One.exp();
+        QTest::addRow("flat guess") << "solve(x^2 - 4, x, 0)" << KNumber(2);
+        QTest::addRow("polynomial") << "integrate(x^2, x, 0, 3)" << KNumber(9);
+        QTest::addRow("reversed") << "integrate(x^2, x, 3, 0)" << KNumber(-9);
+        QTest::addRow("hyperbola") << "integrate(1/x, x, 1, 2)" << KNumber(2).ln();
+        QTest::addRow("singular") << "integrate(1/x^(1/2), x, 0, 1)" << KNumber(2);
+        QTest::addRow("nested") << "solve(integrate(t, t, 0, x) - 2, x, 1)" << KNumber(2);
+    }
+
+    void calculus()
+    {
+        QFETCH(QString, input);
+        QFETCH(KNumber, result);
+
+        QSignalSpy spy(parser, SIGNAL(foundInvalidToken(int)));
+        QCOMPARE(parser->parseExpression(input).toQString(10), result.toQString(10));
+        QCOMPARE(spy.count(), 0);
+    }
+
+    void derivatives()
+    {
+        QVERIFY(parser->defineFunction(QStringLiteral("sqr(a) = solve(x^2 - a, x, a)")));
+        QCOMPARE(parser->parseExpression(QStringLiteral("sqr(9)")).toQString(10), QStringLiteral("3"));
+
+        // exact through the arithmetic operators
+        const auto body = parser->compile(QStringLiteral("3*x^2 - 1/x"), QStringList { QStringLiteral("x") });
+        KNumber value;
+        KNumber derivative;
+        QVERIFY(KCalcCalculus::differentiate(body, parser->functions(), QVector<KNumber>(), KNumber(2), value, derivative));
+        QCOMPARE(derivative, KNumber(49) / KNumber(4));
+
+        QSignalSpy spy(parser, SIGNAL(foundInvalidToken(int)));
+        parser->parseExpression(QStringLiteral("solve(x, 1, 2)"));
+        QVERIFY(spy.count() > 0);
+        QVERIFY(parser->parseExpression(QStringLiteral("solve(x^2 + 1, x, 1)")).type() == KNumber::TYPE_ERROR);
+    }
+
+    void numberTheory_data()
+    {
+        QTest::addColumn<QString>("input");
+        QTest::addColumn<QString>("result");
+
+        QTest::addRow("powmod") << "powmod(4, 13, 497)" << "445";
+        QTest::addRow("negative exponent") << "powmod(3, -1, 7)" << "5";
+        QTest::addRow("fused") << "4^13 mod 497" << "445";
+        QTest::addRow("fused huge") << "3^(10^20) mod 7" << "4";
+        QTest::addRow("invmod") << "invmod(3, 11)" << "4";
+        QTest::addRow("no inverse") << "invmod(6, 9)" << "nan";
+        QTest::addRow("gcd") << "gcd(84, 36)" << "12";
+        QTest::addRow("lcm") << "lcm(4, 6)" << "12";
+        QTest::addRow("jacobi") << "jacobi(3, 7)" << "-1";
+        QTest::addRow("prime") << "isprime(2^127 - 1)" << "1";
+        QTest::addRow("carmichael") << "isprime(561)" << "0";
+        QTest::addRow("next prime") << "nextprime(2^64)" << "18446744073709551629";
+        QTest::addRow("fraction") << "gcd(1/2, 4)" << "nan";
+    }
+
+    void numberTheory()
+    {
+        QFETCH(QString, input);
+        QFETCH(QString, result);
+
+        QSignalSpy spy(parser, SIGNAL(foundInvalidToken(int)));
+        QCOMPARE(parser->parseExpression(input).toQString(), result);
+        QCOMPARE(spy.count(), 0);
+
+        // the power is not formed, "x^p mod q" runs as one instruction
+        const auto program = parser->compile(QStringLiteral("x^p mod q"),
+                                             QStringList { QStringLiteral("x"), QStringLiteral("p"), QStringLiteral("q") });
+        QCOMPARE(program.code.size(), 4);
+    }
+
+    void numberTheoryBenchmark_data()
+    {
+        QTest::addColumn<QString>("input");
+        QTest::addColumn<int>("exponent");
+
+        // the Mersenne primes 2^2203 - 1 and 2^4253 - 1, key sized
+        for (const int exponent : { 2203, 4253 }) {
+            QTest::addRow("powmod %d", exponent) << "powmod(x, p - 2, p)" << exponent;
+            QTest::addRow("power mod %d", exponent) << "x^(p - 2) mod p" << exponent;
+            QTest::addRow("invmod %d", exponent) << "invmod(x, p)" << exponent;
+            QTest::addRow("gcd %d", exponent) << "gcd(x, p)" << exponent;
+            QTest::addRow("isprime %d", exponent) << "isprime(p)" << exponent;
+        }
+    }
+
+    void numberTheoryBenchmark()
+    {
+        QFETCH(QString, input);
+        QFETCH(int, exponent);
+
+        const QStringList arguments { QStringLiteral("x"), QStringLiteral("p") };
+        const KNumber prime = KNumber(2).pow(KNumber(exponent)) - KNumber::One;
+        const QVector<KNumber> values { KNumber(3).pow(KNumber(exponent / 2)), prime };
+
+        // by Fermat, x^(p - 2) is the inverse of x mod p
+        const KNumber inverse = parser->evaluate(parser->compile(QStringLiteral("invmod(x, p)"), arguments), values);
+        const auto program = parser->compile(input, arguments);
+        const KNumber result = parser->evaluate(program, values);
+        if (input.contains(QLatin1String("p - 2"))) {
+            QCOMPARE(result, inverse);
+        } else if (input.startsWith(QLatin1String("isprime"))) {
+            QCOMPARE(result, KNumber::One);
+        }
+
+        QBENCHMARK {
+            parser->evaluate(program, values);
+        }
+    }
+
+    void factor_data()
+    {
+        QTest::addColumn<QString>("input");
+        QTest::addColumn<QString>("result");
+
+        QTest::addRow("small") << "720" << "2^4 * 3^2 * 5";
+        QTest::addRow("negative") << "-12" << "-1 * 2^2 * 3";
+        QTest::addRow("one") << "1" << "1";
+        QTest::addRow("prime") << "2^61 - 1" << "2305843009213693951";
+        QTest::addRow("power") << "1000003^5" << "1000003^5";
+        QTest::addRow("rho") << "(10^9 + 7) * (10^9 + 9)" << "1000000007 * 1000000009";
+        QTest::addRow("fermat 6") << "2^64 + 1" << "274177 * 67280421310721";
+        QTest::addRow("fermat 7") << "2^128 + 1" << "59649589127497217 * 5704689200685129054721";
+        QTest::addRow("repeated") << "(2^61 - 1)^2 * 3^7" << "3^7 * 2305843009213693951^2";
+    }
+
+    void factor()
+    {
+        QFETCH(QString, input);
+        QFETCH(QString, result);
+
+        const KNumber number = parser->parseExpression(input);
+        QCOMPARE(KCalcFactor::toString(KCalcFactor::factors(number)), result);
+    }
+
+    void factorization()
+    {
+        QVERIFY(KCalcFactor::isFactorization(QStringLiteral("factor(2^64 + 1)")));
+        QVERIFY(!KCalcFactor::isFactorization(QStringLiteral("2^64 + 1")));
+
+        KCalcFactor factor;
+        QVERIFY(!factor.start(*parser, QStringLiteral("factor(1/2)")));
+        QVERIFY(!factor.start(*parser, QStringLiteral("factor(2 +)")));
+
+        // every prime arrives on its own, then the end
+        QSignalSpy found(&factor, SIGNAL(factorFound(KNumber, int)));
+        QSignalSpy finished(&factor, SIGNAL(finished(bool)));
+        QVERIFY(factor.start(*parser, QStringLiteral("factor(2^3 * (2^64 + 1))")));
+        QCOMPARE(factor.expression(), QStringLiteral("2^3 * (2^64 + 1)"));
+        QTRY_COMPARE_WITH_TIMEOUT(finished.count(), 1, 30000);
+        QCOMPARE(finished.at(0).at(0).toBool(), true);
+        QCOMPARE(found.count(), 3);
+        QCOMPARE(found.at(0).at(0).value<KNumber>(), KNumber(2));
+        QCOMPARE(found.at(0).at(1).toInt(), 3);
+
+        // a product of two 40 digit primes takes far longer than the test
+        QAtomicInt canceled(1);
+        const KNumber hard = parser->parseExpression(QStringLiteral("nextprime(10^40) * nextprime(2 * 10^40)"));
+        QVERIFY(!KCalcFactor::factor(hard, [](const KNumber &, int) {}, &canceled));
+
+        finished.clear();
+        QVERIFY(factor.start(hard));
+        factor.cancel();
+        QTRY_COMPARE_WITH_TIMEOUT(finished.count(), 1, 10000);
+        QCOMPARE(finished.at(0).at(0).toBool(), false);
+    }
+
+    void keyPad()
+    {
+        CalcEngine core;
+        bool error;
+
+        // 2 + 3 * 4 =
+        core.enterOperation(KNumber(2), CalcEngine::FUNC_ADD);
+        core.enterOperation(KNumber(3), CalcEngine::FUNC_MULTIPLY);
+        core.enterOperation(KNumber(4), CalcEngine::FUNC_EQUAL);
+        QCOMPARE(core.lastOutput(error), KNumber(14));
+
+        // 1 + (1 + (... (1) ...)) =, nested deeper than the nodes kept inline
+        const int depth = 40;
+        for (int i = 0; i < depth; ++i) {
+            core.enterOperation(KNumber::One, CalcEngine::FUNC_ADD);
+            core.ParenOpen(KNumber::Zero);
+        }
+        KNumber inner = KNumber::One;
+        for (int i = 0; i < depth; ++i) {
+            core.ParenClose(inner);
+            inner = core.lastOutput(error);
+        }
+        core.enterOperation(inner, CalcEngine::FUNC_EQUAL);
+        QCOMPARE(core.lastOutput(error), KNumber(depth + 1));
+
+        // a number moved from is zero, not a dangling value
+        KNumber moved(7);
+        const KNumber taken(std::move(moved));
+        QCOMPARE(taken, KNumber(7));
+        QCOMPARE(moved, KNumber::Zero);
+        QCOMPARE(moved.toQString(), QStringLiteral("0"));
+
+        // 5 + 2 = = repeats "+ 2"
+        core.Reset();
+        core.setRepeatLastOperation(true);
+        core.enterOperation(KNumber(5), CalcEngine::FUNC_ADD);
+        core.enterOperation(KNumber(2), CalcEngine::FUNC_EQUAL);
+        core.enterOperation(core.lastOutput(error), CalcEngine::FUNC_EQUAL);
+        QCOMPARE(core.lastOutput(error), KNumber(9));
+        QVERIFY(!error);
+    }
+
+    void concurrentSessions()
+    {
+        QAtomicInt failures;
+        QThreadPool pool;
+        pool.setMaxThreadCount(qMax(4, QThread::idealThreadCount()));
+
+        for (int id = 0; id < 2000; ++id) {
+            pool.start(new KeyPadSession(id, failures));
+        }
+        QVERIFY(pool.waitForDone(120000));
+        QCOMPARE(failures.load(), 0);
+    }
+
+    void macro()
+    {
+        CalcEngine core;
+        KCalcMacro macro;
+        bool error;
+
+        // * 2 + 3 = x^2, recorded on whatever was displayed
+        {
+            KCalcMacro::Recorder recorder(macro);
+            recorder.enterOperation(CalcEngine::FUNC_MULTIPLY);
+            recorder.digit(2);
+            recorder.enterOperation(CalcEngine::FUNC_ADD);
+            recorder.digit(3);
+            recorder.enterOperation(CalcEngine::FUNC_EQUAL);
+            recorder.apply(KCalcMacro::Square);
+        }
+        QCOMPARE(macro.size(), 6);
+
+        // (2x + 3)^2 on the engine, carried on from its state
+        QCOMPARE(macro.run(core, KNumber(10)), KNumber(529));
+        QCOMPARE(core.lastOutput(error), KNumber(529));
+
+        const QVector<KNumber> results = macro.run({ KNumber(0), KNumber(1), KNumber(-2) });
+        QCOMPARE(results, QVector<KNumber>({ KNumber(9), KNumber(25), KNumber(1) }));
+
+        // a typed 5 stays typed although 5 was displayed
+        macro.clear();
+        {
+            KCalcMacro::Recorder recorder(macro);
+            recorder.enterOperation(CalcEngine::FUNC_ADD);
+            recorder.digit(5);
+            recorder.enterOperation(CalcEngine::FUNC_EQUAL);
+        }
+        QCOMPARE(macro.run({ KNumber(5), KNumber(7) }), QVector<KNumber>({ KNumber(10), KNumber(12) }));
+
+        // typed with a point, corrected and in hex
+        macro.clear();
+        {
+            KCalcMacro::Recorder recorder(macro);
+            recorder.enterOperation(CalcEngine::FUNC_MULTIPLY);
+            recorder.digit(1);
+            recorder.point();
+            recorder.digit(3);
+            recorder.backspace();
+            recorder.digit(2);
+            recorder.digit(5);
+            recorder.enterOperation(CalcEngine::FUNC_ADD);
+            recorder.setBase(NB_HEX);
+            recorder.digit(1);
+            recorder.digit(15);
+            recorder.enterOperation(CalcEngine::FUNC_EQUAL);
+        }
+        QCOMPARE(macro.run({ KNumber(4) }), QVector<KNumber>({ KNumber(36) }));
+
+        // (x + 4)!, brackets and functions of the engine
+        macro.clear();
+        {
+            KCalcMacro::Recorder recorder(macro);
+            recorder.apply(KCalcMacro::ParenOpen);
+            recorder.enterOperation(CalcEngine::FUNC_ADD);
+            recorder.digit(4);
+            recorder.parenClose();
+            recorder.apply(KCalcMacro::Factorial);
+        }
+        QCOMPARE(macro.run({ KNumber(2) }), QVector<KNumber>({ KNumber(720) }));
+
+        QAtomicInt canceled(1);
+        QVERIFY(macro.run(QVector<KNumber>(1000, KNumber::One), CalcEngine::Settings(), &canceled).isEmpty());
+    }
+
+    void statistics()
+    {
+        KStats stats;
+        for (const int x : { 1, 2, 4 }) {
+            stats.enterData(KNumber(x));
+        }
+
+        // exact fractions stay exact
+        QCOMPARE(stats.count(), 3);
+        QCOMPARE(stats.sum(), KNumber(7));
+        QCOMPARE(stats.sum_of_squares(), KNumber(21));
+        QCOMPARE(stats.mean(), KNumber(7) / KNumber(3));
+        QCOMPARE(stats.std_kernel(), KNumber(14) / KNumber(3));
+        QCOMPARE(stats.variance(), KNumber(14) / KNumber(9));
+        QCOMPARE(stats.sample_variance(), KNumber(7) / KNumber(3));
+        QVERIFY(!stats.error());
+
+        // clearing the last value restores the state before it
+        stats.clearLast();
+        QCOMPARE(stats.mean(), KNumber(3) / KNumber(2));
+        QCOMPARE(stats.std_kernel(), KNumber(1) / KNumber(2));
+        stats.clearLast();
+        stats.clearLast();
+        stats.mean();
+        QVERIFY(stats.error());
+
+        // Welford keeps a large offset from swallowing the variance
+        const KNumber offset(qint64(1000000000));
+        for (const QString &x : { QStringLiteral("4.5"), QStringLiteral("7.5"), QStringLiteral("13.5"), QStringLiteral("16.5") }) {
+            stats.enterData(offset + KNumber(x));
+        }
+        QVERIFY((stats.sample_variance() - KNumber(30)).abs() < KNumber(QStringLiteral("0.000001")));
+
+        // clearing past a checkpoint gives the totals entering gave
+        stats.clearAll();
+        for (int i = 1; i <= 200; ++i) {
+            stats.enterData(KNumber(i));
+        }
+        for (int i = 0; i < 130; ++i) {
+            stats.clearLast();
+        }
+        QCOMPARE(stats.sum(), KNumber(2485));
+        QCOMPARE(stats.mean(), KNumber(71) / KNumber(2));
+        QCOMPARE(stats.std_kernel(), KNumber(57155) / KNumber(2));
+
+        // a million values cost O(1) each, queries too
+        stats.clearAll();
+        for (int i = 1; i <= 1000000; ++i) {
+            stats.enterData(KNumber(i));
+        }
+        QBENCHMARK {
+            QCOMPARE(stats.mean(), KNumber(1000001) / KNumber(2));
+        }
+    }
+
+    void orderStatistics()
+    {
+        KStats stats;
+        for (const int x : { 7, 1, 4, 4, 10 }) {
+            stats.enterData(KNumber(x));
+        }
+
+        QCOMPARE(stats.median(), KNumber(4));
+        QCOMPARE(stats.minimum(), KNumber(1));
+        QCOMPARE(stats.maximum(), KNumber(10));
+        QCOMPARE(stats.rank(KNumber(4)), 3);
+        QCOMPARE(stats.rank(KNumber(0)), 0);
+        QCOMPARE(stats.percentile(KNumber(25)), KNumber(4));
+        QCOMPARE(stats.percentile(KNumber(90)), KNumber(44) / KNumber(5));
+        QCOMPARE(stats.percentile(KNumber(100)), KNumber(10));
+        QVERIFY(!stats.error());
+        stats.percentile(KNumber(101));
+        QVERIFY(stats.error());
+
+        // kept in sync with the data
+        stats.clearLast();
+        QCOMPARE(stats.median(), KNumber(4));
+        QCOMPARE(stats.maximum(), KNumber(7));
+        stats.clearLast();
+        QCOMPARE(stats.median(), KNumber(4));
+        QCOMPARE(stats.rank(KNumber(4)), 2);
+
+        // assigning a snapshot back only moves the values in between
+        const KStats snapshot = stats;
+        stats.enterData(KNumber(-5));
+        stats.enterData(KNumber(-6));
+        QCOMPARE(stats.minimum(), KNumber(-6));
+        stats = snapshot;
+        QCOMPARE(stats.minimum(), KNumber(1));
+        QCOMPARE(stats.count(), 3);
+        QCOMPARE(stats.rank(KNumber(100)), 3);
+
+        // repeated errors are found again when they leave
+        KStats errors;
+        for (const KNumber &x : { KNumber::NaN, KNumber::PosInfinity, KNumber(2) }) {
+            errors.enterData(x);
+        }
+        const KStats kept = errors;
+        for (const KNumber &x : { KNumber::NaN, KNumber::NegInfinity, KNumber::PosInfinity, KNumber::NaN }) {
+            errors.enterData(x);
+        }
+        QCOMPARE(errors.median().toQString(), QStringLiteral("inf"));
+        QCOMPARE(errors.minimum().toQString(), QStringLiteral("-inf"));
+        errors.clearLast();
+        errors.clearLast();
+        QCOMPARE(errors.rank(KNumber(2)), 2);
+        errors = kept;
+        QCOMPARE(errors.count(), 3);
+        QCOMPARE(errors.minimum(), KNumber(2));
+        QCOMPARE(errors.median().toQString(), QStringLiteral("inf"));
+        QCOMPARE(errors.maximum().toQString(), QStringLiteral("nan"));
+        errors.clearLast();
+        errors.clearLast();
+        QCOMPARE(errors.median().toQString(), QStringLiteral("nan"));
+
+        // O(log n) per query on a million values
+        stats.clearAll();
+        for (int i = 1000000; i > 0; --i) {
+            stats.enterData(KNumber(i));
+        }
+        QCOMPARE(stats.median(), KNumber(1000001) / KNumber(2));
+        QBENCHMARK {
+            stats.enterData(KNumber::Zero);
+            QCOMPARE(stats.minimum(), KNumber::Zero);
+            stats.clearLast();
+            QCOMPARE(stats.percentile(KNumber(99)), KNumber(99000001) / KNumber(100));
+        }
+    }
+
+    void importData()
+    {
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+
+        const auto write = [&dir](const QString &name, const QByteArray &data) {
+            QFile file(dir.filePath(name));
+            file.open(QIODevice::WriteOnly);
+            file.write(data);
+            return file.fileName();
+        };
+
+        const auto read = [](const QString &fileName, int chunkSize, int column, qint64 &skipped) {
+            KCalcImport import;
+            QSignalSpy progress(&import, &KCalcImport::progress);
+            QSignalSpy finished(&import, &KCalcImport::finished);
+            import.setChunkSize(chunkSize);
+            import.setColumn(column);
+            if (!import.start(fileName)) {
+                return QVector<KNumber>();
+            }
+            import.waitForFinished();
+            if (finished.count() != 1 || !finished.at(0).at(0).toBool()
+                || progress.last().at(0).toLongLong() != import.size()) {
+                return QVector<KNumber>();
+            }
+            skipped = import.skipped();
+            return import.takeValues();
+        };
+
+        // a header and quoted fields, lines cut at every chunk size
+        QByteArray csv("\xEF\xBB\xBFtime,value\n");
+        QVector<KNumber> expected;
+        for (int i = 0; i < 1000; ++i) {
+            csv += QStringLiteral("%1, \"%1.5\"\r\n").arg(i).toLatin1();
+            expected.push_back(KNumber(2 * i + 1) / KNumber(2));
+        }
+        const QString csvFile = write(QStringLiteral("samples.csv"), csv);
+
+        for (const int chunkSize : { 1, 7, 100, 1 << 20 }) {
+            qint64 skipped = 0;
+            QCOMPARE(read(csvFile, chunkSize, 1, skipped), expected);
+            QCOMPARE(skipped, qint64(1));
+            QCOMPARE(read(csvFile, chunkSize, -1, skipped).size(), 2000);
+            QCOMPARE(skipped, qint64(2));
+        }
+
+        // columns separated by white space, no newline at the end
+        qint64 skipped = 0;
+        const QVector<KNumber> text = read(write(QStringLiteral("samples.txt"), "1 2 3\n-4E2\t5/2\n  x 6\n7"), 3, -1, skipped);
+        QCOMPARE(text, QVector<KNumber>() << KNumber(1) << KNumber(2) << KNumber(3) << KNumber(-400)
+                                          << KNumber(5) / KNumber(2) << KNumber(6) << KNumber(7));
+        QCOMPARE(skipped, qint64(1));
+
+        // binary, no finite double and the cut off value are skipped
+        QByteArray doubles;
+        for (const double x : { 0.25, -3.0, qQNaN(), 1e10 }) {
+            quint64 bits;
+            std::memcpy(&bits, &x, sizeof(bits));
+            bits = qToLittleEndian(bits);
+            doubles.append(reinterpret_cast<const char *>(&bits), sizeof(bits));
+        }
+        doubles.append("\0\0\0", 3);
+        QCOMPARE(read(write(QStringLiteral("samples.f64"), doubles), 16, -1, skipped),
+                 QVector<KNumber>() << KNumber(0.25) << KNumber(-3) << KNumber(qint64(10000000000)));
+        QCOMPARE(skipped, qint64(2));
+
+        const qint32 int32[] = { qToLittleEndian<qint32>(-7), qToLittleEndian<qint32>(2147483647) };
+        QCOMPARE(read(write(QStringLiteral("samples.i32"), QByteArray(reinterpret_cast<const char *>(int32), sizeof(int32))), 5, -1, skipped),
+                 QVector<KNumber>() << KNumber(-7) << KNumber(2147483647));
+
+        // straight into the statistic mode
+        CalcEngine core;
+        bool error;
+        core.StatDataNew(KNumber(1));
+        core.StatMedian(KNumber::Zero);
+        core.StatDataImport(expected);
+        QCOMPARE(core.lastOutput(error), KNumber(1001));
+        core.StatSum(KNumber::Zero);
+        QCOMPARE(core.lastOutput(error), KNumber(500001));
+        core.StatMedian(KNumber::Zero);
+        QCOMPARE(core.lastOutput(error), KNumber(999) / KNumber(2));
+    }
+
+    void undoHistory()
+    {
+        CalcEngine core;
+        KCalcHistory history;
+        bool error;
+
+        const auto record = [&](const QString &input) {
+            KCalcHistory::State state;
+            state.core = core.snapshot();
+            state.input = input;
+            history.record(state);
+        };
+
+        record(QString());
+        for (int i = 1; i <= 3; ++i) {
+            core.StatDataNew(KNumber(i));
+            record(QString::number(i));
+        }
+        core.enterOperation(KNumber(2), CalcEngine::FUNC_ADD);
+        record(QStringLiteral("2+"));
+        record(QStringLiteral("2+"));
+        QCOMPARE(history.count(), 5);
+
+        // back to two values, with nothing pending
+        history.undo();
+        core.restore(history.undo().core);
+        QCOMPARE(history.undo().input, QStringLiteral("1"));
+        core.restore(history.redo().core);
+        core.StatCount(KNumber::Zero);
+        QCOMPARE(core.lastOutput(error), KNumber(2));
+        core.enterOperation(KNumber(3), CalcEngine::FUNC_EQUAL);
+        QCOMPARE(core.lastOutput(error), KNumber(3));
+
+        // recording drops what could be redone
+        QVERIFY(history.canRedo());
+        record(QStringLiteral("3"));
+        QVERIFY(!history.canRedo());
+
+        // snapshots share the data, a hundred thousand values are cheap
+        for (int i = 0; i < 100000; ++i) {
+            core.StatDataNew(KNumber(i));
+            record(QString());
+        }
+        QVERIFY(history.bytes() < 64 << 20);
+        core.restore(history.undo().core);
+        core.StatCount(KNumber::Zero);
+        QCOMPARE(core.lastOutput(error), KNumber(100001));
+
+        // the oldest states go once the budget is exceeded
+        history.setBudget(4096);
+        QVERIFY(history.bytes() <= 4096);
+        QVERIFY(history.count() < 100);
+        QVERIFY(history.canRedo());
+    }
+
+    void deepNesting_data()
+    {
+        QTest::addColumn<QString>("input");
+        QTest::addColumn<int>("result");
+
+        // about 1 MB each, far deeper than a recursive parser survives
+        const int levels = 250000;
+        QTest::addRow("left nested") << QString(QStringLiteral("(")).repeated(levels) + QStringLiteral("1")
+                + QString(QStringLiteral("+1)")).repeated(levels) << levels + 1;
+        QTest::addRow("right nested") << QString(QStringLiteral("1+(")).repeated(levels) + QStringLiteral("1")
+                + QString(QStringLiteral(")")).repeated(levels) << levels + 1;
+    }
+
+    void deepNesting()
+    {
+        QFETCH(QString, input);
+        QFETCH(int, result);
+
+        QSignalSpy spy(parser, SIGNAL(foundInvalidToken(int)));
+
+        QCOMPARE(parser->parseExpression(input), KNumber(result));
+        QCOMPARE(spy.count(), 0);
+
+        parser->setOptimize(false);
+        const auto program = parser->compile(input);
+        parser->setOptimize(true);
+
+        QCOMPARE(parser->evaluate(program), KNumber(result));
+
+        QBENCHMARK_ONCE {
+            parser->parseExpression(input);
+        }
+    }
+
+    void trigonometry_data()
+    {
+        QTest::addColumn<int>("mode");
+        QTest::addColumn<QString>("input");
+        QTest::addColumn<KNumber>("result");
+
+        const KNumber half = KNumber::One / KNumber(2);
+        QTest::addRow("sin 30 deg") << int(A_DEG) << "sin(30)" << half;
+        QTest::addRow("cos 60 deg") << int(A_DEG) << "cos(60)" << half;
+        QTest::addRow("sin -90 deg") << int(A_DEG) << "sin(-90)" << KNumber::NegOne;
+        QTest::addRow("cos 180 deg") << int(A_DEG) << "cos(180)" << KNumber::NegOne;
+        QTest::addRow("tan 45 deg") << int(A_DEG) << "tan(45)" << KNumber::One;
+        QTest::addRow("tan 135 deg") << int(A_DEG) << "tan(135)" << KNumber::NegOne;
+        QTest::addRow("large deg") << int(A_DEG) << "sin(10^30 + 30)" << half;
+        QTest::addRow("fraction deg") << int(A_DEG) << "cos(720 + 120)" << -half;
+        QTest::addRow("sin 100 grad") << int(A_GRAD) << "sin(100)" << KNumber::One;
+        QTest::addRow("cos 400 grad") << int(A_GRAD) << "cos(400)" << KNumber::One;
+        QTest::addRow("sin 0 rad") << int(A_RAD) << "sin(0)" << KNumber::Zero;
+        QTest::addRow("cos 0 rad") << int(A_RAD) << "cos(0)" << KNumber::One;
+    }
+
+    void trigonometry()
+    {
+        QFETCH(int, mode);
+        QFETCH(QString, input);
+        QFETCH(KNumber, result);
+
+        KCalcParser parser;
+        parser.addDefaultParser();
+        parser.setNumBase(NB_DECIMAL);
+        parser.setAngleMode(AngleMode(mode));
+
+        QCOMPARE(parser.parseExpression(input), result);
+
+        QBENCHMARK {
+            parser.evaluate(parser.compile(input));
+        }
+    }
+
+    void radians()
+    {
+        QCOMPARE(KCalcTrig::sin(KNumber::One, A_RAD).toQString(10), KNumber::One.sin().toQString(10));
+        QCOMPARE(KCalcTrig::cos(KNumber(2), A_RAD).toQString(10), KNumber(2).cos().toQString(10));
+
+        // large arguments keep their accuracy, sin(10^22) from an
+        // independent high precision reduction
+        const KNumber expected(QStringLiteral("-0.8522008497671888017727058937530293682618"));
+        const KNumber large = KNumber(10).pow(KNumber(22));
+        QVERIFY((KCalcTrig::sin(large, A_RAD) - expected).abs() < KNumber(QStringLiteral("1e-14")));
+        QCOMPARE(KCalcTrig::toRadians(KNumber(180), A_DEG), KCalcTrig::pi());
+        QVERIFY(KCalcTrig::sin(KNumber::NaN, A_DEG).type() == KNumber::TYPE_ERROR);
+    }
+
+    void resultCache()
+    {
+        KCalcParser parser;
+        parser.addDefaultParser();
+        parser.setNumBase(NB_DECIMAL);
+        KCalcResultCache &cache = parser.resultCache();
+
+        QCOMPARE(parser.parseExpression(QStringLiteral("2^100 + 1")), KNumber(QStringLiteral("1267650600228229401496703205377")));
+        QCOMPARE(cache.misses(), quint64(1));
+
+        // whitespace does not matter
+        QCOMPARE(parser.parseExpression(QStringLiteral(" 2 ^ 100+1")), KNumber(QStringLiteral("1267650600228229401496703205377")));
+        QCOMPARE(cache.hits(), quint64(1));
+        QCOMPARE(cache.hitRate(), 0.5);
+
+        // the base is part of the key
+        parser.setNumBase(NB_HEX);
+        QCOMPARE(parser.parseExpression(QStringLiteral("10 + 1")), KNumber(17));
+        parser.setNumBase(NB_DECIMAL);
+        QCOMPARE(parser.parseExpression(QStringLiteral("10 + 1")), KNumber(11));
+        QCOMPARE(cache.hits(), quint64(1));
+
+        // errors are reported on every call
+        QSignalSpy spy(&parser, SIGNAL(foundInvalidToken(int)));
+        parser.parseExpression(QStringLiteral("(1 + 2"));
+        parser.parseExpression(QStringLiteral("(1 + 2"));
+        QCOMPARE(spy.count(), 2);
+
+        // the GUI compiles and looks up the same key
+        QString key;
+        parser.compile(QStringLiteral("2^100+1"), key);
+        KNumber cached;
+        QVERIFY(cache.find(key, cached));
+        QCOMPARE(cached, KNumber(QStringLiteral("1267650600228229401496703205377")));
+        parser.compile(QStringLiteral("(1 + 2"), key);
+        QVERIFY(key.isEmpty());
+
+        // defining a function invalidates
+        QVERIFY(cache.count() > 0);
+        QVERIFY(parser.defineFunction(QStringLiteral("g(x) = x + 1")));
+        QCOMPARE(cache.count(), 0);
+
+        // bounded in bytes, the most recent results stay
+        cache.setMaxBytes(4096);
+        for (int i = 0; i < 1000; ++i) {
+            parser.parseExpression(QStringLiteral("%1!").arg(i % 100));
+        }
+        QVERIFY(cache.bytes() <= 4096);
+        cache.resetStatistics();
+        parser.parseExpression(QStringLiteral("99!"));
+        QCOMPARE(cache.hits(), quint64(1));
+    }
+
+    void preview()
+    {
+        KCalcPreview preview(*parser);
+        preview.setDelay(10);
+
+        qRegisterMetaType<KNumber>();
+        QSignalSpy spy(&preview, SIGNAL(resultReady(KNumber)));
+
+        // only the latest text is evaluated
+        preview.setExpression(QStringLiteral("2^3"));
+        preview.setExpression(QStringLiteral("2^4"));
+
+        QTRY_COMPARE(spy.count(), 1);
+        QCOMPARE(spy.at(0).at(0).value<KNumber>(), KNumber(16));
+
+        // nothing to preview
+        preview.setExpression(QStringLiteral("10x+"));
+        preview.setExpression(QStringLiteral("42"));
+        QTest::qWait(100);
+        QCOMPARE(spy.count(), 1);
+    }
+
+    void table()
+    {
+        QVERIFY(KCalcTable::isTable(QStringLiteral("table(x^2, x, 0, 1, 0.5)")));
+        QVERIFY(!KCalcTable::isTable(QStringLiteral("x^2")));
+
+        KCalcTable table;
+        QVERIFY(!table.start(*parser, QStringLiteral("table(x^2, x, 0, 1)")));
+        QVERIFY(!table.start(*parser, QStringLiteral("table(x^2, sin, 0, 1, 1)")));
+        QVERIFY(!table.start(*parser, QStringLiteral("table(x^2, x, 1, 0, 1)")));
+        QVERIFY(!table.start(*parser, QStringLiteral("table(x^2, x, 0, 1, -1)")));
+        QVERIFY(!table.start(*parser, QStringLiteral("table(x^2, x, 0, 1, 0)")));
+        QVERIFY(!table.start(*parser, QStringLiteral("table(x^2, x, 0, 1, 0.000000001)")));
+
+        KCalcTable descending;
+        QVERIFY(descending.start(*parser, QStringLiteral("table(x^2, x, 3, 0, -1)")));
+        QCOMPARE(descending.count(), qint64(4));
+
+        QVector<KNumber> arguments;
+        QVector<KNumber> results;
+        bool ordered = true;
+        bool finished = false;
+
+        table.setChunkSize(100);
+        connect(&table, &KCalcTable::rowsReady, this, [&](qint64 first, const QVector<KNumber> &xs, const QVector<KNumber> &ys) {
+            ordered = ordered && first == arguments.size();
+            arguments += xs;
+            results += ys;
+        });
+        connect(&table, &KCalcTable::finished, this, [&finished]() { finished = true; });
+
+        QVERIFY(table.start(*parser, QStringLiteral("table(x^2 + 1, x, 0, 10, 0.001)")));
+        QCOMPARE(table.count(), qint64(10001));
+
+        QTRY_VERIFY_WITH_TIMEOUT(finished, 30000);
+        QVERIFY(ordered);
+        QCOMPARE(arguments.size(), 10001);
+        QCOMPARE(results.at(0), KNumber::One);
+        QCOMPARE(results.at(2000), KNumber(5));
+        QCOMPARE(results.last(), KNumber(101));
+
+        QString csv;
+        QTextStream stream(&csv);
+        KCalcTable::writeCsv(stream, arguments.mid(0, 2), results.mid(0, 2));
+        QCOMPARE(csv.count(QLatin1Char('\n')), 2);
+    }
+
+    void executor()
+    {
+        KCalcExecutor executor;
+        QSignalSpy busy(&executor, SIGNAL(busyChanged(bool)));
+
+        // results arrive in submission order, whatever the work takes
+        QVector<int> order;
+        for (int i = 0; i < 4; ++i) {
+            executor.submit([i]() -> KCalcExecutor::Work {
+                return [i](const QAtomicInt &) {
+                    QThread::msleep(40 - i * 10);
+                    return KNumber(i);
+                };
+            }, [&order](const KNumber &result) {
+                order.append(result.toInt64());
+            });
+        }
+
+        QVERIFY(executor.isBusy());
+        QTRY_VERIFY(!executor.isBusy());
+        QCOMPARE(order, QVector<int>({0, 1, 2, 3}));
+        QCOMPARE(busy.count(), 2);
+
+        // jobs handled while preparing do not occupy the worker
+        bool prepared = false;
+        executor.submit([&prepared]() {
+            prepared = true;
+            return KCalcExecutor::Work();
+        });
+        QVERIFY(prepared);
+        QVERIFY(!executor.isBusy());
+
+        // canceling drops the running and all queued results
+        order.clear();
+        QAtomicInt returned;
+        for (int i = 0; i < 3; ++i) {
+            executor.submit([i, &returned]() -> KCalcExecutor::Work {
+                return [i, &returned](const QAtomicInt &canceled) {
+                    while (!canceled.load()) {
+                        QThread::msleep(1);
+                    }
+                    returned.ref();
+                    return KNumber(i);
+                };
+            }, [&order](const KNumber &result) {
+                order.append(result.toInt64());
+            });
+        }
+        executor.cancel();
+
+        // the next job is only prepared once the canceled work returned
+        prepared = false;
+        executor.submit([&prepared, &returned]() {
+            prepared = returned.load() == 1;
+            return KCalcExecutor::Work();
+        });
+        QVERIFY(executor.isBusy());
+        QTRY_VERIFY(executor.isIdle());
+        QVERIFY(prepared);
+        QVERIFY(!executor.isBusy());
+        QVERIFY(order.isEmpty());
+    }
+
+    void batch()
+    {
+        QString input = QStringLiteral("1 + 2\n"
+                                       "\n"
+                                       "sq(x) = x * x\n"
+                                       "sq(12)\n"
+                                       "1 + 2\n"
+                                       "10x+\n"
+                                       "2^10\n");
+        QString output;
+        QString errors;
+        QTextStream in(&input);
+        QTextStream out(&output);
+        QTextStream err(&errors);
+
+        KCalcBatch batch;
+        QCOMPARE(batch.run(in, out, err), 1);
+        QCOMPARE(output, QStringLiteral("3\n\n\n144\n3\n\n1024\n"));
+        QVERIFY(errors.contains(QStringLiteral("line 6")));
+
+        QCOMPARE(KCalcBatch::formatNumber(KNumber(255), NB_HEX, 12), QStringLiteral("FF"));
+        QCOMPARE(KCalcBatch::formatNumber(KNumber(-5), NB_BINARY, 12), QStringLiteral("-101"));
+    }
+
+    void parallelBatch_data()
+    {
+        QTest::addColumn<int>("jobs");
+
+        QTest::addRow("1 job") << 1;
+        QTest::addRow("2 jobs") << 2;
+        QTest::addRow("4 jobs") << 4;
+        QTest::addRow("8 jobs") << 8;
+    }
+
+    void parallelBatch()
+    {
+        QFETCH(int, jobs);
+
+        // the same output as one job, definitions in between apply to
+        // the following lines only
+        QString input;
+        for (int i = 0; i < 20000; ++i) {
+            if (i % 5000 == 0) {
+                input += QStringLiteral("f(x) = x + %1\n").arg(i);
+            }
+            input += QStringLiteral("f(%1) * 3! - (%1 mod 7)^9 / 3^9\n").arg(i);
+        }
+        input += QStringLiteral("10x+\n");
+
+        KCalcBatch reference;
+        QString output;
+        QString errors;
+        {
+            QTextStream in(&input);
+            QTextStream out(&output);
+            QTextStream err(&errors);
+            QCOMPARE(reference.run(in, out, err), 1);
+        }
+
+        QBENCHMARK {
+            KCalcBatch batch;
+            batch.setJobs(jobs);
+            batch.setChunkSize(256);
+
+            QString parallel;
+            QString parallelErrors;
+            QTextStream in(&input);
+            QTextStream out(&parallel);
+            QTextStream err(&parallelErrors);
+            QCOMPARE(batch.run(in, out, err), 1);
+            QCOMPARE(parallel, output);
+            QCOMPARE(parallelErrors, errors);
+        }
+    }
+
+    void server()
+    {
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        const QString path = dir.filePath(QStringLiteral("kcalc.sock"));
+
+        KCalcServer server;
+        server.settings().setJobs(4);
+        server.setBatchSize(16);
+        QVERIFY(server.listen(path));
+
+        QLocalSocket socket;
+        socket.connectToServer(path);
+        QVERIFY(socket.waitForConnected(5000));
+        QTRY_COMPARE(server.connectionCount(), 1);
+
+        // pipelined in one write, with errors in between
+        QByteArray requests;
+        for (int i = 0; i < 500; ++i) {
+            requests += QStringLiteral("{\"id\": %1, \"expression\": \"%1 * 2 + 1\"}\n").arg(i).toUtf8();
+        }
+        requests += "{\"id\": \"bad\", \"expression\": \"10x+\"}\n";
+        requests += "{\"id\": \"define\", \"expression\": \"f(x) = x\"}\n";
+        requests += "garbage\n";
+        socket.write(requests);
+
+        QList<QJsonObject> responses;
+        QByteArray buffer;
+        QTRY_VERIFY_WITH_TIMEOUT((buffer += socket.readAll(), buffer.count('\n') == 503), 30000);
+        for (const QByteArray &line : buffer.split('\n')) {
+            if (!line.isEmpty()) {
+                responses.push_back(QJsonDocument::fromJson(line).object());
+            }
+        }
+
+        QCOMPARE(responses.size(), 503);
+        for (int i = 0; i < 500; ++i) {
+            QCOMPARE(responses.at(i).value(QStringLiteral("id")).toInt(), i);
+            QCOMPARE(responses.at(i).value(QStringLiteral("result")).toString(), QString::number(i * 2 + 1));
+        }
+        QCOMPARE(responses.at(500).value(QStringLiteral("id")).toString(), QStringLiteral("bad"));
+        QVERIFY(responses.at(500).contains(QStringLiteral("error")));
+        QVERIFY(responses.at(501).contains(QStringLiteral("error")));
+        QVERIFY(responses.at(502).value(QStringLiteral("id")).isNull());
+        QVERIFY(responses.at(502).contains(QStringLiteral("error")));
+
+        // neither a live server's socket nor any other file is replaced
+        KCalcServer second;
+        QVERIFY(!second.listen(path));
+        QCOMPARE(socket.state(), QLocalSocket::ConnectedState);
+
+        const QString data = dir.filePath(QStringLiteral("data.txt"));
+        QFile file(data);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        file.write("1\n");
+        file.close();
+        QVERIFY(!second.listen(data));
+        QVERIFY(QFile::exists(data));
+
+        socket.disconnectFromServer();
+        QTRY_COMPARE(server.connectionCount(), 0);
+    }
+
 private:
     KCalcParser *parser;
 };